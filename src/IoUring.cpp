@@ -0,0 +1,372 @@
+#include "IoUring.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+  constexpr unsigned RING_ENTRIES = 64;
+  // Provided buffers for the multishot recvs; a potato larger than one buffer simply arrives in several completions
+  constexpr unsigned BUFFER_COUNT = 64; // Must be a power of two
+  constexpr std::size_t BUFFER_SIZE = 16 * 1024;
+  constexpr std::uint16_t BUFFER_GROUP = 0;
+
+  // The operation of a completion is kept in the upper half of its user_data and the stream index in the lower half
+  constexpr std::uint64_t OP_RECV = 1;
+  constexpr std::uint64_t OP_SEND = 2;
+
+  // Compact a stream buffer once this many consumed bytes have piled up at its front
+  constexpr std::size_t COMPACT_THRESHOLD = 64 * 1024;
+
+  // Helper function
+  int ioUringSetup(unsigned entries, io_uring_params * params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+  }
+
+  // Helper function
+  int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+  }
+
+  // Helper function
+  int ioUringRegister(int fd, unsigned opcode, void * arg, unsigned nrArgs) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+  }
+
+  // Helper function
+  unsigned * ringField(void * ring, unsigned offset) {
+    return reinterpret_cast<unsigned *>(static_cast<char *>(ring) + offset);
+  }
+}
+
+std::unique_ptr<IoUring> IoUring::create(const std::vector<int> & fds) {
+  std::unique_ptr<IoUring> ring(new IoUring());
+  if (!ring->setup()) {
+    return nullptr;
+  }
+  for (int fd : fds) {
+    Stream stream;
+    stream.fd = fd;
+    ring->streams_.push_back(std::move(stream));
+  }
+  for (std::size_t i = 0; i < ring->streams_.size(); ++i) {
+    ring->armRecv(i);
+  }
+  return ring;
+}
+
+bool IoUring::setup() {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  // Only this thread submits, and completions only need to be processed when it waits
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  ringFd_ = ioUringSetup(RING_ENTRIES, &params);
+  if (ringFd_ < 0 && errno == EINVAL) {
+    std::memset(&params, 0, sizeof(params));
+    ringFd_ = ioUringSetup(RING_ENTRIES, &params);
+  }
+  if (ringFd_ < 0) {
+    return false; // ENOSYS, or EPERM if io_uring is disabled by kernel.io_uring_disabled
+  }
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMmap) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+  sqRing_ = ::mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) {
+    sqRing_ = nullptr;
+    return false;
+  }
+  if (singleMmap) {
+    cqRing_ = sqRing_;
+  }
+  else {
+    cqRing_ = ::mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) {
+      cqRing_ = nullptr;
+      return false;
+    }
+  }
+  sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+  void * sqes = ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  sqHead_ = ringField(sqRing_, params.sq_off.head);
+  sqTail_ = ringField(sqRing_, params.sq_off.tail);
+  sqMask_ = *ringField(sqRing_, params.sq_off.ring_mask);
+  sqArray_ = ringField(sqRing_, params.sq_off.array);
+  cqHead_ = ringField(cqRing_, params.cq_off.head);
+  cqTail_ = ringField(cqRing_, params.cq_off.tail);
+  cqMask_ = *ringField(cqRing_, params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(cqRing_) + params.cq_off.cqes);
+
+  // The buffer ring must be page aligned, which an anonymous mapping always is
+  bufRingSize_ = BUFFER_COUNT * sizeof(io_uring_buf);
+  void * bufRing = ::mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufRing == MAP_FAILED) {
+    return false;
+  }
+  bufRing_ = static_cast<io_uring_buf_ring *>(bufRing);
+  io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<std::uint64_t>(bufRing_);
+  reg.ring_entries = BUFFER_COUNT;
+  reg.bgid = BUFFER_GROUP;
+  if (ioUringRegister(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    return false; // Provided buffer rings need Linux 5.19
+  }
+  buffers_.resize(BUFFER_COUNT * BUFFER_SIZE);
+  bufRing_->tail = 0;
+  for (unsigned bid = 0; bid < BUFFER_COUNT; ++bid) {
+    recycleBuffer(static_cast<std::uint16_t>(bid));
+  }
+  return true;
+}
+
+IoUring::~IoUring() {
+  // Closing the ring cancels the multishot recvs still armed
+  if (ringFd_ >= 0) {
+    ::close(ringFd_);
+  }
+  if (bufRing_ != nullptr) {
+    ::munmap(bufRing_, bufRingSize_);
+  }
+  if (sqes_ != nullptr) {
+    ::munmap(sqes_, sqesSize_);
+  }
+  if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+    ::munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_ != nullptr) {
+    ::munmap(sqRing_, sqRingSize_);
+  }
+}
+
+std::size_t IoUring::streamIndex(int fd) const {
+  for (std::size_t i = 0; i < streams_.size(); ++i) {
+    if (streams_[i].fd == fd) {
+      return i;
+    }
+  }
+  throw std::runtime_error("Socket " + std::to_string(fd) + " is not watched by the io_uring engine");
+}
+
+std::size_t IoUring::available(int fd) const {
+  const Stream & stream = streams_[streamIndex(fd)];
+  return stream.data.size() - stream.head;
+}
+
+const char * IoUring::peek(int fd) const {
+  const Stream & stream = streams_[streamIndex(fd)];
+  return stream.data.data() + stream.head;
+}
+
+void IoUring::consume(int fd, std::size_t len) {
+  Stream & stream = streams_[streamIndex(fd)];
+  stream.head += len;
+  if (stream.head == stream.data.size()) {
+    stream.data.clear();
+    stream.head = 0;
+  }
+  else if (stream.head >= COMPACT_THRESHOLD) {
+    stream.data.erase(stream.data.begin(), stream.data.begin() + static_cast<std::ptrdiff_t>(stream.head));
+    stream.head = 0;
+  }
+}
+
+bool IoUring::closed(int fd) const {
+  return streams_[streamIndex(fd)].closed;
+}
+
+void IoUring::recvAll(int fd, char * buf, std::size_t len) {
+  while (available(fd) < len) {
+    if (closed(fd)) {
+      throw std::runtime_error("Peer closed connection before all data was received");
+    }
+    wait();
+  }
+  std::memcpy(buf, peek(fd), len);
+  consume(fd, len);
+}
+
+std::vector<char> IoUring::acquireBuffer() {
+  if (spareBuffers_.empty()) {
+    return std::vector<char>();
+  }
+  std::vector<char> buf = std::move(spareBuffers_.back());
+  spareBuffers_.pop_back();
+  return buf;
+}
+
+void IoUring::send(int fd, std::vector<char> && data) {
+  std::size_t index = streamIndex(fd);
+  Stream & stream = streams_[index];
+  stream.sendQueue.push_back(std::move(data));
+  if (!stream.sending) {
+    submitSend(index);
+  }
+}
+
+void IoUring::wait() {
+  // A completed send satisfies the wait as well as a recv does, so the callers loop until the data they expect is buffered
+  enter(1);
+  reap();
+}
+
+void IoUring::drainSends() {
+  while (sendsPending()) {
+    enter(sendsInFlight());
+    reap();
+  }
+}
+
+std::vector<int> IoUring::fds() const {
+  std::vector<int> result;
+  for (const Stream & stream : streams_) {
+    result.push_back(stream.fd);
+  }
+  return result;
+}
+
+io_uring_sqe * IoUring::nextSqe() {
+  unsigned tail = *sqTail_;
+  if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) > sqMask_) {
+    enter(0);
+  }
+  unsigned index = tail & sqMask_;
+  io_uring_sqe * sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqArray_[index] = index;
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+  toSubmit_++;
+  return sqe;
+}
+
+void IoUring::armRecv(std::size_t index) {
+  io_uring_sqe * sqe = nextSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = streams_[index].fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = (OP_RECV << 32) | index;
+}
+
+void IoUring::submitSend(std::size_t index) {
+  Stream & stream = streams_[index];
+  const std::vector<char> & message = stream.sendQueue.front();
+  io_uring_sqe * sqe = nextSqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = stream.fd;
+  sqe->addr = reinterpret_cast<std::uint64_t>(message.data() + stream.sendOffset);
+  sqe->len = static_cast<std::uint32_t>(message.size() - stream.sendOffset);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (OP_SEND << 32) | index;
+  stream.sending = true;
+}
+
+void IoUring::recycleBuffer(std::uint16_t bid) {
+  unsigned short tail = bufRing_->tail;
+  // Index the entries by hand: in C++ the empty struct in the header's flexible array wrapper takes a byte, which shifts bufs[] out of place
+  io_uring_buf * buf = reinterpret_cast<io_uring_buf *>(bufRing_) + (tail & (BUFFER_COUNT - 1));
+  buf->addr = reinterpret_cast<std::uint64_t>(buffers_.data() + bid * BUFFER_SIZE);
+  buf->len = static_cast<std::uint32_t>(BUFFER_SIZE);
+  buf->bid = bid;
+  __atomic_store_n(&bufRing_->tail, static_cast<unsigned short>(tail + 1), __ATOMIC_RELEASE);
+}
+
+void IoUring::enter(unsigned minComplete) {
+  unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (true) {
+    enterCalls_++;
+    int submitted = ioUringEnter(ringFd_, toSubmit_, minComplete, flags);
+    if (submitted >= 0) {
+      toSubmit_ -= static_cast<unsigned>(submitted);
+      return;
+    }
+    if (errno != EINTR) {
+      throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+    }
+  }
+}
+
+unsigned IoUring::reap() {
+  unsigned head = *cqHead_;
+  unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  unsigned count = 0;
+  for (; head != tail; ++head, ++count) {
+    io_uring_cqe cqe = cqes_[head & cqMask_];
+    // Free the slot right away: handling the completion may queue new entries and enter the kernel
+    __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+    std::uint64_t op = cqe.user_data >> 32;
+    std::size_t index = static_cast<std::size_t>(cqe.user_data & 0xffffffffu);
+    Stream & stream = streams_[index];
+
+    if (op == OP_RECV) {
+      if (cqe.res > 0) {
+        std::uint16_t bid = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        const char * data = buffers_.data() + bid * BUFFER_SIZE;
+        stream.data.insert(stream.data.end(), data, data + cqe.res);
+        recycleBuffer(bid);
+      }
+      else if (cqe.res == 0) {
+        stream.closed = true;
+        continue;
+      }
+      else if (cqe.res != -ENOBUFS) {
+        throw std::runtime_error(std::string("io_uring recv failed: ") + std::strerror(-cqe.res));
+      }
+      if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+        armRecv(index); // The kernel stopped the multishot recv, e.g. because it ran out of buffers
+      }
+    }
+    else if (op == OP_SEND) {
+      if (cqe.res < 0) {
+        throw std::runtime_error(std::string("io_uring send failed: ") + std::strerror(-cqe.res));
+      }
+      stream.sendOffset += static_cast<std::size_t>(cqe.res);
+      stream.sending = false;
+      if (stream.sendOffset == stream.sendQueue.front().size()) {
+        spareBuffers_.push_back(std::move(stream.sendQueue.front()));
+        stream.sendQueue.pop_front();
+        stream.sendOffset = 0;
+      }
+      if (!stream.sendQueue.empty()) {
+        submitSend(index);
+      }
+    }
+  }
+  return count;
+}
+
+unsigned IoUring::sendsInFlight() const {
+  unsigned count = 0;
+  for (const Stream & stream : streams_) {
+    if (stream.sending) {
+      count++;
+    }
+  }
+  return count;
+}
+
+bool IoUring::sendsPending() const {
+  for (const Stream & stream : streams_) {
+    if (!stream.sendQueue.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
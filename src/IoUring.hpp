@@ -0,0 +1,195 @@
+#pragma once
+#ifndef IO_URING_HPP
+#define IO_URING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/**
+ * An io_uring I/O engine for a fixed set of connected stream sockets, driven with the raw system calls.
+ * Every socket has a multishot recv armed that fills buffers from a ring of provided buffers registered with the kernel; 
+ * the received bytes are copied into a per-socket stream buffer that the caller reads from. Sends are queued as SQEs and 
+ * submitted together with the next wait, so a hop that sends one potato and waits for the next costs a single io_uring_enter call.
+ * Once an engine watches a socket, every read of that socket must go through the engine, since the kernel hands the data to the engine.
+ * An engine must only be used from one thread.
+ */
+class IoUring {
+public:
+  /**
+   * Create an engine watching the given sockets.
+   * @param fds the connected stream sockets to receive from and send to
+   * @return the engine, or nullptr if io_uring, provided buffer rings or multishot recv are not available, so that the caller can fall back to blocking I/O
+   */
+  static std::unique_ptr<IoUring> create(const std::vector<int> & fds);
+  ~IoUring();
+
+  IoUring(const IoUring &) = delete;
+  IoUring & operator=(const IoUring &) = delete;
+
+  /**
+   * Get the number of bytes received from a socket that have not been consumed yet.
+   * @param fd one of the watched sockets
+   * @return the number of buffered bytes
+   */
+  std::size_t available(int fd) const;
+  /**
+   * Get the bytes received from a socket that have not been consumed yet.
+   * @param fd one of the watched sockets
+   * @return a pointer to the first of available(fd) buffered bytes, valid until the next call to wait() or consume()
+   */
+  const char * peek(int fd) const;
+  /**
+   * Drop bytes from the front of a socket's buffered data.
+   * @param fd one of the watched sockets
+   * @param len the number of bytes to drop, at most available(fd)
+   */
+  void consume(int fd, std::size_t len);
+  /**
+   * Check whether the peer of a socket has closed the connection. Bytes received before the close remain available.
+   * @param fd one of the watched sockets
+   * @return true if the peer has closed the connection
+   */
+  bool closed(int fd) const;
+  /**
+   * Receive exactly len bytes from a socket, waiting for more data as needed.
+   * @param fd one of the watched sockets
+   * @param buf buffer to receive data into
+   * @param len length of the buffer
+   * @throws std::runtime_error if the peer closes the connection before all data is received
+   */
+  void recvAll(int fd, char * buf, std::size_t len);
+
+  /**
+   * Get a buffer to build a message in, reusing the buffer of a completed send if there is one. 
+   * The buffer keeps the size and contents of the message it last carried, so that filling it again does not zero it first.
+   * @return a buffer with unspecified contents
+   */
+  std::vector<char> acquireBuffer();
+  /**
+   * Queue a message to be sent on a socket. Messages to the same socket go out in order; the engine owns the buffer until the send completes.
+   * The send is submitted with the next wait(), or right away if the submission queue is full.
+   * @param fd one of the watched sockets
+   * @param data the message
+   */
+  void send(int fd, std::vector<char> && data);
+  /**
+   * Submit the queued sends and wait until at least one completion has been processed, which may be the completion of a send 
+   * rather than the arrival of data; the callers wait again until the data they expect is buffered.
+   * This must only be called when more data is expected from a socket.
+   * @throws std::runtime_error if a send or a recv fails
+   */
+  void wait();
+  /**
+   * Submit the queued sends and wait until every one of them has completed, e.g. before writing to a socket directly.
+   */
+  void drainSends();
+
+  /**
+   * Get the watched sockets, in the order they were given to create().
+   * @return the watched sockets
+   */
+  std::vector<int> fds() const;
+  /**
+   * Get the number of io_uring_enter system calls made so far, to compare the cost per hop with the blocking path.
+   * @return the number of io_uring_enter calls
+   */
+  std::uint64_t enterCalls() const noexcept { return enterCalls_; }
+private:
+  struct Stream {
+    int fd = -1;
+    std::vector<char> data; // Received bytes; those before head have been consumed
+    std::size_t head = 0;
+    bool closed = false;
+    std::deque<std::vector<char>> sendQueue; // The front message is in flight if sending is set
+    std::size_t sendOffset = 0;
+    bool sending = false;
+  };
+
+  int ringFd_ = -1;
+  void * sqRing_ = nullptr;
+  std::size_t sqRingSize_ = 0;
+  void * cqRing_ = nullptr; // Same mapping as sqRing_ if the kernel supports a single mmap
+  std::size_t cqRingSize_ = 0;
+  io_uring_sqe * sqes_ = nullptr;
+  std::size_t sqesSize_ = 0;
+  unsigned * sqHead_ = nullptr;
+  unsigned * sqTail_ = nullptr;
+  unsigned sqMask_ = 0;
+  unsigned * sqArray_ = nullptr;
+  unsigned * cqHead_ = nullptr;
+  unsigned * cqTail_ = nullptr;
+  unsigned cqMask_ = 0;
+  io_uring_cqe * cqes_ = nullptr;
+  unsigned toSubmit_ = 0;
+
+  io_uring_buf_ring * bufRing_ = nullptr;
+  std::size_t bufRingSize_ = 0;
+  std::vector<char> buffers_; // The provided buffers, back to back
+  std::uint64_t enterCalls_ = 0;
+
+  std::vector<Stream> streams_;
+  std::vector<std::vector<char>> spareBuffers_;
+
+  IoUring() = default;
+
+  /**
+   * Set up the rings and register the provided buffers.
+   * @return true on success, false if the kernel does not support what the engine needs
+   */
+  bool setup();
+  /**
+   * Get the stream of a watched socket.
+   * @param fd one of the watched sockets
+   * @return the index of the socket's stream
+   * @throws std::runtime_error if the socket is not watched
+   */
+  std::size_t streamIndex(int fd) const;
+  /**
+   * Get a free submission queue entry, submitting the queued ones first if the submission queue is full.
+   * @return a zeroed submission queue entry
+   */
+  io_uring_sqe * nextSqe();
+  /**
+   * Queue a multishot recv on a stream.
+   * @param index the index of the stream
+   */
+  void armRecv(std::size_t index);
+  /**
+   * Queue a send of the unsent part of the front message of a stream.
+   * @param index the index of the stream
+   */
+  void submitSend(std::size_t index);
+  /**
+   * Hand a provided buffer back to the kernel.
+   * @param bid the ID of the buffer
+   */
+  void recycleBuffer(std::uint16_t bid);
+  /**
+   * Submit the queued entries and optionally wait for completions.
+   * @param minComplete the number of completions to wait for
+   */
+  void enter(unsigned minComplete);
+  /**
+   * Process every completion in the completion queue.
+   * @return the number of completions processed
+   */
+  unsigned reap();
+  /**
+   * Check whether any stream has a send queued or in flight.
+   * @return true if a send is pending
+   */
+  bool sendsPending() const;
+  /**
+   * Count the sends that have been queued or submitted but whose completion has not been processed yet.
+   * @return the number of sends in flight, at most one per stream
+   */
+  unsigned sendsInFlight() const;
+};
+#endif
@@ -0,0 +1,280 @@
+#include "Logger.hpp"
+#include "clock.hpp"
+#include "wire.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+  constexpr std::size_t QUEUE_CAPACITY = 4096;
+  // Write the buffers out early if this many bytes are pending, even if the ring buffer has not run dry
+  constexpr std::size_t FLUSH_THRESHOLD = 64 * 1024;
+  // Number of empty polls the flusher yields for before it starts sleeping
+  constexpr unsigned SPIN_POLLS = 64;
+  constexpr auto MAX_IDLE_SLEEP = std::chrono::milliseconds(1);
+
+  constexpr char BINARY_MAGIC[4] = {'P', 'L', 'O', 'G'};
+  constexpr char BINARY_VERSION = 1;
+
+  // Helper function
+  bool toStandardError(LogEvent event) {
+    switch (event) {
+      case LogEvent::ConnectedToRingmaster:
+      case LogEvent::Neighbor:
+      case LogEvent::InvalidPotatoHops:
+      case LogEvent::InvalidPotato:
+      case LogEvent::Error:
+      case LogEvent::IoUringUnavailable:
+      case LogEvent::IoUringCalls:
+      case LogEvent::LinkTransport:
+      case LogEvent::IoUringSharedMemory:
+      case LogEvent::IoUringSpin:
+      case LogEvent::IoUringHealing:
+      case LogEvent::LostNeighbor:
+        return true;
+      default:
+        return false;
+    }
+  }
+}
+
+Logger::Logger(const LoggerOptions & options)
+    : level_(options.level), format_(options.format), queue_(QUEUE_CAPACITY), stopping_(false) {
+  if (level_ == LogLevel::Off) {
+    return;
+  }
+  if (!options.file.empty()) {
+    fd_ = ::open(options.file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("Could not open log file " + options.file);
+    }
+  }
+  if (format_ == LogFormat::Binary) {
+    std::string header(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header += BINARY_VERSION;
+    writeOut(fd_ >= 0 ? fd_ : STDOUT_FILENO, header);
+  }
+  flusher_ = std::thread(&Logger::flushLoop, this);
+}
+
+Logger::~Logger() {
+  if (flusher_.joinable()) {
+    stopping_.store(true, std::memory_order_release);
+    flusher_.join();
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void Logger::log(LogEvent event, std::int32_t arg0, std::int32_t arg1, std::string text) {
+  if (!enabled(levelOf(event))) {
+    return;
+  }
+  LogRecord record;
+  record.stamp = format_ == LogFormat::Binary ? monotonicNanos() : 0;
+  record.event = event;
+  record.args[0] = arg0;
+  record.args[1] = arg1;
+  record.text = std::move(text);
+  while (!queue_.push(std::move(record))) {
+    std::this_thread::yield();
+  }
+}
+
+LogLevel Logger::levelOf(LogEvent event) noexcept {
+  switch (event) {
+    case LogEvent::InvalidPotatoHops:
+    case LogEvent::InvalidPotato:
+    case LogEvent::Error:
+      return LogLevel::Error;
+    case LogEvent::ReceivedPotato:
+    case LogEvent::IoUringCalls:
+    case LogEvent::LinkTransport:
+    case LogEvent::StalePotato:
+      return LogLevel::Debug;
+    default:
+      return LogLevel::Info;
+  }
+}
+
+void Logger::formatText(const LogRecord & record, std::string & out) {
+  switch (record.event) {
+    case LogEvent::ConnectedToRingmaster:
+      out += "Connected to ringmaster at " + std::to_string(record.args[0]);
+      break;
+    case LogEvent::Neighbor:
+      out += std::to_string(record.args[0]) + " " + record.text + " " + std::to_string(record.args[1]);
+      break;
+    case LogEvent::ConnectedAsPlayer:
+      out += "Connected as player " + std::to_string(record.args[0]) + " out of " + std::to_string(record.args[1]) + " total players";
+      break;
+    case LogEvent::ReceivedPotato:
+      out += "Received potato " + std::to_string(record.args[0]) + " with " + std::to_string(record.args[1]) + " hops left";
+      break;
+    case LogEvent::ImIt:
+      out += "I'm it";
+      break;
+    case LogEvent::SendingPotato:
+      out += "Sending potato to " + std::to_string(record.args[0]);
+      break;
+    case LogEvent::Message:
+      out += record.text;
+      break;
+    case LogEvent::InvalidPotatoHops:
+      out += "Attempted to pass an invalid potato with negative hops. Ignoring.";
+      break;
+    case LogEvent::InvalidPotato:
+      out += "Error: Failed to receive a valid potato. Continuing to wait for potatoes.";
+      break;
+    case LogEvent::Error:
+      out += "Error: " + record.text;
+      break;
+    case LogEvent::IoUringUnavailable:
+      out += "io_uring is not available, falling back to blocking I/O";
+      break;
+    case LogEvent::IoUringCalls:
+      out += "io_uring: " + std::to_string(record.args[0]) + " io_uring_enter calls";
+      break;
+    case LogEvent::LinkTransport:
+      out += "Link to " + std::to_string(record.args[0]) + " uses " + record.text;
+      break;
+    case LogEvent::IoUringSharedMemory:
+      out += "io_uring cannot wait on shared memory links, falling back to futex wakeups";
+      break;
+    case LogEvent::IoUringSpin:
+      out += "io_uring waits in the kernel, falling back to spinning on the links";
+      break;
+    case LogEvent::PlayingPositions:
+      out += "Playing positions " + std::to_string(record.args[0]) + " to " + std::to_string(record.args[1]);
+      break;
+    case LogEvent::NewGame:
+      out += "Starting a new game";
+      break;
+    case LogEvent::IoUringHealing:
+      out += "io_uring cannot drop the link of a lost neighbor, falling back to blocking I/O";
+      break;
+    case LogEvent::StalePotato:
+      out += "Dropped potato " + std::to_string(record.args[0]) + " of generation " + std::to_string(record.args[1]);
+      break;
+    case LogEvent::LostNeighbor:
+      out += "Lost the link to " + std::to_string(record.args[0]);
+      break;
+    case LogEvent::Relinked:
+      out += "Relinked around lost players as generation " + std::to_string(record.args[0]) + ", gaining " + std::to_string(record.args[1]) + " links";
+      break;
+  }
+  out += '\n';
+}
+
+void Logger::append(const LogRecord & record, std::string & out, std::string & err) const {
+  if (format_ == LogFormat::Text) {
+    formatText(record, fd_ < 0 && toStandardError(record.event) ? err : out);
+    return;
+  }
+
+  std::vector<char> buf(1 + sizeof(std::uint64_t));
+  buf[0] = static_cast<char>(record.event);
+  putU64(buf, 1, record.stamp);
+  putVarint(buf, zigzag(record.args[0]));
+  putVarint(buf, zigzag(record.args[1]));
+  putVarint(buf, static_cast<std::uint32_t>(record.text.size()));
+  buf.insert(buf.end(), record.text.begin(), record.text.end());
+  out.append(buf.data(), buf.size());
+}
+
+void Logger::flushLoop() {
+  std::string out;
+  std::string err;
+  LogRecord record;
+  unsigned idlePolls = 0;
+  int outFd = fd_ >= 0 ? fd_ : STDOUT_FILENO;
+  while (true) {
+    // Read the flag before draining: every record was pushed before the flag was set, so the last drain sees all of them
+    bool stop = stopping_.load(std::memory_order_acquire);
+    bool drained = false;
+    while (queue_.pop(record)) {
+      drained = true;
+      append(record, out, err);
+      if (out.size() + err.size() >= FLUSH_THRESHOLD) {
+        writeOut(outFd, out);
+        writeOut(STDERR_FILENO, err);
+      }
+    }
+    writeOut(outFd, out);
+    writeOut(STDERR_FILENO, err);
+
+    if (stop) {
+      return;
+    }
+    if (drained) {
+      idlePolls = 0;
+    }
+    else if (++idlePolls < SPIN_POLLS) {
+      std::this_thread::yield();
+    }
+    else {
+      std::this_thread::sleep_for(std::min(MAX_IDLE_SLEEP, std::chrono::milliseconds(idlePolls / SPIN_POLLS)));
+    }
+  }
+}
+
+void Logger::writeOut(int fd, std::string & buf) {
+  std::size_t written = 0;
+  while (written < buf.size()) {
+    ssize_t n = ::write(fd, buf.data() + written, buf.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break; // Nowhere to report a failing log stream, so drop the rest
+    }
+    written += static_cast<std::size_t>(n);
+  }
+  buf.clear();
+}
+
+void decodeBinaryLog(std::istream & in, std::ostream & out) {
+  std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(BINARY_MAGIC) + 1 || !std::equal(BINARY_MAGIC, BINARY_MAGIC + sizeof(BINARY_MAGIC), data.begin())) {
+    throw std::runtime_error("Not a binary player log");
+  }
+  if (data[sizeof(BINARY_MAGIC)] != BINARY_VERSION) {
+    throw std::runtime_error("Unsupported binary log version " + std::to_string(data[sizeof(BINARY_MAGIC)]));
+  }
+
+  const char * pos = data.data() + sizeof(BINARY_MAGIC) + 1;
+  const char * end = data.data() + data.size();
+  std::string line;
+  while (pos < end) {
+    if (end - pos < static_cast<std::ptrdiff_t>(1 + sizeof(std::uint64_t))) {
+      throw std::runtime_error("Truncated binary log record");
+    }
+    LogRecord record;
+    record.event = static_cast<LogEvent>(*pos);
+    if (record.event > LogEvent::Relinked) {
+      throw std::runtime_error("Unknown binary log event " + std::to_string(static_cast<int>(record.event)));
+    }
+    record.stamp = getU64(pos + 1);
+    pos += 1 + sizeof(std::uint64_t);
+    record.args[0] = unzigzag(getVarint(pos, end));
+    record.args[1] = unzigzag(getVarint(pos, end));
+    std::uint32_t length = getVarint(pos, end);
+    if (length > static_cast<std::size_t>(end - pos)) {
+      throw std::runtime_error("Truncated binary log record");
+    }
+    record.text.assign(pos, length);
+    pos += length;
+
+    line = std::to_string(record.stamp) + " ";
+    Logger::formatText(record, line);
+    out << line;
+  }
+  out.flush();
+}
@@ -0,0 +1,156 @@
+#pragma once
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <thread>
+#include "SpscQueue.hpp"
+
+/**
+ * Verbosity of a Logger. A record is kept if its level is at most the logger's level.
+ */
+enum class LogLevel : std::uint8_t {
+  Off = 0,
+  Error = 1,
+  Info = 2,
+  Debug = 3,
+};
+
+/**
+ * Output format of a Logger: the player's original text lines, or compact binary records that can be turned back into text with decodeBinaryLog().
+ */
+enum class LogFormat : std::uint8_t {
+  Text,
+  Binary,
+};
+
+/**
+ * The messages a player can log. Each event has a fixed text template, so the hop path only records the event and its arguments 
+ * and all the formatting happens on the flusher thread.
+ */
+enum class LogEvent : std::uint8_t {
+  ConnectedToRingmaster,  // args: listening port
+  Neighbor,               // args: neighbor ID, neighbor port; text: neighbor address
+  ConnectedAsPlayer,      // args: player ID, number of players
+  ReceivedPotato,         // args: potato ID, hops left
+  ImIt,
+  SendingPotato,          // args: neighbor ID
+  Message,                // text: the message, e.g. the ringmaster's final message
+  InvalidPotatoHops,
+  InvalidPotato,
+  Error,                  // text: the error message
+  IoUringUnavailable,
+  IoUringCalls,           // args: number of io_uring_enter calls
+  LinkTransport,          // args: neighbor ID; text: transport of the link to the neighbor
+  IoUringSharedMemory,
+  IoUringSpin,
+  PlayingPositions,       // args: ID of the first position, ID of the last position
+  NewGame,
+  IoUringHealing,
+  StalePotato,            // args: potato ID, generation of the potato
+  LostNeighbor,           // args: neighbor ID
+  Relinked,               // args: generation, number of links gained
+};
+
+/**
+ * A single log record as it travels through the ring buffer.
+ */
+struct LogRecord {
+  std::uint64_t stamp = 0; // CLOCK_MONOTONIC nanoseconds
+  LogEvent event = LogEvent::Message;
+  std::int32_t args[2] = {0, 0};
+  std::string text; // Only set by the events that carry a string, so per-hop records do not allocate
+};
+
+/**
+ * Options that change where and how a Logger writes.
+ */
+struct LoggerOptions {
+  LogLevel level = LogLevel::Info;
+  LogFormat format = LogFormat::Text;
+  // If not empty, every record is written to this file instead of standard output and standard error
+  std::string file;
+};
+
+/**
+ * An asynchronous logger for a single producer thread. log() only pushes a small record into a lock-free ring buffer; 
+ * a background flusher thread formats the records and writes them out in batches, so logging costs no syscall and no formatting on the hop path.
+ * In the text format with no file, every event is written to the stream the player originally used (standard output or standard error), 
+ * with exactly the original text. The destructor writes every pending record before returning.
+ */
+class Logger {
+public:
+  explicit Logger(const LoggerOptions & options = LoggerOptions());
+  ~Logger();
+
+  Logger(const Logger &) = delete;
+  Logger & operator=(const Logger &) = delete;
+
+  /**
+   * Check whether records of the given level are kept, so that callers can skip preparing the arguments of a dropped record.
+   * @param level the level of the record
+   * @return true if the record would be written
+   */
+  bool enabled(LogLevel level) const noexcept { return level <= level_ && level_ != LogLevel::Off; }
+
+  /**
+   * Queue a record. If the ring buffer is full, this waits for the flusher rather than dropping the record.
+   * Must only be called from the thread that owns the logger.
+   * @param event the event to log, whose level is given by levelOf()
+   * @param arg0 the first numeric argument of the event, if any
+   * @param arg1 the second numeric argument of the event, if any
+   * @param text the string argument of the event, if any
+   */
+  void log(LogEvent event, std::int32_t arg0 = 0, std::int32_t arg1 = 0, std::string text = std::string());
+
+  /**
+   * Get the level an event is logged at.
+   * @param event the event
+   * @return the level of the event
+   */
+  static LogLevel levelOf(LogEvent event) noexcept;
+  /**
+   * Format a record as the text line the player originally printed, including the trailing newline.
+   * @param record the record to format
+   * @param out the string to append the line to
+   */
+  static void formatText(const LogRecord & record, std::string & out);
+private:
+  LogLevel level_;
+  LogFormat format_;
+  int fd_ = -1; // The log file, or -1 to use standard output and standard error
+  SpscQueue<LogRecord> queue_;
+  std::atomic<bool> stopping_;
+  std::thread flusher_;
+
+  /**
+   * Body of the flusher thread: drain the ring buffer into per-stream buffers and write them whenever the ring buffer runs dry.
+   */
+  void flushLoop();
+  /**
+   * Append a record to the buffer of the stream it belongs to, in the logger's format.
+   * @param record the record to append
+   * @param out the buffer for standard output, or for the log file if there is one
+   * @param err the buffer for standard error
+   */
+  void append(const LogRecord & record, std::string & out, std::string & err) const;
+  /**
+   * Write a whole buffer to a file descriptor and clear it.
+   * @param fd the file descriptor to write to
+   * @param buf the buffer to write
+   */
+  static void writeOut(int fd, std::string & buf);
+};
+
+/**
+ * Turn a binary log written by a Logger back into text, one line per record prefixed with its CLOCK_MONOTONIC stamp in nanoseconds.
+ * @param in the binary log
+ * @param out the stream to write the text to
+ * @throws std::runtime_error if the log is not a binary log or is truncated
+ */
+void decodeBinaryLog(std::istream & in, std::ostream & out);
+#endif
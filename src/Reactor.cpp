@@ -0,0 +1,102 @@
+#include "Reactor.hpp"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+  // Maximum number of ready file descriptors dispatched per epoll_wait call
+  constexpr int MAX_EVENTS = 256;
+
+  // Handler installed in place of a null handler, so that a registered file descriptor always has one
+  void ignore(std::uint32_t) {
+  }
+}
+
+Reactor::Reactor() : epfd_(::epoll_create1(EPOLL_CLOEXEC)), registered_(0), dispatching_(-1) {
+  if (epfd_ < 0) {
+    throw std::runtime_error(std::string("epoll_create1 failed: ") + std::strerror(errno));
+  }
+}
+
+Reactor::~Reactor() {
+  ::close(epfd_);
+}
+
+void Reactor::add(int fd, std::uint32_t events, Handler handler) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    throw std::runtime_error(std::string("epoll_ctl(ADD) failed: ") + std::strerror(errno));
+  }
+  if (static_cast<std::size_t>(fd) >= handlers_.size()) {
+    handlers_.resize(fd + 1);
+  }
+  handlers_[fd] = handler ? std::move(handler) : ignore;
+  registered_++;
+}
+
+void Reactor::modify(int fd, std::uint32_t events) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (::epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    throw std::runtime_error(std::string("epoll_ctl(MOD) failed: ") + std::strerror(errno));
+  }
+}
+
+void Reactor::setHandler(int fd, Handler handler) {
+  retire(fd);
+  handlers_.at(fd) = handler ? std::move(handler) : ignore;
+}
+
+void Reactor::retire(int fd) {
+  // Keep a handler that replaces or removes itself alive until it returns
+  if (fd == dispatching_) {
+    retired_ = std::move(handlers_[fd]);
+  }
+}
+
+void Reactor::remove(int fd) noexcept {
+  if (fd < 0 || static_cast<std::size_t>(fd) >= handlers_.size() || !handlers_[fd]) {
+    return;
+  }
+  ::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+  retire(fd);
+  handlers_[fd] = nullptr;
+  registered_--;
+}
+
+int Reactor::runOnce(int timeoutMs) {
+  epoll_event events[MAX_EVENTS];
+  int ready = ::epoll_wait(epfd_, events, MAX_EVENTS, timeoutMs);
+  if (ready < 0) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    throw std::runtime_error(std::string("epoll_wait failed: ") + std::strerror(errno));
+  }
+
+  int dispatched = 0;
+  for (int i = 0; i < ready; ++i) {
+    int fd = events[i].data.fd;
+    // A handler earlier in this batch may have removed the file descriptor
+    if (static_cast<std::size_t>(fd) < handlers_.size() && handlers_[fd]) {
+      dispatching_ = fd;
+      handlers_[fd](events[i].events);
+      dispatching_ = -1;
+      retired_ = nullptr;
+      dispatched++;
+    }
+  }
+  return dispatched;
+}
+
+std::size_t Reactor::size() const noexcept {
+  return registered_;
+}
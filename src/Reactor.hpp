@@ -0,0 +1,83 @@
+#pragma once
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * A small epoll-based event loop. File descriptors are registered once and only the ready ones are dispatched,
+ * so the cost of a wakeup does not grow with the number of registered file descriptors.
+ */
+class Reactor {
+public:
+  /**
+   * Handler called with the ready epoll events (EPOLLIN, EPOLLOUT, EPOLLHUP, ...) of its file descriptor.
+   */
+  using Handler = std::function<void(std::uint32_t events)>;
+
+  /**
+   * Create the underlying epoll instance.
+   * @throws std::runtime_error if the epoll instance cannot be created
+   */
+  Reactor();
+  ~Reactor();
+
+  Reactor(const Reactor &) = delete;
+  Reactor & operator=(const Reactor &) = delete;
+
+  /**
+   * Register a file descriptor with the reactor.
+   * @param fd the file descriptor to watch
+   * @param events the epoll events to watch for, e.g. EPOLLIN
+   * @param handler the handler to call when the file descriptor is ready, or nullptr to ignore its events for now
+   * @throws std::runtime_error if the file descriptor cannot be registered
+   */
+  void add(int fd, std::uint32_t events, Handler handler);
+
+  /**
+   * Change the events watched for an already registered file descriptor.
+   * @param fd the registered file descriptor
+   * @param events the epoll events to watch for from now on
+   * @throws std::runtime_error if the file descriptor cannot be modified
+   */
+  void modify(int fd, std::uint32_t events);
+
+  /**
+   * Replace the handler of an already registered file descriptor without touching the kernel registration.
+   * @param fd the registered file descriptor
+   * @param handler the handler to call when the file descriptor is ready from now on, or nullptr to ignore its events
+   */
+  void setHandler(int fd, Handler handler);
+
+  /**
+   * Stop watching a file descriptor. This must be called before the file descriptor is closed.
+   * Events of the file descriptor that are still pending in the current batch are dropped.
+   * @param fd the registered file descriptor
+   */
+  void remove(int fd) noexcept;
+
+  /**
+   * Wait for at least one registered file descriptor to become ready, and call the handlers of all ready file descriptors.
+   * @param timeoutMs the maximum time to wait in milliseconds, or -1 to wait indefinitely
+   * @return the number of handlers called, which is 0 if the timeout expired or the wait was interrupted by a signal
+   * @throws std::runtime_error if epoll_wait fails
+   */
+  int runOnce(int timeoutMs = -1);
+
+  /**
+   * Get the number of file descriptors currently registered with the reactor.
+   * @return the number of registered file descriptors
+   */
+  std::size_t size() const noexcept;
+private:
+  int epfd_;
+  std::size_t registered_;
+  std::vector<Handler> handlers_; // Indexed by file descriptor
+  int dispatching_;
+  Handler retired_;
+
+  void retire(int fd);
+};
+#endif
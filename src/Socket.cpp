@@ -4,10 +4,58 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <cerrno>
+#include <cstddef>
 #include <cstring>
 #include <stdexcept>
 #include <string>
 #include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <vector>
+
+namespace {
+  // Socket buffer size of the throughput profile; the kernel doubles it and caps it at net.core.{w,r}mem_max
+  constexpr int THROUGHPUT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+  // Helper function
+  void setIntOption(int fd, int level, int option, int value, const char * name) {
+    if (::setsockopt(fd, level, option, &value, sizeof(value)) < 0) {
+      throw std::runtime_error(std::string("setsockopt(") + name + ") failed: " + std::strerror(errno));
+    }
+  }
+
+  // Helper function
+  void applyProfileTo(int fd, SocketProfile profile) {
+    switch (profile) {
+      case SocketProfile::Default:
+        break;
+      case SocketProfile::Latency:
+        setIntOption(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+        break;
+      case SocketProfile::Throughput:
+        setIntOption(fd, SOL_SOCKET, SO_SNDBUF, THROUGHPUT_BUFFER_SIZE, "SO_SNDBUF");
+        setIntOption(fd, SOL_SOCKET, SO_RCVBUF, THROUGHPUT_BUFFER_SIZE, "SO_RCVBUF");
+        break;
+    }
+  }
+
+  // Helper function
+  socklen_t unixAddress(const std::string & name, sockaddr_un & addr) {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (name.empty() || name.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error("Invalid AF_UNIX socket name: " + name);
+    }
+    std::memcpy(addr.sun_path, name.data(), name.size());
+    if (name[0] == '@') {
+      addr.sun_path[0] = '\0'; // Abstract namespace: the name is exactly the given bytes, without a terminator
+      return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + name.size());
+    }
+    return sizeof(addr);
+  }
+}
 
 Socket::Socket() noexcept : fd_(-1) {
 }
@@ -66,64 +114,241 @@ void Socket::recvAll(char * buf, std::size_t len) const {
   }
 }
 
-Socket Socket::createListeningSocket(std::uint16_t port) {
+void Socket::recvAllv(const struct iovec * iov, int iovcnt) const {
+  std::vector<struct iovec> pending(iov, iov + iovcnt);
+  std::size_t first = 0;
+  while (first < pending.size()) {
+    ssize_t n = ::readv(fd_, pending.data() + first, static_cast<int>(pending.size() - first));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("readv failed: ") + std::strerror(errno));
+    }
+    if (n == 0) {
+      throw std::runtime_error("Peer closed connection before all data was received");
+    }
+    // Skip the buffers that were filled completely and advance into the first partially filled one
+    std::size_t received = static_cast<std::size_t>(n);
+    while (first < pending.size() && received >= pending[first].iov_len) {
+      received -= pending[first].iov_len;
+      first++;
+    }
+    if (first < pending.size()) {
+      pending[first].iov_base = static_cast<char *>(pending[first].iov_base) + received;
+      pending[first].iov_len -= received;
+    }
+  }
+}
+
+ssize_t Socket::tryRecv(char * buf, std::size_t len) const {
+  for (;;) {
+    ssize_t n = ::recv(fd_, buf, len, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return -1;
+      throw std::runtime_error(std::string("recv failed: ") + std::strerror(errno));
+    }
+    return n;
+  }
+}
+
+void Socket::setNonBlocking(bool enabled) const {
+  int flags = fcntl(fd_, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd_, F_SETFL, enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) < 0) {
+    throw std::runtime_error(std::string("fcntl failed: ") + std::strerror(errno));
+  }
+}
+
+void Socket::acknowledgeNow() const {
+  setIntOption(fd_, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+}
+
+void Socket::applyProfile(SocketProfile profile) const {
+  applyProfileTo(fd_, profile);
+}
+
+bool Socket::parseProfile(const std::string & name, SocketProfile & profile) {
+  if (name == "default") {
+    profile = SocketProfile::Default;
+  }
+  else if (name == "latency") {
+    profile = SocketProfile::Latency;
+  }
+  else if (name == "throughput") {
+    profile = SocketProfile::Throughput;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+const char * Socket::profileName(SocketProfile profile) {
+  switch (profile) {
+    case SocketProfile::Latency:
+      return "latency";
+    case SocketProfile::Throughput:
+      return "throughput";
+    default:
+      return "default";
+  }
+}
+
+std::string Socket::formatAddress(const sockaddr_storage & address) {
+  char ip_str[INET6_ADDRSTRLEN] = "";
+  if (address.ss_family == AF_INET) {
+    inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in *>(&address)->sin_addr, ip_str, sizeof(ip_str));
+  }
+  else if (address.ss_family == AF_INET6) {
+    inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 *>(&address)->sin6_addr, ip_str, sizeof(ip_str));
+  }
+  return ip_str;
+}
+
+std::uint16_t Socket::addressPort(const sockaddr_storage & address) {
+  if (address.ss_family == AF_INET) {
+    return ntohs(reinterpret_cast<const sockaddr_in *>(&address)->sin_port);
+  }
+  if (address.ss_family == AF_INET6) {
+    return ntohs(reinterpret_cast<const sockaddr_in6 *>(&address)->sin6_port);
+  }
+  return 0;
+}
+
+void Socket::setAddressPort(sockaddr_storage & address, std::uint16_t port) {
+  if (address.ss_family == AF_INET) {
+    reinterpret_cast<sockaddr_in *>(&address)->sin_port = htons(port);
+  }
+  else if (address.ss_family == AF_INET6) {
+    reinterpret_cast<sockaddr_in6 *>(&address)->sin6_port = htons(port);
+  }
+}
+
+Socket Socket::accept(sockaddr_storage * address, bool nonBlocking, SocketProfile profile) const {
+  sockaddr_storage peer_addr;
+  socklen_t peer_addr_len = sizeof(peer_addr);
+  int fd;
+  do {
+    fd = ::accept4(fd_, reinterpret_cast<sockaddr *>(&peer_addr), &peer_addr_len, nonBlocking ? SOCK_NONBLOCK : 0);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return Socket();
+    }
+    throw std::runtime_error(std::string("accept failed: ") + std::strerror(errno));
+  }
+
+  if (address != nullptr) {
+    *address = peer_addr;
+    const sockaddr_in6 * addr_in6 = reinterpret_cast<const sockaddr_in6 *>(&peer_addr);
+    if (peer_addr.ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&addr_in6->sin6_addr)) {
+      // Hand out IPv4 peers as such, so that their neighbors can reach them from hosts without IPv6
+      sockaddr_in addr_in = {};
+      addr_in.sin_family = AF_INET;
+      addr_in.sin_port = addr_in6->sin6_port;
+      std::memcpy(&addr_in.sin_addr, addr_in6->sin6_addr.s6_addr + 12, sizeof(addr_in.sin_addr));
+      *address = sockaddr_storage();
+      std::memcpy(address, &addr_in, sizeof(addr_in));
+    }
+  }
+  Socket accepted(fd);
+  accepted.applyProfile(profile);
+  return accepted;
+}
+
+Socket Socket::createListeningSocket(std::uint16_t port, SocketProfile profile) {
   Socket s;
   s.listen(port);
+  s.applyProfile(profile);
   return s;
 }
 
 void Socket::listen(std::uint16_t port) {
-  addrinfo hints{}, *res;
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_flags = AI_PASSIVE;
-
-  std::string port_str = std::to_string(port);
-
-  if(::getaddrinfo(nullptr, port_str.c_str(), &hints, &res) != 0) {
-    throw std::runtime_error("getaddrinfo failed");
+  sockaddr_storage addr = {};
+  socklen_t addr_len;
+  int fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+  if (fd >= 0) {
+    int no = 0;
+    if (::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no)) < 0) {
+      ::close(fd);
+      throw std::runtime_error("setsockopt(IPV6_V6ONLY) failed");
+    }
+    sockaddr_in6 * addr_in6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+    addr_in6->sin6_family = AF_INET6;
+    addr_in6->sin6_addr = in6addr_any;
+    addr_in6->sin6_port = htons(port);
+    addr_len = sizeof(sockaddr_in6);
+  }
+  else if (errno == EAFNOSUPPORT) {
+    // The host has no IPv6
+    fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in * addr_in = reinterpret_cast<sockaddr_in *>(&addr);
+    addr_in->sin_family = AF_INET;
+    addr_in->sin_addr.s_addr = htonl(INADDR_ANY);
+    addr_in->sin_port = htons(port);
+    addr_len = sizeof(sockaddr_in);
   }
-
-  int fd = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
   if (fd < 0) {
-    ::freeaddrinfo(res);
     throw std::runtime_error("socket creation failed");
   }
   fd_ = fd;
 
   int yes = 1;
   if (::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0) {
-    ::freeaddrinfo(res);
     ::close(fd_);
     fd_ = -1;
     throw std::runtime_error("setsockopt(SO_REUSEADDR) failed");
   }
 
-  if (::bind(fd_, res->ai_addr, res->ai_addrlen) < 0) {
-    ::freeaddrinfo(res);
+  if (::bind(fd_, reinterpret_cast<sockaddr *>(&addr), addr_len) < 0) {
     ::close(fd_);
     fd_ = -1;
     throw std::runtime_error("bind failed");
   }
 
-  ::freeaddrinfo(res);
-
-  if (::listen(fd_, 50) < 0) {
+  // The kernel caps the backlog at net.core.somaxconn; a large backlog lets a burst of players connect without being refused
+  if (::listen(fd_, SOMAXCONN) < 0) {
     ::close(fd_);
     fd_ = -1;
     throw std::runtime_error("listen failed");
   }
 }
 
-Socket Socket::connectToServer(const std::string & server, std::uint16_t port, bool blocking) {
+Socket Socket::connectToServer(const std::string & server, std::uint16_t port, bool blocking, SocketProfile profile) {
   Socket s;
-  s.connect(server, port, blocking);
+  s.connect(server, port, blocking, profile);
+  return s;
+}
+
+Socket Socket::connectTo(const sockaddr_storage & address, bool blocking, SocketProfile profile) {
+  socklen_t addr_len;
+  if (address.ss_family == AF_INET) {
+    addr_len = sizeof(sockaddr_in);
+  }
+  else if (address.ss_family == AF_INET6) {
+    addr_len = sizeof(sockaddr_in6);
+  }
+  else {
+    throw std::runtime_error("Unsupported address family " + std::to_string(address.ss_family));
+  }
+  Socket s(::socket(address.ss_family, SOCK_STREAM | (blocking ? 0 : SOCK_NONBLOCK), 0));
+  if (!s.valid()) {
+    throw std::runtime_error(std::string("socket creation failed: ") + std::strerror(errno));
+  }
+  // Before connecting, so that the buffer sizes take part in the window negotiation
+  s.applyProfile(profile);
+  if (::connect(s.fd_, reinterpret_cast<const sockaddr *>(&address), addr_len) < 0 && (blocking || errno != EINPROGRESS)) {
+    throw std::runtime_error("Could not connect to " + formatAddress(address) + ":" + std::to_string(addressPort(address)) 
+                             + ": " + std::strerror(errno));
+  }
   return s;
 }
 
-void Socket::connect(const std::string & server, std::uint16_t port, bool blocking) {
+void Socket::connect(const std::string & server, std::uint16_t port, bool blocking, SocketProfile profile) {
   addrinfo hints{}, *res, *p;
-  hints.ai_family = AF_INET;
+  hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
 
   if (port == 0) {
@@ -146,6 +371,14 @@ void Socket::connect(const std::string & server, std::uint16_t port, bool blocki
       int flags = fcntl(new_fd, F_GETFL, 0);
       fcntl(new_fd, F_SETFL, flags | O_NONBLOCK);
     }
+    // Before connecting, so that the buffer sizes take part in the window negotiation
+    try {
+      applyProfileTo(new_fd, profile);
+    } catch (const std::exception &) {
+      ::close(new_fd);
+      ::freeaddrinfo(res);
+      throw;
+    }
 
     if (::connect(new_fd, p->ai_addr, p->ai_addrlen) == 0 || (!blocking && errno == EINPROGRESS)) {
       fd_ = new_fd;
@@ -162,10 +395,43 @@ void Socket::connect(const std::string & server, std::uint16_t port, bool blocki
   }
 }
 
+Socket Socket::createUnixListeningSocket(const std::string & name) {
+  sockaddr_un addr;
+  socklen_t addr_len = unixAddress(name, addr);
+  Socket s(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (!s.valid()) {
+    throw std::runtime_error(std::string("socket creation failed: ") + std::strerror(errno));
+  }
+  if (::bind(s.fd_, reinterpret_cast<sockaddr *>(&addr), addr_len) < 0) {
+    throw std::runtime_error("bind(" + name + ") failed: " + std::strerror(errno));
+  }
+  if (::listen(s.fd_, 50) < 0) {
+    throw std::runtime_error("listen failed");
+  }
+  return s;
+}
+
+Socket Socket::connectToUnix(const std::string & name) {
+  sockaddr_un addr;
+  socklen_t addr_len = unixAddress(name, addr);
+  Socket s(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (!s.valid()) {
+    throw std::runtime_error(std::string("socket creation failed: ") + std::strerror(errno));
+  }
+  int ret;
+  do {
+    ret = ::connect(s.fd_, reinterpret_cast<sockaddr *>(&addr), addr_len);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    throw std::runtime_error("Could not connect to " + name + ": " + std::strerror(errno));
+  }
+  return s;
+}
+
 void Socket::sendAll(const char * data, std::size_t len) const {
   std::size_t sent = 0;
   while (sent < len) {
-    ssize_t n = ::send(fd_, data + sent, len - sent, 0);
+    ssize_t n = ::send(fd_, data + sent, len - sent, MSG_NOSIGNAL);
     if (n < 0) {
       if (errno == EINTR)
         continue;
@@ -175,6 +441,32 @@ void Socket::sendAll(const char * data, std::size_t len) const {
   }
 }
 
+void Socket::sendAllv(const struct iovec * iov, int iovcnt) const {
+  std::vector<struct iovec> pending(iov, iov + iovcnt);
+  std::size_t first = 0;
+  while (first < pending.size()) {
+    struct msghdr msg = {};
+    msg.msg_iov = pending.data() + first;
+    msg.msg_iovlen = pending.size() - first;
+    ssize_t n = ::sendmsg(fd_, &msg, MSG_NOSIGNAL); // Rather than writev(), which cannot pass MSG_NOSIGNAL
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("sendmsg failed: ") + std::strerror(errno));
+    }
+    // Skip the buffers that were sent completely and advance into the first partially sent one
+    std::size_t sent = static_cast<std::size_t>(n);
+    while (first < pending.size() && sent >= pending[first].iov_len) {
+      sent -= pending[first].iov_len;
+      first++;
+    }
+    if (first < pending.size()) {
+      pending[first].iov_base = static_cast<char *>(pending[first].iov_base) + sent;
+      pending[first].iov_len -= sent;
+    }
+  }
+}
+
 int Socket::release() noexcept {
     int out = fd_;
     fd_ = -1;
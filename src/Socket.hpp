@@ -5,6 +5,18 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Socket options tuned for a kind of traffic, applied to every connection of a game.
+ */
+enum class SocketProfile {
+  Default,    // Leave the kernel defaults alone
+  Latency,    // TCP_NODELAY, so that small potatoes are sent right away rather than held back by Nagle's algorithm until the previous one is acknowledged
+  Throughput, // Large send and receive buffers, for potatoes carrying long traces
+};
 
 class Socket {
 public:
@@ -51,26 +63,139 @@ public:
   void recvAll(char * buf, std::size_t len) const;
 
   /**
-    * Create a listening socket on the given port.
+   * Receive exactly enough data to fill all the given buffers, in order, blocking until all data is received. 
+   * Fixed-size fields that arrive together are read with as few readv calls as possible.
+   * @param iov the buffers to fill
+   * @param iovcnt the number of buffers
+   * @throws std::runtime_error if the peer closes the connection before all data is received
+   */
+  void recvAllv(const struct iovec * iov, int iovcnt) const;
+
+  /**
+    * Receive whatever data is available on a non-blocking socket without waiting for more.
+    * @param buf buffer to receive data into
+    * @param len length of the buffer
+    * @return number of bytes received (0 means peer closed), or -1 if no data is available yet
+    */
+  ssize_t tryRecv(char * buf, std::size_t len) const;
+
+  /**
+    * Switch the socket between blocking and non-blocking mode.
+    * @param enabled true to make the socket non-blocking, false to make it blocking
+    */
+  void setNonBlocking(bool enabled) const;
+
+  /**
+    * Acknowledge the data received so far right away with TCP_QUICKACK, instead of letting the kernel delay the acknowledgement. 
+    * A peer that has nothing more to send for a while would otherwise hold its next small message back with Nagle's algorithm 
+    * until the delayed acknowledgement comes.
+    */
+  void acknowledgeNow() const;
+
+  /**
+    * Set the socket options of the given profile on the socket.
+    * @param profile the profile to apply
+    */
+  void applyProfile(SocketProfile profile) const;
+
+  /**
+    * Look up a profile by its command-line name: "default", "latency" or "throughput".
+    * @param name the name of the profile
+    * @param profile receives the profile if the name is known
+    * @return true if the name is known, false otherwise
+    */
+  static bool parseProfile(const std::string & name, SocketProfile & profile);
+  /**
+    * Get the command-line name of a profile, as accepted by parseProfile().
+    * @param profile the profile
+    * @return the name of the profile
+    */
+  static const char * profileName(SocketProfile profile);
+
+  /**
+    * Get the IP address of a socket address in text form.
+    * @param address an AF_INET or AF_INET6 socket address
+    * @return the IP address in dotted-decimal or IPv6 text form, or an empty string for other families
+    */
+  static std::string formatAddress(const sockaddr_storage & address);
+  /**
+    * Get the port of a socket address.
+    * @param address an AF_INET or AF_INET6 socket address
+    * @return the port in host byte order, or 0 for other families
+    */
+  static std::uint16_t addressPort(const sockaddr_storage & address);
+  /**
+    * Set the port of a socket address.
+    * @param address an AF_INET or AF_INET6 socket address
+    * @param port the port in host byte order
+    */
+  static void setAddressPort(sockaddr_storage & address, std::uint16_t port);
+
+  /**
+    * Accept a pending connection on a listening socket.
+    * @param address if not null, receives the address of the peer; an IPv4 peer of a dual-stack listener is reported as AF_INET, not as an IPv4-mapped IPv6 address
+    * @param nonBlocking true to make the accepted socket non-blocking
+    * @param profile the socket options to apply to the accepted socket
+    * @return a Socket object representing the accepted connection, or an invalid Socket if no connection is pending on a non-blocking listening socket
+    */
+  Socket accept(sockaddr_storage * address, bool nonBlocking, SocketProfile profile = SocketProfile::Default) const;
+
+  /**
+    * Create a listening socket on the given port, on every IPv6 and IPv4 address of the host if IPv6 is available, 
+    * and on every IPv4 address otherwise.
     * @param port the port number to listen on
+    * @param profile the socket options to apply to the listening socket, which also sizes the buffers of the connections it accepts
     * @return a Socket object representing the listening socket
     */
-  static Socket createListeningSocket(std::uint16_t port);
+  static Socket createListeningSocket(std::uint16_t port, SocketProfile profile = SocketProfile::Default);
 
   /**
     * Connect to a server.
     * @param origin the hostname of the other server
     * @param port the port number of the other server
+    * @param profile the socket options to apply to the connection
     * @return a Socket object representing the connection to the other server
     */
-  static Socket connectToServer(const std::string & server, std::uint16_t port, bool blocking);
+  static Socket connectToServer(const std::string & server, std::uint16_t port, bool blocking, SocketProfile profile = SocketProfile::Default);
+  /**
+    * Connect to a numeric socket address, without going through the resolver.
+    * @param address the AF_INET or AF_INET6 address to connect to
+    * @param blocking false to return while the connection is still in progress
+    * @param profile the socket options to apply to the connection
+    * @return a Socket object representing the connection
+    */
+  static Socket connectTo(const sockaddr_storage & address, bool blocking, SocketProfile profile = SocketProfile::Default);
+
+  /**
+    * Create an AF_UNIX stream listening socket.
+    * @param name the path to bind to, or a name in the abstract namespace if it starts with '@', which needs no file and vanishes with the socket
+    * @return a Socket object representing the listening socket
+    */
+  static Socket createUnixListeningSocket(const std::string & name);
+
+  /**
+    * Connect to an AF_UNIX stream listening socket.
+    * @param name the path of the listening socket, or its name in the abstract namespace if it starts with '@'
+    * @return a Socket object representing the connection
+    */
+  static Socket connectToUnix(const std::string & name);
   
   /**
-    * Send all data in the buffer, blocking until all data is sent.
+    * Send all data in the buffer, blocking until all data is sent. 
+    * A peer that has closed the connection makes the send throw instead of raising SIGPIPE.
     * @param data the buffer containing the data to send
     * @param len the length of the data to send
     */
   void sendAll(const char * data, std::size_t len) const;
+
+  /**
+    * Send all data in the given buffers, in order, blocking until all data is sent. 
+    * The buffers are handed to the kernel in a single sendmsg call, so a small message made of several pieces goes out in one segment. 
+    * As with sendAll(), a peer that has closed the connection makes the send throw instead of raising SIGPIPE.
+    * @param iov the buffers to send
+    * @param iovcnt the number of buffers
+    */
+  void sendAllv(const struct iovec * iov, int iovcnt) const;
   
   /**
     * Release the underlying file descriptor, returning it. After calling this function, the Socket object will no longer manage the file descriptor and will not close it on destruction.
@@ -90,6 +215,6 @@ private:
     * @param server the hostname of the other server
     * @param port the port number of the other server
     */
-  void connect(const std::string & server, std::uint16_t port, bool blocking);
+  void connect(const std::string & server, std::uint16_t port, bool blocking, SocketProfile profile);
 };
 #endif
\ No newline at end of file
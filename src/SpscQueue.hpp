@@ -0,0 +1,70 @@
+#pragma once
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * A bounded lock-free queue for exactly one producer thread and one consumer thread.
+ * The producer only writes tail_ and the consumer only writes head_, so neither side ever waits for the other.
+ */
+template <typename T>
+class SpscQueue {
+public:
+  /**
+   * Create a queue that can hold at least the given number of elements.
+   * @param capacity the minimum number of elements the queue must be able to hold
+   */
+  explicit SpscQueue(std::size_t capacity) : head_(0), tail_(0) {
+    std::size_t size = 2;
+    while (size < capacity + 1) {
+      size <<= 1;
+    }
+    slots_.resize(size);
+    mask_ = size - 1;
+  }
+
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue & operator=(const SpscQueue &) = delete;
+
+  /**
+   * Append an element to the queue. Must only be called from the producer thread.
+   * @param value the element to append
+   * @return true if the element was appended, false if the queue is full
+   */
+  bool push(T && value) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    std::size_t next = (tail + 1) & mask_;
+    if (next == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    slots_[tail] = std::move(value);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Remove the oldest element from the queue. Must only be called from the consumer thread.
+   * @param value receives the removed element
+   * @return true if an element was removed, false if the queue is empty
+   */
+  bool pop(T & value) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = std::move(slots_[head]);
+    head_.store((head + 1) & mask_, std::memory_order_release);
+    return true;
+  }
+private:
+  std::vector<T> slots_;
+  std::size_t mask_;
+  // Keep the two indices on separate cache lines so the producer and consumer do not false-share
+  alignas(64) std::atomic<std::size_t> head_;
+  alignas(64) std::atomic<std::size_t> tail_;
+};
+#endif
@@ -0,0 +1,578 @@
+#include "Transport.hpp"
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <linux/futex.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef __NR_futex_waitv
+#define __NR_futex_waitv 449
+#endif
+
+/**
+ * One direction of a shared memory link: a byte ring written by one side and read by the other.
+ * The positions only ever grow and wrap around at 2^32, so the ring never confuses full with empty.
+ * Each side sleeps on a wakeup counter rather than on a position, so that closing the link can wake it too.
+ */
+struct ShmRing {
+  alignas(64) std::atomic<std::uint32_t> head;        // Read position, advanced by the reader
+  std::atomic<std::uint32_t> writerWaiting;           // Set by the writer before it sleeps on a full ring
+  std::atomic<std::uint32_t> spaceWakeups;            // Futex word the writer sleeps on
+  alignas(64) std::atomic<std::uint32_t> tail;        // Write position, advanced by the writer
+  std::atomic<std::uint32_t> readerWaiting;           // Set by the reader before it sleeps on an empty ring
+  std::atomic<std::uint32_t> dataWakeups;             // Futex word the reader sleeps on
+};
+
+/**
+ * The header of a shared memory link segment, followed by the data of the two rings.
+ */
+struct ShmSegment {
+  std::atomic<std::uint32_t> ready;    // SEGMENT_MAGIC once the creator has initialized the segment
+  std::uint32_t capacity;              // Size of the data of each ring, a power of two
+  std::atomic<std::uint32_t> closed;   // Set by either side when it lets go of the link, or by the survivor when the other side died
+  std::atomic<std::int32_t> pids[2];   // Process IDs of the creator and of the other side, 0 until that side has mapped the segment
+  ShmRing rings[2];                    // rings[0] is written by the creator, rings[1] by the other side
+};
+
+namespace {
+  constexpr std::uint32_t SEGMENT_MAGIC = 0x50544c4b; // "PTLK"
+  // Size of the data of each ring; a potato frame larger than this simply streams through the ring
+  constexpr std::uint32_t RING_CAPACITY = 256 * 1024;
+  // How long to wait for the peer to create its end of a shared memory link
+  constexpr auto OPEN_TIMEOUT = std::chrono::seconds(30);
+  // Sleep of the futex_wait fallback when futex_waitv is not available, in nanoseconds
+  constexpr long FALLBACK_WAIT_NS = 1000 * 1000;
+  // How often a side blocked on a full or empty ring checks that its peer is still alive
+  constexpr struct timespec PEER_CHECK_INTERVAL = {0, 100 * 1000 * 1000};
+
+  // Helper function
+  std::size_t segmentSize(std::uint32_t capacity) {
+    std::size_t header = (sizeof(ShmSegment) + 63) & ~static_cast<std::size_t>(63);
+    return header + 2 * static_cast<std::size_t>(capacity);
+  }
+
+  // Helper function
+  long futexWait(std::atomic<std::uint32_t> * word, std::uint32_t expected, const struct timespec * timeout) {
+    return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+  }
+
+  // Helper function
+  void futexWake(std::atomic<std::uint32_t> * word) {
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+  }
+
+  // Helper function
+  void wakeCounter(std::atomic<std::uint32_t> & counter) {
+    counter.fetch_add(1);
+    futexWake(&counter);
+  }
+
+  // Spin iterations between two reads of the clock
+  constexpr unsigned SPIN_CLOCK_INTERVAL = 64;
+
+  // Helper function
+  inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  // Helper function
+  std::string readLink(const char * path) {
+    char buf[256];
+    ssize_t n = ::readlink(path, buf, sizeof(buf));
+    return n > 0 ? std::string(buf, static_cast<std::size_t>(n)) : std::string();
+  }
+}
+
+bool parseTransport(const std::string & name, TransportKind & kind) {
+  if (name == "tcp") {
+    kind = TransportKind::Tcp;
+  }
+  else if (name == "unix") {
+    kind = TransportKind::Unix;
+  }
+  else if (name == "shm") {
+    kind = TransportKind::SharedMemory;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+const char * transportName(TransportKind kind) {
+  switch (kind) {
+    case TransportKind::Unix:
+      return "unix";
+    case TransportKind::SharedMemory:
+      return "shm";
+    default:
+      return "tcp";
+  }
+}
+
+bool parseWaitMode(const std::string & name, WaitMode & mode) {
+  if (name == "block") {
+    mode = WaitMode::Block;
+  }
+  else if (name == "spin") {
+    mode = WaitMode::Spin;
+  }
+  else if (name == "hybrid") {
+    mode = WaitMode::Hybrid;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+const char * waitModeName(WaitMode mode) {
+  switch (mode) {
+    case WaitMode::Spin:
+      return "spin";
+    case WaitMode::Hybrid:
+      return "hybrid";
+    default:
+      return "block";
+  }
+}
+
+std::string localHostId() {
+  // Containers share the kernel's boot ID, but abstract AF_UNIX names are scoped by the network namespace
+  // and POSIX shared memory by the mount of /dev/shm, so those are part of what makes two players co-located
+  std::string bootId;
+  std::ifstream in("/proc/sys/kernel/random/boot_id");
+  std::getline(in, bootId);
+  if (bootId.empty()) {
+    char hostname[256] = {};
+    ::gethostname(hostname, sizeof(hostname) - 1);
+    bootId = hostname;
+  }
+  return bootId + "/" + readLink("/proc/self/ns/net") + "/" + readLink("/proc/self/ns/mnt");
+}
+
+SocketLink::SocketLink(int fd, TransportKind kind) : fd_(fd), kind_(kind) {
+}
+
+void SocketLink::sendAll(const char * data, std::size_t len) {
+  std::size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = ::send(fd_, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("send failed: ") + std::strerror(errno));
+    }
+    sent += static_cast<std::size_t>(n);
+  }
+}
+
+void SocketLink::recvAll(char * buf, std::size_t len) {
+  std::size_t received = 0;
+  while (received < len) {
+    ssize_t n = ::recv(fd_, buf + received, len - received, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("recv failed: ") + std::strerror(errno));
+    }
+    if (n == 0) {
+      throw std::runtime_error("Peer closed connection before all data was received");
+    }
+    received += static_cast<std::size_t>(n);
+  }
+}
+
+bool SocketLink::readable() const {
+  char byte;
+  ssize_t n = ::recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+bool SocketLink::closed() const {
+  char byte;
+  return ::recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+ShmLink::~ShmLink() {
+  if (segment_ == nullptr) {
+    return;
+  }
+  if (creator_ && segment_->pids[1].load() == 0) {
+    ::shm_unlink(name_.c_str()); // The peer never opened the segment, so its name is still there
+  }
+  segment_->closed.store(1);
+  for (ShmRing & ring : segment_->rings) {
+    wakeCounter(ring.dataWakeups);
+    wakeCounter(ring.spaceWakeups);
+  }
+  ::munmap(segment_, size_);
+}
+
+std::unique_ptr<ShmLink> ShmLink::create(const std::string & name) {
+  int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("shm_open(" + name + ") failed: " + std::strerror(errno));
+  }
+  if (::ftruncate(fd, static_cast<off_t>(segmentSize(RING_CAPACITY))) < 0) {
+    int err = errno;
+    ::close(fd);
+    ::shm_unlink(name.c_str());
+    throw std::runtime_error("ftruncate(" + name + ") failed: " + std::strerror(err));
+  }
+  std::unique_ptr<ShmLink> link(new ShmLink());
+  try {
+    link->map(fd, true);
+  } catch (const std::exception &) {
+    ::shm_unlink(name.c_str());
+    throw;
+  }
+  link->name_ = name;
+  link->created_ = std::chrono::steady_clock::now();
+  // ftruncate zero-fills the segment, which is the initial state of every ring
+  link->segment_->capacity = RING_CAPACITY;
+  link->segment_->pids[0].store(::getpid());
+  link->segment_->ready.store(SEGMENT_MAGIC, std::memory_order_release);
+  futexWake(&link->segment_->ready);
+  return link;
+}
+
+std::unique_ptr<ShmLink> ShmLink::open(const std::string & name) {
+  auto deadline = std::chrono::steady_clock::now() + OPEN_TIMEOUT;
+  const struct timespec pause = {0, FALLBACK_WAIT_NS};
+  int fd;
+  for (;;) {
+    fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    struct stat st;
+    if (fd >= 0 && ::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= segmentSize(RING_CAPACITY)) {
+      break;
+    }
+    int err = errno;
+    if (fd >= 0) {
+      ::close(fd); // Created, but not sized yet
+    }
+    else if (err != ENOENT) {
+      throw std::runtime_error("shm_open(" + name + ") failed: " + std::strerror(err));
+    }
+    if (std::chrono::steady_clock::now() > deadline) {
+      ::shm_unlink(name.c_str()); // In case the peer died between creating and sizing the segment
+      throw std::runtime_error("Timed out waiting for shared memory link " + name);
+    }
+    ::nanosleep(&pause, nullptr);
+  }
+  std::unique_ptr<ShmLink> link(new ShmLink());
+  try {
+    link->map(fd, false);
+  } catch (const std::exception &) {
+    ::shm_unlink(name.c_str());
+    throw;
+  }
+  link->segment_->pids[1].store(::getpid());
+  ::shm_unlink(name.c_str()); // Both sides have it mapped now, so the segment goes away with them
+
+  while (link->segment_->ready.load(std::memory_order_acquire) != SEGMENT_MAGIC) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error("Shared memory link " + name + " was never initialized");
+    }
+    futexWait(&link->segment_->ready, 0, &pause);
+  }
+  if (link->segment_->capacity != RING_CAPACITY) {
+    throw std::runtime_error("Shared memory link " + name + " has an unexpected ring size");
+  }
+  return link;
+}
+
+void ShmLink::map(int fd, bool creator) {
+  size_ = segmentSize(RING_CAPACITY);
+  void * addr = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int err = errno;
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error(std::string("mmap of a shared memory link failed: ") + std::strerror(err));
+  }
+  segment_ = static_cast<ShmSegment *>(addr);
+  creator_ = creator;
+  char * data = static_cast<char *>(addr) + (size_ - 2 * static_cast<std::size_t>(RING_CAPACITY));
+  tx_ = &segment_->rings[creator ? 0 : 1];
+  rx_ = &segment_->rings[creator ? 1 : 0];
+  txData_ = data + (creator ? 0 : RING_CAPACITY);
+  rxData_ = data + (creator ? RING_CAPACITY : 0);
+}
+
+void ShmLink::sendAll(const char * data, std::size_t len) {
+  std::uint32_t tail = tx_->tail.load(std::memory_order_relaxed); // Only this side moves it
+  while (len > 0) {
+    if (segment_->closed.load(std::memory_order_acquire)) {
+      throw std::runtime_error("send failed: the peer closed the shared memory link");
+    }
+    std::uint32_t free = RING_CAPACITY - (tail - tx_->head.load(std::memory_order_acquire));
+    if (free == 0) {
+      // Announce the wait before rechecking, so that the reader either sees the flag or this side sees the reader's progress
+      std::uint32_t expected = tx_->spaceWakeups.load();
+      tx_->writerWaiting.store(1);
+      if (tail - tx_->head.load() == RING_CAPACITY && !segment_->closed.load()) {
+        if (futexWait(&tx_->spaceWakeups, expected, &PEER_CHECK_INTERVAL) < 0 && errno == ETIMEDOUT) {
+          checkPeer();
+        }
+      }
+      tx_->writerWaiting.store(0);
+      continue;
+    }
+    std::uint32_t n = static_cast<std::uint32_t>(std::min<std::size_t>(free, len));
+    std::uint32_t offset = tail & (RING_CAPACITY - 1);
+    std::uint32_t first = std::min(n, RING_CAPACITY - offset);
+    std::memcpy(txData_ + offset, data, first);
+    std::memcpy(txData_, data + first, n - first);
+    tail += n;
+    data += n;
+    len -= n;
+    tx_->tail.store(tail);
+    if (tx_->readerWaiting.load()) {
+      wakeCounter(tx_->dataWakeups);
+    }
+  }
+}
+
+void ShmLink::recvAll(char * buf, std::size_t len) {
+  std::uint32_t head = rx_->head.load(std::memory_order_relaxed); // Only this side moves it
+  while (len > 0) {
+    std::uint32_t available = rx_->tail.load(std::memory_order_acquire) - head;
+    if (available == 0) {
+      if (segment_->closed.load(std::memory_order_acquire)) {
+        throw std::runtime_error("Peer closed connection before all data was received");
+      }
+      std::uint32_t expected;
+      armWait(expected);
+      if (rx_->tail.load() == head && !segment_->closed.load()) {
+        if (futexWait(&rx_->dataWakeups, expected, &PEER_CHECK_INTERVAL) < 0 && errno == ETIMEDOUT) {
+          checkPeer();
+        }
+      }
+      disarmWait();
+      continue;
+    }
+    std::uint32_t n = static_cast<std::uint32_t>(std::min<std::size_t>(available, len));
+    std::uint32_t offset = head & (RING_CAPACITY - 1);
+    std::uint32_t first = std::min(n, RING_CAPACITY - offset);
+    std::memcpy(buf, rxData_ + offset, first);
+    std::memcpy(buf + first, rxData_, n - first);
+    head += n;
+    buf += n;
+    len -= n;
+    rx_->head.store(head);
+    if (rx_->writerWaiting.load()) {
+      wakeCounter(rx_->spaceWakeups);
+    }
+  }
+}
+
+void ShmLink::checkPeer() noexcept {
+  std::int32_t pid = segment_->pids[creator_ ? 1 : 0].load();
+  bool alive;
+  if (pid == 0) {
+    // The other side gives up on opening the segment after OPEN_TIMEOUT
+    alive = std::chrono::steady_clock::now() < created_ + OPEN_TIMEOUT;
+  }
+  else {
+    alive = ::kill(pid, 0) == 0 || errno == EPERM;
+  }
+  if (!alive) {
+    segment_->closed.store(1);
+  }
+}
+
+bool ShmLink::closed() const noexcept {
+  return segment_->closed.load(std::memory_order_acquire) && !readable();
+}
+
+bool ShmLink::readable() const noexcept {
+  return rx_->tail.load(std::memory_order_acquire) != rx_->head.load(std::memory_order_relaxed);
+}
+
+std::uint32_t * ShmLink::armWait(std::uint32_t & expected) noexcept {
+  expected = rx_->dataWakeups.load();
+  rx_->readerWaiting.store(1);
+  return reinterpret_cast<std::uint32_t *>(&rx_->dataWakeups);
+}
+
+void ShmLink::disarmWait() noexcept {
+  rx_->readerWaiting.store(0);
+}
+
+LinkWaiter::LinkWaiter(std::vector<Link *> links, WaitMode mode, std::uint64_t spinBudgetNs) 
+    : links_(std::move(links)), dropped_(links_.size()), mode_(mode), spinBudgetNs_(spinBudgetNs), socketsReady_(0), stopping_(false) {
+  for (std::size_t i = 0; i < links_.size(); ++i) {
+    if (links_[i]->kind() == TransportKind::SharedMemory) {
+      shms_.push_back(i);
+    }
+    else {
+      sockets_.push_back(i);
+    }
+  }
+  if (!shms_.empty() && !sockets_.empty()) {
+    stopFd_ = ::eventfd(0, EFD_CLOEXEC);
+    if (stopFd_ < 0) {
+      throw std::runtime_error(std::string("eventfd failed: ") + std::strerror(errno));
+    }
+    watcher_ = std::thread(&LinkWaiter::watchSockets, this);
+  }
+}
+
+LinkWaiter::~LinkWaiter() {
+  if (watcher_.joinable()) {
+    stopping_.store(true);
+    std::uint64_t one = 1;
+    ssize_t written = ::write(stopFd_, &one, sizeof(one));
+    (void) written;
+    wakeCounter(socketsReady_); // In case the helper thread is waiting for its last wakeup to be taken
+    watcher_.join();
+  }
+  if (stopFd_ >= 0) {
+    ::close(stopFd_);
+  }
+}
+
+void LinkWaiter::drop(std::size_t index) {
+  dropped_[index].store(true);
+}
+
+std::size_t LinkWaiter::pollSockets(int timeoutMs) {
+  std::vector<struct pollfd> pfds;
+  for (std::size_t i : sockets_) {
+    int fd = static_cast<SocketLink *>(links_[i])->fd();
+    pfds.push_back({dropped_[i].load() ? -1 : fd, POLLIN, 0}); // poll() skips negative descriptors
+  }
+  for (;;) {
+    int ret = ::poll(pfds.data(), pfds.size(), timeoutMs);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+    }
+    for (std::size_t k = 0; k < pfds.size(); ++k) {
+      if (pfds[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+        return sockets_[k];
+      }
+    }
+    if (timeoutMs == 0) {
+      return links_.size();
+    }
+  }
+}
+
+std::size_t LinkWaiter::spin(std::uint64_t budgetNs) const {
+  std::uint64_t deadline = budgetNs == UINT64_MAX ? UINT64_MAX : monotonicNanos() + budgetNs;
+  for (unsigned i = 1;; ++i) {
+    for (std::size_t k = 0; k < links_.size(); ++k) {
+      if (!dropped_[k].load(std::memory_order_relaxed) && links_[k]->readable()) {
+        return k;
+      }
+    }
+    cpuRelax();
+    if (i % SPIN_CLOCK_INTERVAL == 0 && monotonicNanos() >= deadline) {
+      return links_.size();
+    }
+  }
+}
+
+std::size_t LinkWaiter::wait() {
+  if (mode_ != WaitMode::Block) {
+    std::size_t ready = spin(mode_ == WaitMode::Spin ? UINT64_MAX : spinBudgetNs_);
+    if (ready < links_.size()) {
+      return ready;
+    }
+  }
+  if (shms_.empty()) {
+    return pollSockets(-1);
+  }
+  std::vector<struct futex_waitv> waiters(shms_.size() + (sockets_.empty() ? 0 : 1));
+  for (;;) {
+    // Hand the sockets back to the helper thread once the link it reported has been read
+    if (socketsReady_.load() == 2) {
+      socketsReady_.store(0);
+      futexWake(&socketsReady_);
+    }
+    for (std::size_t k = 0; k < waiters.size(); ++k) {
+      std::uint32_t expected = 0;
+      std::uint32_t * word;
+      if (k < shms_.size()) {
+        word = static_cast<ShmLink *>(links_[shms_[k]])->armWait(expected);
+      }
+      else {
+        word = reinterpret_cast<std::uint32_t *>(&socketsReady_);
+      }
+      waiters[k] = {expected, reinterpret_cast<std::uintptr_t>(word), FUTEX_32, 0};
+    }
+
+    // Recheck every link after arming, so that no wakeup is lost, and pick the earliest ready one
+    std::size_t ready = links_.size();
+    if (socketsReady_.load() == 1) {
+      ready = pollSockets(0);
+      socketsReady_.store(2);
+    }
+    for (std::size_t i : shms_) {
+      if (i < ready && !dropped_[i].load() && static_cast<ShmLink *>(links_[i])->readable()) {
+        ready = i;
+      }
+    }
+    if (ready == links_.size()) {
+      long ret = ::syscall(__NR_futex_waitv, waiters.data(), waiters.size(), 0, nullptr, CLOCK_MONOTONIC);
+      if (ret < 0 && errno == ENOSYS) {
+        // Kernels before 5.16 cannot wait on several futexes; sleep on the first one for a bit and look again
+        const struct timespec pause = {0, FALLBACK_WAIT_NS};
+        futexWait(reinterpret_cast<std::atomic<std::uint32_t> *>(waiters[0].uaddr), static_cast<std::uint32_t>(waiters[0].val), &pause);
+      }
+    }
+    for (std::size_t i : shms_) {
+      static_cast<ShmLink *>(links_[i])->disarmWait();
+    }
+    if (ready < links_.size()) {
+      return ready;
+    }
+  }
+}
+
+void LinkWaiter::watchSockets() {
+  std::vector<struct pollfd> pfds;
+  while (!stopping_.load()) {
+    pfds.clear();
+    for (std::size_t i : sockets_) {
+      int fd = static_cast<SocketLink *>(links_[i])->fd();
+      pfds.push_back({dropped_[i].load() ? -1 : fd, POLLIN, 0});
+    }
+    pfds.push_back({stopFd_, POLLIN, 0});
+    int ret = ::poll(pfds.data(), pfds.size(), -1);
+    if (ret < 0 && errno != EINTR) {
+      return;
+    }
+    if (ret <= 0 || (pfds.back().revents & POLLIN)) {
+      continue;
+    }
+    // 0: nothing to report, 1: a socket is readable, 2: the waiter has taken the report and is reading the socket
+    socketsReady_.store(1);
+    futexWake(&socketsReady_);
+    std::uint32_t state;
+    while ((state = socketsReady_.load()) != 0 && !stopping_.load()) {
+      futexWait(&socketsReady_, state, nullptr);
+    }
+  }
+}
@@ -0,0 +1,273 @@
+#pragma once
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The kinds of link a player can have with a neighbor.
+ */
+enum class TransportKind : std::uint8_t {
+  Tcp,          // A TCP connection, which works across hosts
+  Unix,         // An AF_UNIX stream socket in the abstract namespace, for players on the same host
+  SharedMemory, // A pair of ring buffers in a shared memory segment with futex wakeups, for players on the same host
+};
+
+/**
+ * Look up a transport by its name: "tcp", "unix" or "shm".
+ * @param name the name of the transport
+ * @param kind receives the transport if the name is known
+ * @return true if the name is known, false otherwise
+ */
+bool parseTransport(const std::string & name, TransportKind & kind);
+/**
+ * Get the name of a transport, as accepted by parseTransport().
+ * @param kind the transport
+ * @return the name of the transport
+ */
+const char * transportName(TransportKind kind);
+/**
+ * Get an identifier of the host that is the same for every process on the host and differs between hosts (and between boots),
+ * so that the ringmaster can tell which players share a host.
+ * @return the identifier of the host
+ */
+std::string localHostId();
+
+/**
+ * How a player waits for the next potato.
+ */
+enum class WaitMode : std::uint8_t {
+  Block,  // Sleep in the kernel until a link is ready, paying a scheduler wakeup on every hop
+  Spin,   // Poll the links without sleeping, which needs a core of its own
+  Hybrid, // Spin for a budget, then block
+};
+
+/**
+ * Look up a wait mode by its name: "block", "spin" or "hybrid".
+ * @param name the name of the wait mode
+ * @param mode receives the wait mode if the name is known
+ * @return true if the name is known, false otherwise
+ */
+bool parseWaitMode(const std::string & name, WaitMode & mode);
+/**
+ * Get the name of a wait mode, as accepted by parseWaitMode().
+ * @param mode the wait mode
+ * @return the name of the wait mode
+ */
+const char * waitModeName(WaitMode mode);
+
+/**
+ * A bidirectional byte stream to a peer, whatever the transport underneath.
+ */
+class Link {
+public:
+  virtual ~Link() = default;
+
+  /**
+   * Send all data in the buffer, blocking until all data is sent.
+   * @param data the buffer containing the data to send
+   * @param len the length of the data to send
+   */
+  virtual void sendAll(const char * data, std::size_t len) = 0;
+  /**
+   * Receive exactly len bytes, blocking until all data is received.
+   * @param buf buffer to receive data into
+   * @param len length of the buffer
+   * @throws std::runtime_error if the peer closes the link before all data is received
+   */
+  virtual void recvAll(char * buf, std::size_t len) = 0;
+  /**
+   * Check without blocking or sleeping whether recvAll() would make progress.
+   * @return true if data can be received
+   */
+  virtual bool readable() const = 0;
+  /**
+   * Check without blocking whether the peer has closed the link at a message boundary, with no data left to receive.
+   * @return true if the link can never deliver data again
+   */
+  virtual bool closed() const = 0;
+  /**
+   * Get the transport of the link.
+   * @return the transport of the link
+   */
+  virtual TransportKind kind() const = 0;
+};
+
+/**
+ * A link over a connected stream socket (TCP or AF_UNIX). The link does not own the socket.
+ */
+class SocketLink : public Link {
+public:
+  /**
+   * @param fd the connected socket
+   * @param kind the transport of the socket
+   */
+  SocketLink(int fd, TransportKind kind);
+
+  void sendAll(const char * data, std::size_t len) override;
+  void recvAll(char * buf, std::size_t len) override;
+  /**
+   * Peek at the socket without blocking. A socket whose peer has closed it is readable, so that the read reports the closed connection.
+   * @return true if data can be received
+   */
+  bool readable() const override;
+  bool closed() const override;
+  TransportKind kind() const override { return kind_; }
+
+  /**
+   * Get the socket of the link, to wait for it with poll().
+   * @return the file descriptor of the socket
+   */
+  int fd() const noexcept { return fd_; }
+private:
+  int fd_;
+  TransportKind kind_;
+};
+
+struct ShmSegment;
+struct ShmRing;
+
+/**
+ * A link over a shared memory segment holding one single-producer single-consumer byte ring per direction. 
+ * Data is copied straight into the peer's address space; a futex wakes the other side only when it is actually asleep, 
+ * so a busy link makes no system calls at all.
+ * The segment is created by the connecting side and opened by the accepting side, which then unlinks its name; 
+ * the creator unlinks it instead if the accepting side never opens it.
+ * Each side records its process ID in the segment, and a side blocked on a full or empty ring checks every so often 
+ * that its peer is still alive, so a peer that crashed without closing the link reads as closed rather than hanging it.
+ */
+class ShmLink : public Link {
+public:
+  ~ShmLink() override;
+
+  ShmLink(const ShmLink &) = delete;
+  ShmLink & operator=(const ShmLink &) = delete;
+
+  /**
+   * Create the shared memory segment of a link.
+   * The creator unlinks the segment on destruction if the peer never opened it.
+   * @param name the name of the segment, starting with '/'
+   * @return the link
+   * @throws std::runtime_error if the segment cannot be created
+   */
+  static std::unique_ptr<ShmLink> create(const std::string & name);
+  /**
+   * Open the shared memory segment created by the peer, waiting until the peer has created and initialized it, 
+   * and unlink its name so that the segment goes away with the two processes.
+   * @param name the name of the segment, starting with '/'
+   * @return the link
+   * @throws std::runtime_error if the segment cannot be opened or is not a link segment
+   */
+  static std::unique_ptr<ShmLink> open(const std::string & name);
+
+  void sendAll(const char * data, std::size_t len) override;
+  void recvAll(char * buf, std::size_t len) override;
+  TransportKind kind() const override { return TransportKind::SharedMemory; }
+
+  /**
+   * Check without blocking whether data can be received. A link whose peer has closed it without leaving data behind is never readable, 
+   * since it can no longer deliver a potato.
+   * @return true if recvAll() would make progress without waiting
+   */
+  bool readable() const noexcept override;
+  bool closed() const noexcept override;
+  /**
+   * Announce that the receiving side is about to sleep, so that the sender wakes it up.
+   * @param expected receives the value the futex word must still have for the receiving side to go to sleep
+   * @return the futex word to sleep on
+   */
+  std::uint32_t * armWait(std::uint32_t & expected) noexcept;
+  /**
+   * Withdraw an announcement made with armWait().
+   */
+  void disarmWait() noexcept;
+private:
+  ShmSegment * segment_ = nullptr;
+  std::size_t size_ = 0;
+  ShmRing * tx_ = nullptr;
+  ShmRing * rx_ = nullptr;
+  char * txData_ = nullptr;
+  char * rxData_ = nullptr;
+  bool creator_ = false;
+  std::string name_; // Name of the segment, kept by the creator
+  std::chrono::steady_clock::time_point created_; // When the creator initialized the segment
+
+  ShmLink() = default;
+  /**
+   * Map a segment and pick the rings of this side.
+   * @param fd the shared memory file descriptor
+   * @param creator true for the side that created the segment
+   */
+  void map(int fd, bool creator);
+  /**
+   * Mark the link closed if the peer has died, or has still not opened the segment after the time the peer waits for it.
+   */
+  void checkPeer() noexcept;
+};
+
+/**
+ * Waits until one of a set of links has data to receive. Socket links alone are waited for with poll(); 
+ * shared memory links are waited for with futex_waitv() on the futex words of their rings. When both kinds are present, 
+ * a helper thread polls the sockets and turns their readiness into a futex wakeup, so one wait covers every link.
+ * In the spin and hybrid modes, the links are first polled from user space (a peek at each socket, a load of each ring), 
+ * so a potato that arrives while spinning is picked up without a scheduler wakeup.
+ */
+class LinkWaiter {
+public:
+  /**
+   * @param links the links to wait for, in priority order; they must outlive the waiter
+   * @param mode how to wait
+   * @param spinBudgetNs how long the hybrid mode spins before it blocks, in nanoseconds
+   */
+  explicit LinkWaiter(std::vector<Link *> links, WaitMode mode = WaitMode::Block, std::uint64_t spinBudgetNs = 0);
+  ~LinkWaiter();
+
+  LinkWaiter(const LinkWaiter &) = delete;
+  LinkWaiter & operator=(const LinkWaiter &) = delete;
+
+  /**
+   * Wait until a link has data to receive. A socket link is also ready once its peer has closed it, so that the read reports the closed connection.
+   * @return the index of the ready link; the earliest ready link wins
+   */
+  std::size_t wait();
+  /**
+   * Stop waiting for a link, e.g. one whose peer has closed it and which would otherwise be reported as ready forever.
+   * @param index the index of the link
+   */
+  void drop(std::size_t index);
+private:
+  std::vector<Link *> links_;
+  std::vector<std::atomic<bool>> dropped_; // Read by the helper thread, which leaves dropped sockets out of its poll set
+  WaitMode mode_;
+  std::uint64_t spinBudgetNs_;
+  std::vector<std::size_t> sockets_; // Indices of the socket links
+  std::vector<std::size_t> shms_; // Indices of the shared memory links
+  std::atomic<std::uint32_t> socketsReady_; // Set by the helper thread when a socket is readable
+  std::atomic<bool> stopping_;
+  int stopFd_ = -1; // eventfd that stops the helper thread
+  std::thread watcher_;
+
+  /**
+   * Poll every link from user space until one is ready or the spin budget runs out.
+   * @param budgetNs the spin budget in nanoseconds, or UINT64_MAX to spin until a link is ready
+   * @return the index of the ready link, or the number of links if the budget ran out
+   */
+  std::size_t spin(std::uint64_t budgetNs) const;
+  /**
+   * Wait for socket links only.
+   * @return the index of the ready link
+   */
+  std::size_t pollSockets(int timeoutMs);
+  /**
+   * Body of the helper thread: poll the socket links and raise socketsReady_ whenever one is readable.
+   */
+  void watchSockets();
+};
+#endif
@@ -0,0 +1,146 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include "Socket.hpp"
+#include "topology.hpp"
+
+namespace {
+    constexpr int RINGMASTER_START_ATTEMPTS = 500;
+    constexpr int RINGMASTER_START_INTERVAL_MS = 10;
+}
+
+Benchmark::Benchmark(const BenchmarkOptions & options) : options_(options) {}
+
+void Benchmark::run(std::ostream & out) const {
+    out << "[\n";
+    bool first = true;
+    for (int numPlayers : options_.playerCounts) {
+        for (int numHops : options_.hopCounts) {
+            for (const std::string & topology : options_.topologies) {
+                TopologyOptions topologyOptions;
+                parseTopology(topology, topologyOptions.kind);
+                topologyOptions.degree = options_.degree;
+                std::string problem = checkTopology(topologyOptions, numPlayers);
+                if (!problem.empty()) {
+                    std::cerr << "Skipping " << topology << " with " << numPlayers << " players: " << problem << std::endl;
+                    continue;
+                }
+                for (const std::string & socketProfile : options_.socketProfiles) {
+                    for (const std::string & transport : options_.transports) {
+                        for (const std::string & waitMode : options_.waitModes) {
+                            std::string stats = runGame(numPlayers, numHops, topology, socketProfile, transport, waitMode);
+                            out << (first ? "  " : ",\n  ") << stats;
+                            out.flush();
+                            first = false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    out << "\n]\n";
+}
+
+std::string Benchmark::runGame(int numPlayers, int numHops, const std::string & topology, const std::string & socketProfile, 
+                               const std::string & transport, const std::string & waitMode) const {
+    char statsPath[] = "/tmp/potato_bench_XXXXXX";
+    int statsFd = ::mkstemp(statsPath);
+    if (statsFd < 0) {
+        throw std::runtime_error("Could not create a stats file");
+    }
+    ::close(statsFd);
+
+    std::string port = std::to_string(options_.port);
+    pid_t ringmaster = spawn({options_.binaryDir + "/ringmaster", port, std::to_string(numPlayers), std::to_string(numHops), 
+                              "--potatoes", std::to_string(options_.numPotatoes), "--timestamps", "--socket-profile", socketProfile, 
+                              "--local-transport", transport, "--topology", topology, "--degree", std::to_string(options_.degree), 
+                              "--seed", std::to_string(options_.seed), "--stats", statsPath});
+    waitForRingmaster(ringmaster);
+    std::vector<pid_t> players;
+    unsigned numCpus = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < numPlayers; ++i) {
+        std::vector<std::string> args = {options_.binaryDir + "/player", "127.0.0.1", port, "--socket-profile", socketProfile, 
+                                         "--wait-mode", waitMode, "--spin-us", std::to_string(options_.spinUs)};
+        if (options_.pinPlayers) {
+            args.push_back("--cpu");
+            args.push_back(std::to_string(i % numCpus));
+        }
+        players.push_back(spawn(args));
+    }
+    waitForExit(ringmaster, "ringmaster");
+    for (pid_t player : players) {
+        waitForExit(player, "player");
+    }
+
+    std::ifstream in(statsPath);
+    std::string stats((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ::unlink(statsPath);
+    while (!stats.empty() && stats.back() == '\n') {
+        stats.pop_back();
+    }
+    if (stats.empty() || stats.front() != '{') {
+        throw std::runtime_error("The ringmaster did not write any stats");
+    }
+    return "{\"wait_mode\": \"" + waitMode + "\", " + stats.substr(1);
+}
+
+pid_t Benchmark::spawn(const std::vector<std::string> & args) const {
+    std::vector<char *> argv;
+    for (const std::string & arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork failed");
+    }
+    if (pid == 0) {
+        int devNull = ::open("/dev/null", O_WRONLY);
+        if (devNull >= 0) {
+            ::dup2(devNull, STDOUT_FILENO);
+            ::dup2(devNull, STDERR_FILENO);
+            ::close(devNull);
+        }
+        ::execv(argv[0], argv.data());
+        ::_exit(127);
+    }
+    return pid;
+}
+
+void Benchmark::waitForRingmaster(pid_t ringmaster) const {
+    for (int attempt = 0; attempt < RINGMASTER_START_ATTEMPTS; ++attempt) {
+        try {
+            Socket::connectToServer("127.0.0.1", options_.port, true);
+            return;
+        } catch (const std::exception &) {
+            int status;
+            if (::waitpid(ringmaster, &status, WNOHANG) == ringmaster) {
+                throw std::runtime_error("The ringmaster exited before accepting players");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(RINGMASTER_START_INTERVAL_MS));
+        }
+    }
+    throw std::runtime_error("The ringmaster did not start listening");
+}
+
+void Benchmark::waitForExit(pid_t pid, const std::string & name) const {
+    int status;
+    while (::waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            throw std::runtime_error("waitpid failed");
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("The " + name + " did not exit cleanly");
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * Options that change which games the benchmark plays.
+ */
+struct BenchmarkOptions {
+    // Number of players of each game in the grid
+    std::vector<int> playerCounts = {2, 4, 8};
+    // Number of hops of each game in the grid
+    std::vector<int> hopCounts = {100, 1000};
+    // Socket profiles, by command-line name, that every game of the grid is played with, so that their effect can be compared
+    std::vector<std::string> socketProfiles = {"default", "latency", "throughput"};
+    // Transports, by command-line name, of the links between the players, which all run on this host
+    std::vector<std::string> transports = {"tcp", "unix", "shm"};
+    // Wait modes, by command-line name, of the players; the hop latency of a game is mostly the receiving player's wakeup latency
+    std::vector<std::string> waitModes = {"block", "spin", "hybrid"};
+    // Spin budget of the hybrid wait mode, in microseconds
+    int spinUs = 50;
+    // Pin player i to CPU i modulo the number of CPUs, which the spin wait mode needs to avoid stealing the CPU of the player it waits for
+    bool pinPlayers = false;
+    // Topologies, by command-line name, the players are arranged in; games whose number of players a topology cannot arrange are skipped
+    std::vector<std::string> topologies = {"ring"};
+    // Number of neighbors of every player in the random regular topology
+    int degree = 3;
+    // Seed of every game, so that games with the same number of players, hops and topology take the same hop paths and can be compared
+    std::uint64_t seed = 1;
+    // Number of potatoes injected at the start of every game
+    int numPotatoes = 1;
+    // Port the ringmaster listens on
+    std::uint16_t port = 4444;
+    // Directory containing the ringmaster and player executables
+    std::string binaryDir = ".";
+};
+
+/**
+ * Plays a grid of (players, hops, topology, socket profile, transport, wait mode) games on localhost with real ringmaster and player processes, 
+ * and reports the registration time, hop rate, per-hop latency percentiles and shutdown time of every game as a JSON array.
+ * The numbers are measured by the ringmaster itself, which writes them to a stats file at the end of each game.
+ */
+class Benchmark {
+public:
+    Benchmark(const BenchmarkOptions & options = BenchmarkOptions());
+
+    /**
+     * Play every game of the grid, one after the other, and write the results to the given stream.
+     * @param out the stream to write the JSON array of results to
+     */
+    void run(std::ostream & out) const;
+private:
+    BenchmarkOptions options_;
+
+    /**
+     * Play a single game with a ringmaster and the given number of players, and return its stats.
+     * @param numPlayers the number of player processes to launch
+     * @param numHops the number of hops of the game
+     * @param topology the topology the players are arranged in
+     * @param socketProfile the socket profile the ringmaster and the players use
+     * @param transport the transport of the links between the players
+     * @param waitMode the wait mode of the players
+     * @return the JSON object written by the ringmaster, with the wait mode added
+     */
+    std::string runGame(int numPlayers, int numHops, const std::string & topology, const std::string & socketProfile, 
+                        const std::string & transport, const std::string & waitMode) const;
+    /**
+     * Launch a process with its output discarded, so that printing traces does not skew the measurements.
+     * @param args the path of the executable followed by its arguments
+     * @return the ID of the launched process
+     */
+    pid_t spawn(const std::vector<std::string> & args) const;
+    /**
+     * Wait until the ringmaster accepts connections, so that no player is launched before the ringmaster listens.
+     * The probe connection closes without registering, so the ringmaster drops it.
+     * @param ringmaster the ID of the ringmaster process, checked so that a ringmaster that failed to start is not waited for forever
+     */
+    void waitForRingmaster(pid_t ringmaster) const;
+    /**
+     * Wait for a launched process to exit.
+     * @param pid the ID of the process
+     * @param name the name of the process, used in error messages
+     */
+    void waitForExit(pid_t pid, const std::string & name) const;
+};
+#endif
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include "bench.hpp"
+#include "Socket.hpp"
+#include "Transport.hpp"
+#include "topology.hpp"
+
+// Helper function
+std::vector<int> parseList(const std::string & list) {
+    std::vector<int> values;
+    std::stringstream ss(list);
+    std::string value;
+    while (std::getline(ss, value, ',')) {
+        values.push_back(std::stoi(value));
+    }
+    return values;
+}
+
+int main(int argc, char * argv[]) {
+    BenchmarkOptions options;
+    std::string self = argv[0];
+    std::size_t slash = self.rfind('/');
+    if (slash != std::string::npos) {
+        options.binaryDir = self.substr(0, slash);
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--players" && i + 1 < argc) {
+            options.playerCounts = parseList(argv[++i]);
+        }
+        else if (option == "--hops" && i + 1 < argc) {
+            options.hopCounts = parseList(argv[++i]);
+        }
+        else if (option == "--profiles" && i + 1 < argc) {
+            options.socketProfiles.clear();
+            std::stringstream ss(argv[++i]);
+            std::string name;
+            while (std::getline(ss, name, ',')) {
+                SocketProfile profile;
+                if (!Socket::parseProfile(name, profile)) {
+                    std::cerr << "Unknown socket profile: " << name << std::endl;
+                    return EXIT_FAILURE;
+                }
+                options.socketProfiles.push_back(name);
+            }
+        }
+        else if (option == "--transports" && i + 1 < argc) {
+            options.transports.clear();
+            std::stringstream ss(argv[++i]);
+            std::string name;
+            while (std::getline(ss, name, ',')) {
+                TransportKind transport;
+                if (!parseTransport(name, transport)) {
+                    std::cerr << "Unknown transport: " << name << std::endl;
+                    return EXIT_FAILURE;
+                }
+                options.transports.push_back(name);
+            }
+        }
+        else if (option == "--topologies" && i + 1 < argc) {
+            options.topologies.clear();
+            std::stringstream ss(argv[++i]);
+            std::string name;
+            while (std::getline(ss, name, ',')) {
+                TopologyKind topology;
+                if (!parseTopology(name, topology)) {
+                    std::cerr << "Unknown topology: " << name << std::endl;
+                    return EXIT_FAILURE;
+                }
+                options.topologies.push_back(name);
+            }
+        }
+        else if (option == "--degree" && i + 1 < argc) {
+            options.degree = std::stoi(argv[++i]);
+        }
+        else if (option == "--seed" && i + 1 < argc) {
+            options.seed = std::stoull(argv[++i]);
+        }
+        else if (option == "--wait-modes" && i + 1 < argc) {
+            options.waitModes.clear();
+            std::stringstream ss(argv[++i]);
+            std::string name;
+            while (std::getline(ss, name, ',')) {
+                WaitMode mode;
+                if (!parseWaitMode(name, mode)) {
+                    std::cerr << "Unknown wait mode: " << name << std::endl;
+                    return EXIT_FAILURE;
+                }
+                options.waitModes.push_back(name);
+            }
+        }
+        else if (option == "--spin-us" && i + 1 < argc) {
+            options.spinUs = std::stoi(argv[++i]);
+            if (options.spinUs < 0) {
+                std::cerr << "Invalid spin budget." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--pin") {
+            options.pinPlayers = true;
+        }
+        else if (option == "--potatoes" && i + 1 < argc) {
+            options.numPotatoes = std::stoi(argv[++i]);
+        }
+        else if (option == "--port" && i + 1 < argc) {
+            int port = std::stoi(argv[++i]);
+            if (port <= 0 || port > 65535) {
+                std::cerr << "Invalid port number." << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.port = static_cast<std::uint16_t>(port);
+        }
+        else {
+            std::cerr << "Usage: potato_bench [--players <n1,n2,...>] [--hops <h1,h2,...>] [--topologies <t1,t2,...>] [--degree <degree>] [--seed <seed>] [--profiles <p1,p2,...>] [--transports <t1,t2,...>] "
+                      << "[--wait-modes <w1,w2,...>] [--spin-us <microseconds>] [--pin] [--potatoes <num_potatoes>] [--port <port>]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    for (int numPlayers : options.playerCounts) {
+        if (numPlayers <= 1) {
+            std::cerr << "Number of players must be greater than 1." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    for (int numHops : options.hopCounts) {
+        if (numHops <= 0) {
+            std::cerr << "Number of hops must be positive." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.numPotatoes <= 0) {
+        std::cerr << "Number of potatoes must be positive." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        Benchmark benchmark(options);
+        benchmark.run(std::cout);
+    } catch (const std::exception & e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include "metrics.hpp"
+#include "potato.hpp"
+#include "protocol.hpp"
+#include "Socket.hpp"
+
+// Round trips of the messages players send the ringmaster outside of the potato links, through a connected pair of sockets.
+// The messages are small enough to fit in the socket buffer, so each one is written and then read back on the same thread.
+
+// Helper function
+void expect(bool condition, const std::string & what) {
+    if (!condition) {
+        throw std::runtime_error("Check failed: " + what);
+    }
+}
+
+// Helper function
+void connectedPair(Socket & a, Socket & b) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        throw std::runtime_error("socketpair failed");
+    }
+    a = Socket(fds[0]);
+    b = Socket(fds[1]);
+}
+
+// Helper function
+PlayerCounters sampleCounters() {
+    // Values past 32 bits, so that a truncated counter does not go unnoticed
+    PlayerCounters counters;
+    counters.hops = 1;
+    counters.bytesSent = 0x100000002ULL;
+    counters.bytesReceived = 0x300000004ULL;
+    counters.wakeups = 5;
+    counters.waitNs = 0xfedcba9876543210ULL;
+    counters.latencyNs = 7;
+    counters.latencySamples = 8;
+    return counters;
+}
+
+// Helper function
+bool sameCounters(const PlayerCounters & a, const PlayerCounters & b) {
+    return a.hops == b.hops && a.bytesSent == b.bytesSent && a.bytesReceived == b.bytesReceived && a.wakeups == b.wakeups
+        && a.waitNs == b.waitNs && a.latencyNs == b.latencyNs && a.latencySamples == b.latencySamples;
+}
+
+// Helper function
+void checkReport() {
+    Socket player, ringmaster;
+    connectedPair(player, ringmaster);
+    Potato potato(3);
+    potato.setId(9);
+    writeReport(player, sampleCounters());
+    writePotato(player, potato);
+
+    Potato received(0);
+    PlayerCounters counters;
+    expect(!readPlayerFrame(ringmaster, received, counters), "a report is read as a report");
+    expect(sameCounters(counters, sampleCounters()), "a report carries the counters");
+    expect(readPlayerFrame(ringmaster, received, counters), "a potato after a report is read as a potato");
+    expect(received.getHops() == 3 && received.getId() == 9, "a potato after a report is decoded");
+}
+
+// Helper function
+void checkMalformedReport() {
+    Socket player, ringmaster;
+    connectedPair(player, ringmaster);
+    const char frame[] = {0, 0, 0, 2, static_cast<char>(0xff), 0}; // A report tag with a body too short for the counters
+    player.sendAll(frame, sizeof(frame));
+
+    Potato received(0);
+    PlayerCounters counters;
+    bool rejected = false;
+    try {
+        readPlayerFrame(ringmaster, received, counters);
+    } catch (const std::runtime_error &) {
+        rejected = true;
+    }
+    expect(rejected, "a report with the wrong length is rejected");
+}
+
+// Helper function
+void checkShutdownAck() {
+    Socket player, ringmaster;
+    connectedPair(player, ringmaster);
+    std::vector<TraceLogEntry> traceLog = {{1, 0, 4, 0, 0}, {2, 300, 70000, 123456789, 65535}};
+    writeShutdownAck(player, traceLog, sampleCounters());
+    writeShutdownAck(player, {}, PlayerCounters());
+
+    std::vector<TraceLogEntry> received = {{7, 7, 7, 7, 7}};
+    PlayerCounters counters;
+    readShutdownAck(ringmaster, received, counters);
+    expect(sameCounters(counters, sampleCounters()), "an acknowledgement carries the counters");
+    expect(received.size() == 1 + traceLog.size(), "an acknowledgement appends its trace log");
+    for (std::size_t i = 0; i < traceLog.size(); ++i) {
+        const TraceLogEntry & a = traceLog[i];
+        const TraceLogEntry & b = received[1 + i];
+        expect(a.potatoId == b.potatoId && a.seq == b.seq && a.playerId == b.playerId && a.latency == b.latency && a.generation == b.generation,
+               "an acknowledgement carries the trace log entries");
+    }
+    readShutdownAck(ringmaster, received, counters);
+    expect(sameCounters(counters, PlayerCounters()) && received.size() == 1 + traceLog.size(), "an empty acknowledgement follows another");
+}
+
+// Helper function
+void checkOldShutdownAck() {
+    Socket player, ringmaster;
+    connectedPair(player, ringmaster);
+    std::vector<char> ack(64, 0);
+    ack[1] = 1; // The acknowledgement of a player from before the counters were added
+    player.sendAll(ack.data(), ack.size());
+
+    std::vector<TraceLogEntry> received;
+    PlayerCounters counters;
+    bool rejected = false;
+    try {
+        readShutdownAck(ringmaster, received, counters);
+    } catch (const std::runtime_error &) {
+        rejected = true;
+    }
+    expect(rejected, "an acknowledgement of the old format is rejected");
+}
+
+int main() {
+    try {
+        checkReport();
+        checkMalformedReport();
+        checkShutdownAck();
+        checkOldShutdownAck();
+    } catch (const std::exception & e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Protocol round trips passed" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <cstdint>
+#include <time.h>
+
+/**
+ * Read CLOCK_MONOTONIC. Stamps taken by different processes on the same host can be compared directly.
+ * @return the current monotonic time in nanoseconds
+ */
+inline std::uint64_t monotonicNanos() {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<std::uint64_t>(ts.tv_nsec);
+}
+#endif
@@ -0,0 +1,235 @@
+#include "game.hpp"
+#include "wire.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    // Size of the chunks the traces are written in, so that a long trace never needs a buffer of its own size
+    constexpr std::size_t TRACE_CHUNK_SIZE = 32 * 1024;
+    constexpr char TRACE_FILE_MAGIC[4] = {'P', 'T', 'R', 'C'};
+    constexpr char TRACE_FILE_VERSION = 1;
+    // Flags of the header of a binary trace file
+    constexpr char TRACE_FILE_WITH_ID = 1; // The text headers carry the potato IDs
+    constexpr char TRACE_FILE_ROUNDS = 2; // The traces are headed by the number of their round
+
+    // Formats text, or encodes varints, into a fixed buffer and writes it to a stream whenever the buffer is full
+    class ChunkWriter {
+    public:
+        explicit ChunkWriter(std::ostream & out) : out(out) {}
+
+        void put(char c) {
+            if (used == sizeof(buf)) {
+                flush();
+            }
+            buf[used++] = c;
+        }
+
+        void put(const char * text) {
+            while (*text) {
+                put(*text++);
+            }
+        }
+
+        void putNumber(long long value) {
+            if (sizeof(buf) - used < 20) {
+                flush(); // Room for any 64-bit number and its sign
+            }
+            used = static_cast<std::size_t>(std::to_chars(buf + used, buf + sizeof(buf), value).ptr - buf);
+        }
+
+        void putVarint(std::uint32_t value) {
+            if (sizeof(buf) - used < MAX_VARINT_SIZE) {
+                flush();
+            }
+            used = static_cast<std::size_t>(::putVarint(buf + used, value) - buf);
+        }
+
+        void flush() {
+            out.write(buf, static_cast<std::streamsize>(used));
+            used = 0;
+        }
+    private:
+        std::ostream & out;
+        char buf[TRACE_CHUNK_SIZE];
+        std::size_t used = 0;
+    };
+
+    // Reads a stream through a fixed buffer, so that a long file is never held in memory
+    class ChunkReader {
+    public:
+        explicit ChunkReader(std::istream & in) : in(in) {}
+
+        bool atEnd() {
+            fill(1);
+            return pos == end;
+        }
+
+        std::size_t read(char * out, std::size_t len) {
+            fill(len);
+            len = std::min(len, static_cast<std::size_t>(end - pos));
+            std::memcpy(out, pos, len);
+            pos += len;
+            return len;
+        }
+
+        std::uint32_t getVarint() {
+            fill(MAX_VARINT_SIZE);
+            return ::getVarint(pos, end);
+        }
+    private:
+        std::istream & in;
+        char buf[TRACE_CHUNK_SIZE];
+        const char * pos = buf;
+        const char * end = buf;
+
+        // Buffer at least the given number of bytes, unless the stream ends first
+        void fill(std::size_t wanted) {
+            std::size_t left = static_cast<std::size_t>(end - pos);
+            if (left >= wanted) {
+                return;
+            }
+            std::memmove(buf, pos, left);
+            in.read(buf + left, static_cast<std::streamsize>(sizeof(buf) - left));
+            pos = buf;
+            end = buf + left + in.gcount();
+        }
+    };
+
+    // Helper function
+    void putTraceHeader(ChunkWriter & writer, std::uint32_t potatoId, bool withId) {
+        writer.put("Trace of potato");
+        if (withId) {
+            writer.put(' ');
+            writer.putNumber(potatoId);
+        }
+        writer.put(":\n");
+    }
+
+    // Helper function: the splitmix64 finalizer, which turns consecutive inputs into independent-looking outputs
+    std::uint64_t mix(std::uint64_t value) {
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+        return value ^ (value >> 31);
+    }
+}
+
+std::uint64_t hopRandom(std::uint64_t seed, std::uint32_t playerId, std::uint32_t potatoId, std::uint32_t seq) {
+    std::uint64_t hop = (static_cast<std::uint64_t>(potatoId) << 32) | seq;
+    return mix(mix(seed + 0x9E3779B97F4A7C15ULL * (static_cast<std::uint64_t>(playerId) + 1)) ^ hop);
+}
+
+void writeTrace(std::ostream & out, const Potato & potato, bool withId) {
+    ChunkWriter writer(out);
+    putTraceHeader(writer, potato.getId(), withId);
+    bool first = true;
+    potato.getTrace().forEachChunk([&writer, &first](const int * entries, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!first) {
+                writer.put(',');
+            }
+            writer.putNumber(entries[i]);
+            first = false;
+        }
+    });
+    writer.put('\n');
+    writer.flush();
+    out.flush();
+}
+
+void writeBinaryTraceHeader(std::ostream & out, bool withId, bool withRounds) {
+    out.write(TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC));
+    char header[] = {TRACE_FILE_VERSION, static_cast<char>((withId ? TRACE_FILE_WITH_ID : 0) | (withRounds ? TRACE_FILE_ROUNDS : 0))};
+    out.write(header, sizeof(header));
+}
+
+void writeBinaryTrace(std::ostream & out, const Potato & potato, int round) {
+    ChunkWriter writer(out);
+    writer.putVarint(static_cast<std::uint32_t>(round));
+    writer.putVarint(potato.getId());
+    writer.putVarint(static_cast<std::uint32_t>(potato.getTraceLength()));
+    potato.getTrace().forEachChunk([&writer](const int * entries, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            writer.putVarint(static_cast<std::uint32_t>(entries[i])); // Player IDs are never negative; a hop of a lost player is 0
+        }
+    });
+    writer.flush();
+}
+
+void decodeBinaryTrace(std::istream & in, std::ostream & out) {
+    ChunkReader reader(in);
+    char header[sizeof(TRACE_FILE_MAGIC) + 2];
+    if (reader.read(header, sizeof(header)) < sizeof(header) || !std::equal(TRACE_FILE_MAGIC, TRACE_FILE_MAGIC + sizeof(TRACE_FILE_MAGIC), header)) {
+        throw std::runtime_error("Not a binary trace file");
+    }
+    if (header[sizeof(TRACE_FILE_MAGIC)] != TRACE_FILE_VERSION) {
+        throw std::runtime_error("Unsupported binary trace file version " + std::to_string(header[sizeof(TRACE_FILE_MAGIC)]));
+    }
+    char flags = header[sizeof(TRACE_FILE_MAGIC) + 1];
+
+    ChunkWriter writer(out);
+    std::uint32_t lastRound = 0;
+    while (!reader.atEnd()) {
+        std::uint32_t round = reader.getVarint();
+        std::uint32_t potatoId = reader.getVarint();
+        std::uint32_t length = reader.getVarint();
+        if ((flags & TRACE_FILE_ROUNDS) && round != lastRound) {
+            writer.put("Round ");
+            writer.putNumber(round);
+            writer.put('\n');
+            lastRound = round;
+        }
+        putTraceHeader(writer, potatoId, flags & TRACE_FILE_WITH_ID);
+        for (std::uint32_t i = 0; i < length; ++i) {
+            if (i > 0) {
+                writer.put(',');
+            }
+            writer.putNumber(reader.getVarint());
+        }
+        writer.put('\n');
+    }
+    writer.flush();
+    out.flush();
+}
+
+void sortTraceLog(std::vector<TraceLogEntry> & traceLog) {
+    std::sort(traceLog.begin(), traceLog.end(), [](const TraceLogEntry & a, const TraceLogEntry & b) {
+        return a.potatoId < b.potatoId || (a.potatoId == b.potatoId && (a.seq < b.seq || (a.seq == b.seq && a.generation < b.generation)));
+    });
+}
+
+Potato mergeTraceLog(const std::vector<TraceLogEntry> & traceLog, const Potato & potato, bool allowGaps) {
+    auto first = std::lower_bound(traceLog.begin(), traceLog.end(), potato.getId(), [](const TraceLogEntry & entry, std::uint32_t potatoId) {
+        return entry.potatoId < potatoId;
+    });
+    auto last = std::find_if(first, traceLog.end(), [&potato](const TraceLogEntry & entry) {
+        return entry.potatoId != potato.getId();
+    });
+
+    Potato traced(potato.getHops());
+    traced.setId(potato.getId());
+    traced.setTimestamps(potato.hasTimestamps());
+    for (auto entry = first; entry != last && entry->seq < potato.getSeq(); ++entry) {
+        if (entry + 1 != last && (entry + 1)->seq == entry->seq) {
+            continue; // The hop was taken again by a later generation of the potato, after it was re-injected
+        }
+        while (traced.getSeq() < entry->seq) {
+            if (!allowGaps) {
+                throw std::runtime_error("Trace logs are missing hop " + std::to_string(traced.getSeq()) + " of potato " + std::to_string(potato.getId()));
+            }
+            traced.addTrace(0);
+        }
+        traced.addTrace(entry->playerId, entry->latency);
+    }
+    if (traced.getSeq() != potato.getSeq() && !allowGaps) {
+        throw std::runtime_error("Trace logs cover " + std::to_string(traced.getSeq()) + " hops of potato " + std::to_string(potato.getId()) + 
+                                 ", expected " + std::to_string(potato.getSeq()));
+    }
+    while (traced.getSeq() < potato.getSeq()) {
+        traced.addTrace(0);
+    }
+    return traced;
+}
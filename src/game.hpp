@@ -0,0 +1,142 @@
+#pragma once
+#ifndef GAME_HPP
+#define GAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "potato.hpp"
+
+// Game logic shared by the networked ringmaster and players and by the in-process simulation
+
+/**
+ * Returned by takeHop() when the potato has no hops left and must go back to the ringmaster.
+ */
+constexpr int PASS_TO_RINGMASTER = -1;
+
+/**
+ * Hops of the potato the ringmaster sends to every player when the game is over and the players should exit.
+ */
+constexpr int SHUTDOWN_HOPS = -2;
+
+/**
+ * Hops of the potato the ringmaster sends to every player when a player was lost: it is followed by a relink message 
+ * telling the players which links to drop and which to form, and carries the generation of the potatoes from then on.
+ */
+constexpr int RELINK_HOPS = -4;
+
+/**
+ * Hops of the potato the ringmaster sends to every player between the rounds of a session: the players send back 
+ * the trace log of the game that ended, clear it, and stay connected to their neighbors for the next game.
+ */
+constexpr int NEW_GAME_HOPS = -3;
+
+/**
+ * Hops of the potato the ringmaster sends to every player when it refreshes its metrics: each player process answers 
+ * with a report of its counters and goes on with the game.
+ */
+constexpr int REPORT_HOPS = -5;
+
+/**
+ * Handle a valid potato on behalf of a player: record the player's hop, either in the potato's trace or, 
+ * if the potato has a distributed trace, in the player's trace log, and decide where the potato goes next.
+ * If the potato records timestamps, the hop is stamped and its latency is recorded next to the trace entry.
+ * If the potato still has hops left, its hops are decremented and a neighbor is chosen at random.
+ * @param potato the potato to handle, a Potato or a PotatoFrame patched in place, which must have a non-negative number of hops
+ * @param playerId the ID of the player handling the potato
+ * @param numNeighbors the number of neighbors of the player
+ * @param random a callable returning a random non-negative integer, only called if there is more than one neighbor to choose from
+ * @param traceLog the player's trace log
+ * @param latency if not null, receives the latency of the hop in nanoseconds, or 0 if the potato does not record timestamps
+ * @return PASS_TO_RINGMASTER if the potato must be sent back to the ringmaster, otherwise the index of the neighbor to pass it to
+ */
+template <typename PotatoType, typename Random>
+int takeHop(PotatoType & potato, int playerId, std::size_t numNeighbors, Random && random, std::vector<TraceLogEntry> & traceLog, 
+            int * hopLatency = nullptr) {
+    int latency = potato.hasTimestamps() ? potato.stampHop() : 0;
+    if (hopLatency) {
+        *hopLatency = latency;
+    }
+    if (potato.hasDistributedTrace()) {
+        traceLog.push_back({potato.getId(), potato.getSeq(), playerId, latency, potato.getGeneration()});
+    }
+
+    if (potato.getHops() == 0) {
+        potato.addTrace(playerId, latency);
+        return PASS_TO_RINGMASTER;
+    }
+    potato.decrementHops();
+    potato.addTrace(playerId, latency);
+    if (numNeighbors == 1) {
+        return 0;
+    }
+    return static_cast<int>(static_cast<std::size_t>(random()) % numNeighbors);
+}
+
+/**
+ * Draw the random number a player uses to choose the neighbor of a hop. The number only depends on its arguments, 
+ * so a game with a given seed takes the same path whatever order the players handle concurrent potatoes in, 
+ * and the simulation and the networked game take the same path for the same seed and topology.
+ * @param seed the seed of the game
+ * @param playerId the ID of the player choosing the neighbor, or 0 for the ringmaster choosing the first player of a potato
+ * @param potatoId the ID of the potato
+ * @param seq the sequence number of the hop, which is the number of hops the potato has taken so far
+ * @return a uniformly distributed 64-bit number
+ */
+std::uint64_t hopRandom(std::uint64_t seed, std::uint32_t playerId, std::uint32_t potatoId, std::uint32_t seq);
+
+/**
+ * Write the trace of the given potato in a comma-separated format, preceded by a header line indicating that it is the trace of the potato.
+ * The text is formatted into a fixed buffer that is written out whenever it is full, so a long trace is never built in memory.
+ * @param out the stream to write the trace to
+ * @param potato the Potato object whose trace is to be written
+ * @param withId true to include the potato ID in the header line, for games with several potatoes
+ */
+void writeTrace(std::ostream & out, const Potato & potato, bool withId);
+
+/**
+ * Write the header of a binary trace file, which holds the traces written by writeBinaryTrace() in a compact form 
+ * that decodeBinaryTrace() turns back into the text of writeTrace().
+ * @param out the stream of the file, opened in binary mode
+ * @param withId true if the text headers carry the potato IDs, for games with several potatoes
+ * @param withRounds true if the traces are headed by the number of their round, for sessions of several rounds
+ */
+void writeBinaryTraceHeader(std::ostream & out, bool withId, bool withRounds);
+
+/**
+ * Append the trace of the given potato to a binary trace file as varints: the round, the potato ID, the length of the trace, 
+ * then the player IDs. The record is written in fixed chunks, so a long trace never needs a buffer of its own size.
+ * @param out the stream of the file, whose header was written with writeBinaryTraceHeader()
+ * @param potato the Potato object whose trace is to be written
+ * @param round the round of the session the potato was played in, counted from 1
+ */
+void writeBinaryTrace(std::ostream & out, const Potato & potato, int round);
+
+/**
+ * Turn a binary trace file back into text, in the format of writeTrace(). 
+ * The file is decoded as it is read, through a fixed buffer, so it is never held in memory whole.
+ * @param in the binary trace file
+ * @param out the stream to write the text to
+ * @throws std::runtime_error if the file is not a binary trace file or is truncated
+ */
+void decodeBinaryTrace(std::istream & in, std::ostream & out);
+
+/**
+ * Sort trace log entries gathered from the players by potato ID, sequence number and generation, as required by mergeTraceLog().
+ * @param traceLog the gathered trace log entries
+ */
+void sortTraceLog(std::vector<TraceLogEntry> & traceLog);
+
+/**
+ * Reconstruct the trace of a potato with a distributed trace by merging the trace log entries gathered from the players by sequence number. 
+ * A hop logged by several generations of the potato is taken from the latest one.
+ * @param traceLog the trace log entries of all players, sorted with sortTraceLog()
+ * @param potato the final potato, whose sequence number is the number of hops that must be present in the logs
+ * @param allowGaps true to record the hops missing from the logs as player 0 rather than failing, for a game that lost players and their logs
+ * @return a copy of the potato carrying the reconstructed trace, and the reconstructed hop latencies if the potato records timestamps
+ * @throws std::runtime_error if gaps are not allowed and the logs do not cover every hop of the potato
+ */
+Potato mergeTraceLog(const std::vector<TraceLogEntry> & traceLog, const Potato & potato, bool allowGaps = false);
+#endif
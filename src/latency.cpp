@@ -0,0 +1,88 @@
+#include "latency.hpp"
+
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <utility>
+
+std::vector<std::uint64_t> collectHopLatencies(const std::vector<Potato> & potatoes) {
+    std::vector<std::uint64_t> latencies;
+    for (const Potato & potato : potatoes) {
+        potato.getHopLatencies().forEachChunk([&latencies](const int * entries, std::size_t count) {
+            latencies.insert(latencies.end(), entries, entries + count);
+        });
+    }
+    return latencies;
+}
+
+std::uint64_t percentile(const std::vector<std::uint64_t> & sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    std::size_t rank = static_cast<std::size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+std::vector<LinkLatency> collectLinkLatencies(const std::vector<Potato> & potatoes) {
+    std::map<std::pair<int, int>, LinkLatency> links;
+    for (const Potato & potato : potatoes) {
+        const Trace & trace = potato.getTrace();
+        const Trace & latencies = potato.getHopLatencies();
+        for (std::size_t i = 0; i < latencies.size() && i < trace.size(); ++i) {
+            int from = i == 0 ? RINGMASTER_ID : trace[i - 1];
+            auto inserted = links.emplace(std::make_pair(from, trace[i]), LinkLatency{from, trace[i]});
+            LinkLatency & link = inserted.first->second;
+            std::uint64_t latency = static_cast<std::uint64_t>(latencies[i]);
+            link.count++;
+            link.total += latency;
+            if (latency > link.max) {
+                link.max = latency;
+            }
+        }
+    }
+
+    std::vector<LinkLatency> result;
+    result.reserve(links.size());
+    for (const auto & link : links) {
+        result.push_back(link.second);
+    }
+    return result;
+}
+
+std::vector<std::uint64_t> histogram(const std::vector<std::uint64_t> & latencies) {
+    std::vector<std::uint64_t> buckets(HISTOGRAM_BUCKETS, 0);
+    for (std::uint64_t latency : latencies) {
+        std::size_t bucket = latency == 0 ? 0 : 63 - static_cast<std::size_t>(__builtin_clzll(latency));
+        buckets[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1]++;
+    }
+    return buckets;
+}
+
+void writeLatencyReport(std::ostream & out, const std::vector<Potato> & potatoes) {
+    out << "Link latency (from -> to: hops, mean us, max us):\n";
+    out << std::fixed << std::setprecision(1);
+    for (const LinkLatency & link : collectLinkLatencies(potatoes)) {
+        std::string from = link.from == RINGMASTER_ID ? "ringmaster" : std::to_string(link.from);
+        out << from << " -> " << link.to << ": " << link.count << ", " 
+            << link.total / 1000.0 / link.count << ", " << link.max / 1000.0 << "\n";
+    }
+
+    std::vector<std::uint64_t> buckets = histogram(collectHopLatencies(potatoes));
+    std::uint64_t largest = 0;
+    for (std::uint64_t count : buckets) {
+        largest = count > largest ? count : largest;
+    }
+    out << "Hop latency histogram (us):\n";
+    for (std::size_t k = 0; k < buckets.size(); ++k) {
+        if (buckets[k] == 0) {
+            continue;
+        }
+        constexpr std::size_t BAR_WIDTH = 50;
+        std::size_t bar = static_cast<std::size_t>((buckets[k] * BAR_WIDTH + largest - 1) / largest);
+        out << std::setw(10) << (k == 0 ? 0.0 : (1ULL << k) / 1000.0) << " - " << std::setw(10) << (1ULL << (k + 1)) / 1000.0 
+            << ": " << std::setw(8) << buckets[k] << " " << std::string(bar, '#') << "\n";
+    }
+    out << std::defaultfloat;
+    out.flush();
+}
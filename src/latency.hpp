@@ -0,0 +1,67 @@
+#pragma once
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "potato.hpp"
+
+/**
+ * Stands for the ringmaster in a LinkLatency, since player IDs start at 1.
+ */
+constexpr int RINGMASTER_ID = 0;
+
+/**
+ * The latencies of all the hops over one directed link.
+ */
+struct LinkLatency {
+    int from; // The player that sent the potato, or RINGMASTER_ID
+    int to; // The player that received the potato
+    std::uint64_t count = 0;
+    std::uint64_t total = 0; // Sum of the latencies in nanoseconds
+    std::uint64_t max = 0;
+};
+
+/**
+ * Number of power-of-two buckets in a latency histogram; the last bucket also holds every larger latency.
+ */
+constexpr std::size_t HISTOGRAM_BUCKETS = 32;
+
+/**
+ * Gather the per-hop latencies recorded by all the given potatoes into one vector.
+ * @param potatoes the potatoes of a game played with timestamps
+ * @return the per-hop latencies in nanoseconds, in no particular order
+ */
+std::vector<std::uint64_t> collectHopLatencies(const std::vector<Potato> & potatoes);
+
+/**
+ * Get a percentile of a set of samples using the nearest-rank method.
+ * @param sorted the samples, sorted in ascending order
+ * @param fraction the percentile as a fraction between 0 and 1, e.g. 0.99 for p99
+ * @return the sample at the requested percentile, or 0 if there are no samples
+ */
+std::uint64_t percentile(const std::vector<std::uint64_t> & sorted, double fraction);
+
+/**
+ * Attribute every recorded hop latency to the link it was measured over: hop i of a trace went from the player of hop i - 1, 
+ * or from the ringmaster for the first hop, to the player of hop i.
+ * @param potatoes the potatoes of a game played with timestamps
+ * @return the latencies of every link that carried a potato, ordered by sender and then receiver
+ */
+std::vector<LinkLatency> collectLinkLatencies(const std::vector<Potato> & potatoes);
+
+/**
+ * Count latencies into power-of-two buckets: bucket k holds the latencies in [2^k, 2^(k+1)) nanoseconds, and bucket 0 also holds 0.
+ * @param latencies the latencies in nanoseconds
+ * @return the count of every bucket
+ */
+std::vector<std::uint64_t> histogram(const std::vector<std::uint64_t> & latencies);
+
+/**
+ * Write the per-link latency matrix, one line per link that carried a potato, followed by a histogram of all the hop latencies.
+ * @param out the stream to write the report to
+ * @param potatoes the potatoes of a game played with timestamps
+ */
+void writeLatencyReport(std::ostream & out, const std::vector<Potato> & potatoes);
+#endif
@@ -0,0 +1,56 @@
+#include "metrics.hpp"
+
+#include <iomanip>
+
+namespace {
+    constexpr std::uint64_t NANOS_PER_SECOND = 1000000000;
+
+    // Helper function
+    void writeFamily(std::ostream & out, const char * name, const char * type, const char * help) {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+    }
+
+    // Helper function
+    void writeSeconds(std::ostream & out, const char * name, std::uint64_t ns) {
+        // Written digit by digit, so that a long game loses no precision to a double
+        out << name << ' ' << ns / NANOS_PER_SECOND << '.' << std::setw(9) << std::setfill('0') << ns % NANOS_PER_SECOND << std::setfill(' ') << '\n';
+    }
+}
+
+PlayerCounters & PlayerCounters::operator+=(const PlayerCounters & other) {
+    hops += other.hops;
+    bytesSent += other.bytesSent;
+    bytesReceived += other.bytesReceived;
+    wakeups += other.wakeups;
+    waitNs += other.waitNs;
+    latencyNs += other.latencyNs;
+    latencySamples += other.latencySamples;
+    return *this;
+}
+
+void writePrometheus(std::ostream & out, const PlayerCounters & counters, const GameGauges & gauges) {
+    writeFamily(out, "potato_hops_total", "counter", "Hops taken by the players.");
+    out << "potato_hops_total " << counters.hops << '\n';
+    writeFamily(out, "potato_sent_bytes_total", "counter", "Bytes of the potato frames the players sent.");
+    out << "potato_sent_bytes_total " << counters.bytesSent << '\n';
+    writeFamily(out, "potato_received_bytes_total", "counter", "Bytes of the potato frames the players received.");
+    out << "potato_received_bytes_total " << counters.bytesReceived << '\n';
+    writeFamily(out, "potato_wakeups_total", "counter", "Waits for the next potato that returned.");
+    out << "potato_wakeups_total " << counters.wakeups << '\n';
+    writeFamily(out, "potato_wait_seconds_total", "counter", "Time the players spent waiting for the next potato.");
+    writeSeconds(out, "potato_wait_seconds_total", counters.waitNs);
+    writeFamily(out, "potato_hop_latency_seconds", "summary", "Latency of the hops of the potatoes that record timestamps.");
+    writeSeconds(out, "potato_hop_latency_seconds_sum", counters.latencyNs);
+    out << "potato_hop_latency_seconds_count " << counters.latencySamples << '\n';
+
+    writeFamily(out, "potato_round", "gauge", "Round of the session being played.");
+    out << "potato_round " << gauges.round << '\n';
+    writeFamily(out, "potato_players", "gauge", "Players still in the game.");
+    out << "potato_players " << gauges.players << '\n';
+    writeFamily(out, "potato_potatoes", "gauge", "Potatoes of the round.");
+    out << "potato_potatoes " << gauges.potatoes << '\n';
+    writeFamily(out, "potato_potatoes_returned", "gauge", "Potatoes of the round received back by the ringmaster.");
+    out << "potato_potatoes_returned " << gauges.potatoesReturned << '\n';
+    writeFamily(out, "potato_generation", "gauge", "Times the game went on without a lost player.");
+    out << "potato_generation " << gauges.generation << '\n';
+}
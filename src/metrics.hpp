@@ -0,0 +1,48 @@
+#pragma once
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * The counters a player process keeps from the moment it starts, which it sends the ringmaster in its reports and acknowledgements.
+ */
+struct PlayerCounters {
+    std::uint64_t hops = 0; // Hops taken by the positions of the process
+    std::uint64_t bytesSent = 0; // Bytes of the potato frames sent to the neighbors and to the ringmaster
+    std::uint64_t bytesReceived = 0; // Bytes of the potato frames received from the neighbors and from the ringmaster
+    std::uint64_t wakeups = 0; // Number of times a wait for the next potato returned
+    std::uint64_t waitNs = 0; // Time spent waiting for the next potato, in nanoseconds
+    std::uint64_t latencyNs = 0; // Sum of the latencies of the hops taken, in nanoseconds, if the potatoes record timestamps
+    std::uint64_t latencySamples = 0; // Number of hops whose latency was recorded
+
+    /**
+     * Add the counters of another process to these ones.
+     * @param other the counters to add
+     * @return these counters
+     */
+    PlayerCounters & operator+=(const PlayerCounters & other);
+};
+
+/**
+ * The state of a game the ringmaster exports next to the counters of its players.
+ */
+struct GameGauges {
+    int round = 1; // The round of the session being played, counted from 1
+    std::uint32_t players = 0; // Number of players still in the game
+    int potatoes = 0; // Number of potatoes of the round
+    std::size_t potatoesReturned = 0; // Number of potatoes of the round received back so far
+    std::uint32_t generation = 0; // Number of times the game went on without a lost player
+};
+
+/**
+ * Write the summed counters of the players and the state of the game in the Prometheus text exposition format, 
+ * one metric family per counter, each with its HELP and TYPE lines. Durations are exported in seconds.
+ * @param out the stream to write the metrics to
+ * @param counters the counters of every player process, summed
+ * @param gauges the state of the game
+ */
+void writePrometheus(std::ostream & out, const PlayerCounters & counters, const GameGauges & gauges);
+#endif
@@ -1,33 +1,108 @@
 #include "player.hpp"
+#include "clock.hpp"
+#include "game.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <stdexcept>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
 #include <poll.h>
-#include <fcntl.h>
+#include <sched.h>
 
-Player::Player(int port) : port_(port) {
+namespace {
+    // Indices of the links of a player
+    constexpr std::size_t RINGMASTER_LINK = 0;
+    constexpr std::size_t FIRST_NEIGHBOR_LINK = 1; // The link to neighbor k is at FIRST_NEIGHBOR_LINK + k
+
+    // Helper function
+    std::uint32_t playerId(const NeighborEntry & neighbor) {
+        return neighbor.index + 1; // Convert from 0-based index to 1-based player ID
+    }
+}
+
+Player::Player(int port, Logger & logger, const PlayerOptions & options) : port_(port), logger(logger), options_(options) {
 }
 
-std::uint16_t Player::get_id() const {
+std::uint32_t Player::get_id() const {
     return my_id;
 }
 
 void Player::start(const std::string & ringmasterAddress, std::uint16_t ringmasterPort) {
+    pinToCpu();
     openListeningSocket();
     getPort();
+    openUnixListeningSocket();
     connectToRingmaster(ringmasterAddress, ringmasterPort);
-    std::cerr << "Connected to ringmaster at " << port_ << "\n";
+    logger.log(LogEvent::ConnectedToRingmaster, port_);
     sendInfoToRingmaster();
     neighborInfos = receiveInfoFromRingmaster();
-    std::cerr << neighborInfos[0].id << " " << neighborInfos[0].address << " " << neighborInfos[0].port << "\n";
-    std::cerr << neighborInfos[1].id << " " << neighborInfos[1].address << " " << neighborInfos[1].port << "\n";
-    connectToNeighbors(neighborInfos);
+    for (std::size_t k = 0; k < neighborInfos.size(); ++k) {
+        if (!isPending(neighborInfos[k])) {
+            logNeighbor(k); // The neighbors that have not registered yet are logged once the ringmaster announces them
+        }
+    }
+    connectToNeighbors();
+    std::vector<int> fds = {ringmaster.get_fd()};
+    for (const Socket & neighbor : neighborSockets) {
+        fds.push_back(neighbor.get_fd());
+    }
+    bool sockets = std::find(fds.begin(), fds.end(), -1) == fds.end();
+    if (options_.ioUring && checkpointInterval > 0) {
+        logger.log(LogEvent::IoUringHealing);
+    }
+    else if (options_.ioUring && !sockets) {
+        logger.log(LogEvent::IoUringSharedMemory);
+    }
+    else if (options_.ioUring && options_.waitMode != WaitMode::Block) {
+        logger.log(LogEvent::IoUringSpin);
+    }
+    else if (options_.ioUring) {
+        io = IoUring::create(fds);
+        if (!io) {
+            logger.log(LogEvent::IoUringUnavailable);
+        }
+    }
+    if (!io) {
+        watchLinks();
+    }
+}
+
+void Player::watchLinks() {
+    std::vector<Link *> waited;
+    waitedLinks.clear();
+    for (std::size_t i = 0; i < links.size(); ++i) {
+        if (links[i]) {
+            waited.push_back(links[i].get());
+            waitedLinks.push_back(i);
+        }
+    }
+    waiter.reset(new LinkWaiter(waited, options_.waitMode, options_.spinBudgetNs));
 }
 
 void Player::openListeningSocket() {
-    mySocket = Socket::createListeningSocket(0); // Use port 0 to let the OS choose an available port
+    mySocket = Socket::createListeningSocket(0, options_.socketProfile); // Use port 0 to let the OS choose an available port
+}
+
+void Player::pinToCpu() const {
+    if (options_.cpu < 0) {
+        return;
+    }
+    if (options_.cpu >= CPU_SETSIZE) {
+        throw std::runtime_error("CPU " + std::to_string(options_.cpu) + " is out of range");
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(options_.cpu, &cpus);
+    if (::sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+        throw std::runtime_error("Could not pin the player to CPU " + std::to_string(options_.cpu) + ": " + std::strerror(errno));
+    }
+}
+
+void Player::openUnixListeningSocket() {
+    unixSocket = Socket::createUnixListeningSocket("@potato-player-" + std::to_string(port_));
 }
 
 void Player::getPort() {
@@ -37,239 +112,489 @@ void Player::getPort() {
         throw std::runtime_error("getsockname failed");
     }
     
-    struct sockaddr_in * addr_in = (struct sockaddr_in *) &addr;
-    port_ = ntohs(addr_in->sin_port);
+    port_ = Socket::addressPort(addr);
 }
 
 void Player::connectToRingmaster(const std::string & ringmasterAddress, std::uint16_t ringmaster_port) {
-    ringmaster = Socket::connectToServer(ringmasterAddress, ringmaster_port, true);
+    ringmaster = Socket::connectToServer(ringmasterAddress, ringmaster_port, true, options_.socketProfile);
 }
 
-Socket Player::connectToNeighbor(const Player::PlayerInfo & info) {
-    return Socket::connectToServer(info.address, info.port, false);
+Socket Player::connectToNeighbor(const NeighborEntry & info) {
+    if (info.transport == TransportKind::Unix) {
+        return Socket::connectToUnix(info.linkName); // The neighbor listens already, so this completes at once
+    }
+    return Socket::connectTo(info.address, false, options_.socketProfile);
+}
+
+void Player::connectToNeighbors() {
+    links.clear();
+    links.emplace_back(new SocketLink(ringmaster.get_fd(), TransportKind::Tcp));
+    links.resize(FIRST_NEIGHBOR_LINK + neighborInfos.size());
+    neighborSockets.clear();
+    neighborSockets.resize(neighborInfos.size());
+
+    // Start the links to the neighbors with a lower ID, which registered first; neither creating a shared memory segment nor connecting waits for the neighbor
+    for (std::size_t k = 0; k < neighborInfos.size(); ++k) {
+        if (!isLocal(k) && playerId(neighborInfos[k]) < ownerId(k)) {
+            startLink(k);
+        }
+    }
+
+    // Complete those connections, which only needs the neighbors' kernels, and introduce this player on each of them
+    for (std::size_t k = 0; k < neighborInfos.size(); ++k) {
+        if (!isLocal(k) && playerId(neighborInfos[k]) < ownerId(k)) {
+            introduce(k);
+        }
+    }
+
+    // Complete the links the neighbors with a higher ID start the same way, once the ringmaster has announced the ones that had not registered yet
+    std::size_t pending = 0;
+    for (std::size_t k = 0; k < neighborInfos.size(); ++k) {
+        if (isLocal(k) || playerId(neighborInfos[k]) < ownerId(k)) {
+            continue;
+        }
+        if (isPending(neighborInfos[k])) {
+            ++pending;
+        }
+        else {
+            completeLink(k);
+        }
+    }
+    for (; pending > 0; --pending) {
+        completeLink(receiveNeighborNotice());
+    }
 }
 
-void setNonBlocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+void Player::startLink(std::size_t k) {
+    const NeighborEntry & neighbor = neighborInfos[k];
+    if (neighbor.transport == TransportKind::SharedMemory) {
+        links[FIRST_NEIGHBOR_LINK + k] = ShmLink::create(neighbor.linkName);
+    }
+    else {
+        neighborSockets[k] = connectToNeighbor(neighbor);
+    }
 }
 
-void Player::connectToNeighbors(const std::vector<Player::PlayerInfo> & neighborInfos) {
-    setNonBlocking(mySocket.get_fd());
-    rightPlayer = std::move(connectToNeighbor(neighborInfos[0]));
+void Player::introduce(std::size_t k) {
+    if (!neighborSockets[k].valid()) {
+        return; // A shared memory link is complete once its segment exists
+    }
+    completeConnection(neighborSockets[k], neighborInfos[k]);
+    // Both ends are named, since either process may play several positions; convert to the 0-based indices the ringmaster uses
+    std::uint32_t hello_net[2] = {htonl(ownerId(k) - 1), htonl(neighborInfos[k].index)};
+    neighborSockets[k].sendAll(reinterpret_cast<const char *>(hello_net), sizeof(hello_net));
+    links[FIRST_NEIGHBOR_LINK + k].reset(new SocketLink(neighborSockets[k].get_fd(), neighborInfos[k].transport));
+}
 
-    bool right_ready = false;
-    bool left_ready = false;
-    while (!right_ready || !left_ready) {
-        struct pollfd fds[2];
-        fds[0] = {mySocket.get_fd(), POLLIN, 0};
-        fds[1] = {rightPlayer.get_fd(), POLLOUT, 0};
+void Player::completeLink(std::size_t k) {
+    const NeighborEntry & info = neighborInfos[k];
+    if (info.transport == TransportKind::SharedMemory) {
+        links[FIRST_NEIGHBOR_LINK + k] = ShmLink::open(info.linkName);
+        return;
+    }
+    while (!neighborSockets[k].valid()) {
+        // Connections arrive in any order, so each one is matched to its neighbor by the IDs it starts with; 
+        // one from a neighbor the ringmaster has not announced yet is kept until it does
+        Socket neighbor = acceptNeighborConnection(info.transport);
+        std::uint32_t hello_net[2];
+        neighbor.recvAll(reinterpret_cast<char *>(hello_net), sizeof(hello_net));
+        std::uint32_t from = ntohl(hello_net[0]) + 1; // Convert from 0-based indices to 1-based player IDs
+        std::uint32_t to = ntohl(hello_net[1]) + 1;
+        std::size_t j = 0;
+        while (j < neighborInfos.size() && (isLocal(j) || playerId(neighborInfos[j]) != from || ownerId(j) != to || from < to || neighborSockets[j].valid() 
+                                            || (!isPending(neighborInfos[j]) && neighborInfos[j].transport != info.transport))) {
+            ++j;
+        }
+        if (j == neighborInfos.size()) {
+            throw std::runtime_error("Unexpected connection from player " + std::to_string(from) + " to player " + std::to_string(to));
+        }
+        links[FIRST_NEIGHBOR_LINK + j].reset(new SocketLink(neighbor.get_fd(), info.transport));
+        neighborSockets[j] = std::move(neighbor);
+    }
+}
 
-        int ret = ::poll(fds, 2, -1);
-        if (ret > 0) {
-            if (!left_ready && (fds[0].revents && POLLIN)) {
-                leftPlayer = std::move(acceptNeighborConnection());
-                left_ready = true;
-            }
-            if (!right_ready && (fds[1].revents && POLLOUT)) {
-                right_ready = true;
+std::size_t Player::receiveNeighborNotice() {
+    std::uint32_t index;
+    NeighborEntry neighbor = readNeighborNotice(ringmaster, index);
+    std::size_t position = index - firstIndex;
+    if (position < options_.positions) {
+        for (std::size_t k = neighborOffsets[position]; k < neighborOffsets[position + 1]; ++k) {
+            if (neighborInfos[k].index == neighbor.index && isPending(neighborInfos[k])) {
+                neighborInfos[k] = neighbor;
+                logNeighbor(k);
+                return k;
             }
         }
     }
+    throw std::runtime_error("The ringmaster announced player " + std::to_string(playerId(neighbor)) + ", who is not a pending neighbor of player " + std::to_string(index + 1));
 }
 
-Socket Player::acceptNeighborConnection() {
-    struct sockaddr_storage neighbor_addr;
-    socklen_t neighbor_addr_len = sizeof(neighbor_addr);
-    int neighbor_fd = ::accept(mySocket.get_fd(), (struct sockaddr *) & neighbor_addr, & neighbor_addr_len);
-    if (neighbor_fd < 0) {
-        throw std::runtime_error("accept failed");
+void Player::logNeighbor(std::size_t k) const {
+    const NeighborEntry & neighbor = neighborInfos[k];
+    logger.log(LogEvent::Neighbor, playerId(neighbor), Socket::addressPort(neighbor.address), Socket::formatAddress(neighbor.address));
+    if (!isLocal(k)) {
+        logger.log(LogEvent::LinkTransport, playerId(neighbor), 0, transportName(neighbor.transport));
     }
-    std::string neighbor_ip_str;
-    struct sockaddr_in * addr_in = (struct sockaddr_in *) & neighbor_addr;
-    char ip_str[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &addr_in->sin_addr, ip_str, sizeof(ip_str));
-    neighbor_ip_str = ip_str;
-
-    return Socket(neighbor_fd);
 }
 
-// Helper function
-void Player::sendInfoToRingmaster() const {
-    std::uint16_t port_net = htons(port_);
-    ringmaster.sendAll(reinterpret_cast<const char *>(&port_net), sizeof(port_net));
+void Player::completeConnection(Socket & neighbor, const NeighborEntry & info) {
+    struct pollfd pfd = {neighbor.get_fd(), POLLOUT, 0};
+    while (::poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR) {
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+        }
+    }
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (::getsockopt(neighbor.get_fd(), SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0) {
+        throw std::runtime_error("Could not connect to player " + std::to_string(playerId(info)) + ": " + std::strerror(error));
+    }
+    neighbor.setNonBlocking(false);
 }
 
-// Helper function
-void Player::receiveMyId() {
-    std::uint16_t id_net;
-    char * buff = reinterpret_cast<char *>(&id_net);
-    ringmaster.recvAll(buff, sizeof(id_net));
-    my_id = ntohs(id_net) + 1; // Convert from 0-based index to 1-based player ID
+Socket Player::acceptNeighborConnection(TransportKind transport) {
+    Socket neighbor = transport == TransportKind::Unix 
+        ? unixSocket.accept(nullptr, false) 
+        : mySocket.accept(nullptr, false, options_.socketProfile);
+    if (!neighbor.valid()) {
+        throw std::runtime_error("accept failed");
+    }
+    return neighbor;
 }
 
 // Helper function
-void Player::receiveTotalNumberOfPlayers() {
-    std::uint16_t numPlayers_net;
-    char * buff = reinterpret_cast<char *>(&numPlayers_net);
-    ringmaster.recvAll(buff, sizeof(numPlayers_net));
-    numPlayers = ntohs(numPlayers_net);
+void Player::sendInfoToRingmaster() const {
+    std::string host = localHostId().substr(0, 255);
+    std::uint16_t port_net = htons(port_);
+    std::uint32_t positions_net = htonl(options_.positions);
+    std::uint8_t host_len = static_cast<std::uint8_t>(host.size());
+    struct iovec iov[4];
+    iov[0] = {&port_net, sizeof(port_net)};
+    iov[1] = {&positions_net, sizeof(positions_net)};
+    iov[2] = {&host_len, sizeof(host_len)};
+    iov[3] = {const_cast<char *>(host.data()), host.size()};
+    ringmaster.sendAllv(iov, 4);
 }
 
 // Helper function
 std::uint16_t Player::receiveInfoLength() {
     std::uint16_t info_len_net;
     char * buff = reinterpret_cast<char *>(&info_len_net);
-    ringmaster.recvAll(buff, sizeof(info_len_net));
+    if (io) {
+        io->recvAll(ringmaster.get_fd(), buff, sizeof(info_len_net));
+    }
+    else {
+        ringmaster.recvAll(buff, sizeof(info_len_net));
+    }
     return ntohs(info_len_net);
 }
 
 // Helper function
 std::string Player::receiveInfoString() {
-    std::uint16_t info_len = receiveInfoLength();
-    std::string info_str(info_len, '\0');
-    ringmaster.recvAll(info_str.data(), info_len);
-    return info_str;
+    return receiveInfoBytes(receiveInfoLength());
 }
 
 // Helper function
-Player::PlayerInfo Player::parseString(const std::string & playerInfo) {
-    PlayerInfo info;
-
-    std::size_t first_colon_pos = playerInfo.find(':');
-    if (first_colon_pos == std::string::npos) {
-        return info;
-    }
-    std::string id_str = playerInfo.substr(0, first_colon_pos);
-    try {
-        info.id = std::stoi(id_str) + 1; // Convert from 0-based index to 1-based player ID
-    } catch (const std::exception &) {
-        throw std::runtime_error("Invalid player ID in neighbor information");
-    }
-
-    std::size_t second_colon_pos = playerInfo.find(':', first_colon_pos + 1);
-    if (second_colon_pos == std::string::npos) {
-        return info;
-    }
-    info.address = playerInfo.substr(first_colon_pos + 1, second_colon_pos - first_colon_pos - 1);
-    std::string port_str = playerInfo.substr(second_colon_pos + 1);
-    try {
-        int port = std::stoi(port_str);
-        if (port < 0 || port > 65535) {
-            throw std::runtime_error("Port number out of range in neighbor information");
-        }
-        info.port = static_cast<std::uint16_t>(port);
-    } catch (const std::exception &) {
-        throw std::runtime_error("Invalid port number in neighbor information");
+std::string Player::receiveInfoBytes(std::uint16_t length) {
+    std::string info_str(length, '\0');
+    if (io) {
+        io->recvAll(ringmaster.get_fd(), info_str.data(), length);
     }
-
-    return info;
+    else {
+        ringmaster.recvAll(info_str.data(), length);
+    }
+    return info_str;
 }
 
-std::vector<Player::PlayerInfo> Player::receiveInfoFromRingmaster() {
-    receiveMyId();
-    receiveTotalNumberOfPlayers();
-
-    std::vector<PlayerInfo> neighborInfos;
-
-    std::string info = receiveInfoString();
-    size_t newline_pos = info.find('\n');
-    if (newline_pos == std::string::npos) {
-        throw std::runtime_error("Invalid neighbor information format");
+std::vector<NeighborEntry> Player::receiveInfoFromRingmaster() {
+    std::vector<NeighborEntry> neighborInfos;
+    neighborOffsets.assign(1, 0);
+    neighborPositions.clear();
+    for (std::uint32_t position = 0; position < options_.positions; ++position) {
+        SetupHeader header = readSetupHeader(ringmaster);
+        if (position == 0) {
+            firstIndex = header.index;
+            my_id = header.index + 1; // Convert from 0-based index to 1-based player ID
+            numPlayers = header.numPlayers;
+            seed = header.seed;
+            checkpointInterval = header.checkpointInterval;
+        }
+        else if (header.index != firstIndex + position) {
+            throw std::runtime_error("The ringmaster sent the setup of player " + std::to_string(header.index + 1) + " out of order");
+        }
+        if (header.numNeighbors == 0) {
+            throw std::runtime_error("The ringmaster sent no neighbors");
+        }
+        std::size_t offset = neighborInfos.size();
+        neighborInfos.resize(offset + header.numNeighbors);
+        neighborPositions.resize(neighborInfos.size(), position);
+        neighborOffsets.push_back(neighborInfos.size());
+        readSetupNeighbors(ringmaster, neighborInfos.data() + offset, header.numNeighbors);
+        // A hop is taken by a single position, so the potato ID and the sequence number identify its decision across all positions
+        for (const HopDecision & decision : readSetupDecisions(ringmaster, header.numDecisions)) {
+            if (decision.neighbor >= header.numNeighbors) {
+                throw std::runtime_error("The ringmaster sent a decision for neighbor " + std::to_string(decision.neighbor) + " of " + std::to_string(header.numNeighbors));
+            }
+            decisions[(static_cast<std::uint64_t>(decision.potatoId) << 32) | decision.seq] = decision.neighbor;
+        }
     }
-    std::string right_info = info.substr(0, newline_pos);
-    neighborInfos.push_back(parseString(right_info));
 
-    if (numPlayers > 2) {
-        std::string left_info = info.substr(newline_pos + 1);
-        neighborInfos.push_back(parseString(left_info));
+    logger.log(LogEvent::ConnectedAsPlayer, my_id, numPlayers);
+    if (options_.positions > 1) {
+        logger.log(LogEvent::PlayingPositions, my_id, my_id + options_.positions - 1);
     }
 
-    std::cout << "Connected as player " << my_id << " out of " << numPlayers << " total players\n";
-
     return neighborInfos;
 }
 
-Potato Player::receivePotato() const {
-    std::vector<struct pollfd> pfds(3);
-    pfds[0].fd = ringmaster.get_fd();
-    pfds[0].events = POLLIN;
-
-    pfds[1].fd = leftPlayer.get_fd();
-    pfds[1].events = POLLIN;
-
-    pfds[2].fd = rightPlayer.get_fd();
-    pfds[2].events = POLLIN;
-
-    int status = ::poll(pfds.data(), pfds.size(), -1);
-    if (status > 0) {
-        for (int i = 0; i < 3; i++) {
-            if (pfds[i].revents & POLLIN) {
-                Potato potato;
-                char * buf = reinterpret_cast<char *>(&potato);
-                if (i == 0) {
-                    ringmaster.recvAll(buf, sizeof(potato));
-                } else if (i == 1) {
-                    leftPlayer.recvAll(buf, sizeof(potato));
-                } else if (i == 2) {
-                    rightPlayer.recvAll(buf, sizeof(potato));
-                }
-                return potato;
+std::size_t Player::receivePotato() {
+    if (io) {
+        std::uint64_t start = monotonicNanos();
+        readFrame(*io, potato);
+        counters.waitNs += monotonicNanos() - start;
+        ++counters.wakeups;
+        counters.bytesReceived += potato.size();
+        return RINGMASTER_LINK; // A process using io_uring plays a single position, so the source does not matter
+    }
+    while (true) {
+        std::uint64_t start = monotonicNanos();
+        std::size_t waited = waiter->wait();
+        counters.waitNs += monotonicNanos() - start;
+        ++counters.wakeups;
+        if (waitedLinks[waited] != RINGMASTER_LINK && links[waitedLinks[waited]]->closed()) {
+            // A neighbor that received its shutdown potato first may close its link before this player's shutdown potato arrives
+            waiter->drop(waited);
+            continue;
+        }
+        std::size_t source = waitedLinks[waited];
+        if (source == RINGMASTER_LINK && options_.positions > 1) {
+            // The ringmaster prefixes the potatoes it sends to a process playing several positions with the position they are meant for
+            std::uint32_t target_net;
+            links[RINGMASTER_LINK]->recvAll(reinterpret_cast<char *>(&target_net), sizeof(target_net));
+            injectedPosition = ntohl(target_net);
+        }
+        try {
+            readFrame(*links[source], potato);
+            counters.bytesReceived += potato.size();
+            return source;
+        } catch (const std::exception &) {
+            if (source == RINGMASTER_LINK || checkpointInterval == 0) {
+                throw;
             }
+            // The neighbor was lost in the middle of a potato; the ringmaster re-injects it once it has spliced the game around the neighbor
+            logger.log(LogEvent::LostNeighbor, playerId(neighborInfos[source - FIRST_NEIGHBOR_LINK]));
+            waiter->drop(waited);
         }
     }
-    return Potato(-1); // Return an invalid potato if poll fails or is interrupted
 }
 
-int Player::passPotato(Potato & potato) const {
-    if (potato.getHops() == -2) {
+int Player::passPotato(std::size_t source) {
+    if (checkpointInterval > 0 && (potato.getHops() == SHUTDOWN_HOPS || potato.getHops() == NEW_GAME_HOPS)) {
+        writeFrame(*links[RINGMASTER_LINK], potato); // Marks the end of the checkpoints, which the ringmaster skips up to here
+    }
+    if (potato.getHops() == SHUTDOWN_HOPS) {
         return -2; // Indicate that the game is over and the player should exit
     }
+    if (potato.getHops() == NEW_GAME_HOPS) {
+        startNewGame();
+        return 2;
+    }
+    if (potato.getHops() == RELINK_HOPS) {
+        relink();
+        return 3;
+    }
+    if (potato.getHops() == REPORT_HOPS) {
+        sendReport();
+        return 3;
+    }
+    if (potato.getGeneration() < generation) {
+        // The ringmaster has re-injected the potato since this copy was sent, so the copy is dropped wherever it is
+        logger.log(LogEvent::StalePotato, static_cast<std::int32_t>(potato.getId()), potato.getGeneration());
+        return 3;
+    }
 
     if (potato.getHops() < 0) {
-        std::cerr << "Attempted to pass an invalid potato with negative hops. Ignoring.\n";
+        logger.log(LogEvent::InvalidPotatoHops);
         return -1; // Do not pass an invalid potato
     }
 
-    if (potato.getHops() == 0) {
-        potato.addTrace(my_id);
-        ringmaster.sendAll(reinterpret_cast<const char *>(&potato), sizeof(potato));
-        std::cout << "I'm it\n";
-        return 0;
-    } else {
-        potato.decrementHops();
-        potato.addTrace(my_id);
-        if (numPlayers == 2) {
-            rightPlayer.sendAll(reinterpret_cast<const char *>(&potato), sizeof(potato));
-            std::cout << "Sending potato to " << neighborInfos[0].id << "\n";
+    std::size_t position = source == RINGMASTER_LINK ? injectedPosition : neighborPositions[source - FIRST_NEIGHBOR_LINK];
+    if (position >= options_.positions) {
+        logger.log(LogEvent::InvalidPotato);
+        return -1; // The ringmaster sent the potato to a position this process does not play
+    }
+    while (true) {
+        logger.log(LogEvent::ReceivedPotato, static_cast<std::int32_t>(potato.getId()), potato.getHops());
+        std::uint32_t id = firstIndex + static_cast<std::uint32_t>(position) + 1;
+        std::size_t first = neighborOffsets[position];
+        std::uint32_t potatoId = potato.getId();
+        std::uint32_t seq = potato.getSeq(); // The hop is numbered before takeHop() records it
+        int latency;
+        int next = takeHop(potato, static_cast<int>(id), neighborOffsets[position + 1] - first, 
+                           [this, id, potatoId, seq] { return chooseNeighbor(id, potatoId, seq); }, traceLog, &latency);
+        ++counters.hops;
+        if (potato.hasTimestamps()) {
+            counters.latencyNs += static_cast<std::uint64_t>(latency);
+            ++counters.latencySamples;
         }
-        else {
-            int randomChoice = rand() % 2;
-            if (randomChoice == 0) {
-                rightPlayer.sendAll(reinterpret_cast<const char *>(&potato), sizeof(potato));
-            } else {
-                leftPlayer.sendAll(reinterpret_cast<const char *>(&potato), sizeof(potato));
+        if (next == PASS_TO_RINGMASTER) {
+            sendPotato(RINGMASTER_LINK);
+            logger.log(LogEvent::ImIt);
+            return 0;
+        }
+        if (checkpointInterval > 0 && potato.getHops() > 0 && potato.getSeq() % checkpointInterval == 0) {
+            sendPotato(RINGMASTER_LINK); // A checkpoint, which the ringmaster tells from a returned potato by its hops
+        }
+
+        std::size_t k = first + static_cast<std::size_t>(next);
+        if (!isLocal(k)) {
+            try {
+                sendPotato(FIRST_NEIGHBOR_LINK + k);
+            } catch (const std::exception &) {
+                if (checkpointInterval == 0) {
+                    throw;
+                }
+                // The ringmaster re-injects the potato from its last checkpoint once it has spliced the game around the neighbor
+                logger.log(LogEvent::LostNeighbor, playerId(neighborInfos[k]));
+                return 3;
+            }
+            logger.log(LogEvent::SendingPotato, playerId(neighborInfos[k]));
+            return 1;
+        }
+        logger.log(LogEvent::SendingPotato, playerId(neighborInfos[k]));
+        position = neighborInfos[k].index - firstIndex; // The neighbor is played by this process, so the potato stays in its buffer
+    }
+}
+
+void Player::relink() {
+    generation = potato.getGeneration();
+    Relink relink = readRelink(ringmaster);
+    waiter.reset(); // Its helper thread must not poll the links that are dropped
+
+    // Drop the entries of the lost players, keeping the order of the others, and append the links each position gains
+    std::vector<NeighborEntry> infos;
+    std::vector<std::size_t> offsets(1, 0);
+    std::vector<std::uint32_t> positions;
+    std::vector<Socket> sockets;
+    std::vector<std::unique_ptr<Link>> kept;
+    std::vector<std::size_t> added;
+    kept.push_back(std::move(links[RINGMASTER_LINK]));
+    for (std::uint32_t position = 0; position < options_.positions; ++position) {
+        for (std::size_t k = neighborOffsets[position]; k < neighborOffsets[position + 1]; ++k) {
+            if (std::find(relink.lost.begin(), relink.lost.end(), neighborInfos[k].index) != relink.lost.end()) {
+                continue; // The link to a lost player is closed as it goes out of scope
             }
-            std::cout << "Sending potato to " << (randomChoice == 0 ? neighborInfos[0].id : neighborInfos[1].id) << "\n";
+            infos.push_back(neighborInfos[k]);
+            positions.push_back(position);
+            sockets.push_back(std::move(neighborSockets[k]));
+            kept.push_back(std::move(links[FIRST_NEIGHBOR_LINK + k]));
+        }
+        for (const AddedLink & link : relink.added) {
+            if (link.index == firstIndex + position) {
+                added.push_back(infos.size());
+                infos.push_back(link.neighbor);
+                positions.push_back(position);
+                sockets.emplace_back();
+                kept.emplace_back();
+            }
+        }
+        if (infos.size() == offsets.back()) {
+            throw std::runtime_error("Player " + std::to_string(firstIndex + position + 1) + " has no neighbors left");
+        }
+        offsets.push_back(infos.size());
+    }
+    if (added.size() != relink.added.size()) {
+        throw std::runtime_error("The ringmaster added links to players this process does not play");
+    }
+    neighborInfos = std::move(infos);
+    neighborOffsets = std::move(offsets);
+    neighborPositions = std::move(positions);
+    neighborSockets = std::move(sockets);
+    links = std::move(kept);
+
+    // The new links form as the first ones did: the player with the higher ID starts them, and nobody waits for a player that is itself waiting
+    for (std::size_t k : added) {
+        if (!isLocal(k) && playerId(neighborInfos[k]) < ownerId(k)) {
+            startLink(k);
+        }
+    }
+    for (std::size_t k : added) {
+        if (!isLocal(k) && playerId(neighborInfos[k]) < ownerId(k)) {
+            introduce(k);
         }
+    }
+    for (std::size_t k : added) {
+        if (!isLocal(k) && playerId(neighborInfos[k]) > ownerId(k)) {
+            completeLink(k);
+        }
+        logNeighbor(k);
+    }
+    watchLinks();
+    logger.log(LogEvent::Relinked, generation, static_cast<std::int32_t>(added.size()));
+    writeFrame(*links[RINGMASTER_LINK], potato); // The relink potato goes back as the acknowledgement
+}
 
-        return 1;
+bool Player::isLocal(std::size_t k) const {
+    return neighborInfos[k].index - firstIndex < options_.positions; // Indices below the first position wrap around to large values
+}
+
+std::uint32_t Player::ownerId(std::size_t k) const {
+    return firstIndex + neighborPositions[k] + 1;
+}
+
+std::uint64_t Player::chooseNeighbor(std::uint32_t playerId, std::uint32_t potatoId, std::uint32_t seq) const {
+    if (decisions.empty()) {
+        return hopRandom(seed, playerId, potatoId, seq);
+    }
+    auto decision = decisions.find((static_cast<std::uint64_t>(potatoId) << 32) | seq);
+    if (decision == decisions.end()) {
+        throw std::runtime_error("No recorded decision for hop " + std::to_string(seq) + " of potato " + std::to_string(potatoId));
+    }
+    return decision->second;
+}
+
+void Player::sendPotato(std::size_t link) {
+    counters.bytesSent += potato.size();
+    if (io) {
+        int fd = link == RINGMASTER_LINK ? ringmaster.get_fd() : neighborSockets[link - FIRST_NEIGHBOR_LINK].get_fd();
+        writeFrame(*io, fd, potato);
+        return;
     }
+    writeFrame(*links[link], potato);
 }
 
-int Player::middleGame() const {
-    Potato potato = receivePotato();
-    return passPotato(potato);
+int Player::middleGame() {
+    std::size_t source = receivePotato();
+    return passPotato(source);
+}
+
+void Player::sendReport() {
+    if (io) {
+        io->drainSends(); // The report is read by the ringmaster between the potatoes, so it must not cut into one still queued
+    }
+    writeReport(ringmaster, counters);
 }
 
 void Player::receiveGameOver(){
     std::string gameOverStr = receiveInfoString();
-    std::cout << gameOverStr << std::endl;
+    logger.log(LogEvent::Message, 0, 0, gameOverStr);
 }
 
-void Player::sendShutdownAcknowledgement() const {
-    std::uint16_t shutdown = 1;
-    ringmaster.sendAll(reinterpret_cast<const char *>(&shutdown), sizeof(shutdown));
+void Player::sendShutdownAcknowledgement() {
+    if (io) {
+        io->drainSends(); // The acknowledgement must not overtake a potato still queued for the ringmaster
+        logger.log(LogEvent::IoUringCalls, static_cast<std::int32_t>(io->enterCalls()));
+    }
+    writeShutdownAck(ringmaster, traceLog, counters);
+}
+
+void Player::startNewGame() {
+    if (io) {
+        io->drainSends();
+    }
+    writeShutdownAck(ringmaster, traceLog, counters);
+    traceLog.clear();
+    logger.log(LogEvent::NewGame);
 }
 
 void Player::end() {
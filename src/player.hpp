@@ -3,14 +3,43 @@
 #define PLAYER_HPP
 
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include "IoUring.hpp"
+#include "Logger.hpp"
 #include "Socket.hpp"
+#include "Transport.hpp"
 #include "potato.hpp"
+#include "protocol.hpp"
+
+/**
+ * Options that change how a player talks to the ringmaster and its neighbors.
+ */
+struct PlayerOptions {
+    // Socket options of the player's connections to the ringmaster and to its neighbors
+    SocketProfile socketProfile = SocketProfile::Default;
+    // Receive and send potatoes through an io_uring engine, falling back to blocking I/O if io_uring is not available
+    bool ioUring = false;
+    // How to wait for the next potato; io_uring always blocks, so the spin and hybrid modes take precedence over it
+    WaitMode waitMode = WaitMode::Block;
+    // How long the hybrid wait mode spins before it blocks, in nanoseconds
+    std::uint64_t spinBudgetNs = 50 * 1000;
+    // CPU to pin the player to, or -1 to leave the placement to the scheduler
+    int cpu = -1;
+    // Number of consecutive positions of the game the process plays; hops between them are handled in memory and never touch a link
+    std::uint32_t positions = 1;
+};
 
 class Player {
 public:
-    Player(int port);
+    /**
+     * @param port the port to listen on for the neighbors, or 0 to let the OS choose
+     * @param logger the logger every message of the player goes through
+     * @param options the options of the player
+     */
+    Player(int port, Logger & logger, const PlayerOptions & options = PlayerOptions());
 
     /**
      * Start the player by connecting to the ringmaster, sending the player's own information to the ringmaster, 
@@ -23,39 +52,66 @@ public:
      * The main game loop for the player, which will wait for potatoes to be received from either the ringmaster or a neighbor player, 
      * and then pass the potatoes to either the ringmaster or a neighbor player depending on the state of the potato. 
      * @return 1 if the potato is successfully passed to the next player, 0 if there are no hops in the potato remaining, 
-     * -1 if an error occurs while waiting for or receiving a potato, -2 if a shutdown signal is received
+     * -1 if an error occurs while waiting for or receiving a potato, -2 if a shutdown signal is received, 
+     * 2 if the ringmaster starts a new game of the session, 3 if the potato was dropped, the player relinked around a lost player, 
+     * or the player reported its counters
      */
-    int middleGame() const;
+    int middleGame();
     /**
      * Send a shutdown acknowledgement to the ringmaster to confirm that the player has received the shutdown signal and is ready to exit.
      */
     void end();
     /**
      * Get the player's own ID, which is assigned by the ringmaster and received from the ringmaster during the start() function.
+     * A process that plays several positions has the ID of the first one, and the others follow it.
      * @return the player's own ID
      */
-    std::uint16_t get_id() const;
+    std::uint32_t get_id() const;
 private:
-    Socket leftPlayer;
-    Socket rightPlayer;
     Socket ringmaster;
     Socket mySocket;
+    Socket unixSocket; // AF_UNIX listening socket for the neighbors on the same host
     std::uint16_t port_;
-    std::uint16_t my_id;
-    std::uint16_t numPlayers;
+    std::uint32_t my_id;
+    std::uint32_t numPlayers;
+    std::uint32_t firstIndex = 0; // 0-based index of the first position the process plays
+    std::uint64_t seed = 0; // Seed of the game, from which the neighbor of every hop is drawn
+    std::uint32_t checkpointInterval = 0; // Number of hops between the checkpoints sent to the ringmaster, or 0 if the game does not survive lost players
+    std::uint16_t generation = 0; // Generation of the potatoes the player passes on; earlier ones were re-injected and are dropped
+    // The recorded neighbor choices of a replayed game, keyed by potato ID in the upper half and sequence number in the lower half
+    std::unordered_map<std::uint64_t, std::uint32_t> decisions;
 
-    struct PlayerInfo {
-        int id = -1;
-        std::string address = "";
-        std::uint16_t port = 0;
-    };
-    std::vector<PlayerInfo> neighborInfos;
+    std::vector<NeighborEntry> neighborInfos; // The neighbor tables of the positions one after the other, each in the order the ringmaster sent it
+    std::vector<std::size_t> neighborOffsets; // The neighbor table of position p runs from neighborOffsets[p] to neighborOffsets[p + 1]
+    std::vector<std::uint32_t> neighborPositions; // The position each entry of neighborInfos belongs to
+    std::vector<Socket> neighborSockets; // The sockets of the links to the neighbors, in the order of neighborInfos; invalid for shared memory links
+    std::vector<std::unique_ptr<Link>> links; // The link to the ringmaster, then the links to the neighbors in the order of neighborInfos
+    std::unique_ptr<LinkWaiter> waiter; // Waits on the links when the player does not use io_uring
+    std::vector<std::size_t> waitedLinks; // The index in links of every link the waiter waits on; the neighbors played by this process have no link
+    std::size_t injectedPosition = 0; // The position the potato last received from the ringmaster is meant for
+    PotatoFrame potato; // The potato being handled, received, patched and sent in place
+    std::vector<TraceLogEntry> traceLog;
+    PlayerCounters counters; // What the process has done since it started, reported to the ringmaster
+    Logger & logger;
+    PlayerOptions options_;
+    std::unique_ptr<IoUring> io; // Set once the game starts if the player uses io_uring; from then on every read goes through it
 
     /**
      * Open a listening socket on an available port and store the port number in the port_ member variable. 
      * This function should be called before sending the player's own port number to the ringmaster.
      */
     void openListeningSocket();
+    /**
+     * Pin the player to the CPU given in the options, if any, so that a spinning player keeps its core and its caches.
+     * Threads started afterwards, such as the link waiter's helper thread, inherit the affinity.
+     * @throws std::runtime_error if the CPU does not exist or is not available to the player
+     */
+    void pinToCpu() const;
+    /**
+     * Open the AF_UNIX listening socket the neighbors on the same host connect to, named after the TCP port of the player. 
+     * This function should be called after getting the port number and before sending it to the ringmaster.
+     */
+    void openUnixListeningSocket();
     /**
      * Connect to the ringmaster using the provided address and port number. 
      * This function will create a new Socket object representing the connection to the ringmaster and store it in the ringmaster member variable.
@@ -64,25 +120,78 @@ private:
      */
     void connectToRingmaster(const std::string & ringmasterAddress, std::uint16_t ringmasterPort);
     /**
-     * Connect to the neighbor players using the provided vector of PlayerInfo structs, which contain the neighbors' IP addresses and port numbers. 
-     * This function will create new Socket objects representing the connections to the neighbor players and store them in the leftPlayer and rightPlayer member variables.
-     * @param neighborInfos a vector of PlayerInfo structs, where the first element is the right neighbor's information and the second element is the left neighbor's information
+     * Connect to the neighbor players using the neighbor entries, which contain the neighbors' addresses and the transports of the links to them. 
+     * The player starts and completes the links to the neighbors with a lower ID first, which registered before it and never wait for it, 
+     * and then completes the links the neighbors with a higher ID start, so that no player waits for a neighbor that is itself waiting. 
+     * The entries of the neighbors that had not registered when the setup message was sent are completed by the neighbor notices 
+     * the ringmaster sends as they register, so the links form while the other players are still registering.
+     * A player that connects sends its 0-based ID first, since the connections of several neighbors reach the same listening socket in any order.
+     * This function will store the links in the links member variable, after the link to the ringmaster.
      */
-    void connectToNeighbors(const std::vector<PlayerInfo> & neighborInfos);
+    void connectToNeighbors();
     /**
-     * Connect to a neighbor player using the provided PlayerInfo, which contains the neighbor's IP address and port number. 
+     * Start the link to a neighbor with a lower ID: create the shared memory segment, or start connecting to the neighbor.
+     * @param k the index of the neighbor in the neighborInfos member variable
+     */
+    void startLink(std::size_t k);
+    /**
+     * Complete the connection started by startLink() and send the neighbor the IDs of both ends of the link. 
+     * A shared memory link needs nothing more.
+     * @param k the index of the neighbor in the neighborInfos member variable
+     * @throws std::runtime_error if the connection fails
+     */
+    void introduce(std::size_t k);
+    /**
+     * Complete the link a neighbor with a higher ID starts: open its shared memory segment, or accept connections on the listening socket 
+     * of its transport until its own has arrived. A connection from another neighbor is kept for that neighbor.
+     * @param k the index of the neighbor in the neighborInfos member variable, whose entry must be complete
+     * @throws std::runtime_error if a connection does not come from a neighbor that has a link to complete
+     */
+    void completeLink(std::size_t k);
+    /**
+     * Receive a neighbor notice from the ringmaster and complete the pending entry it announces.
+     * @return the index of the completed entry in the neighborInfos member variable
+     * @throws std::runtime_error if the notice does not match a pending entry
+     */
+    std::size_t receiveNeighborNotice();
+    /**
+     * Wait on the link to the ringmaster and the links to the neighbors with a new LinkWaiter.
+     */
+    void watchLinks();
+    /**
+     * Answer the relink potato the ringmaster sends when it has lost a player: take the generation of the potato, 
+     * receive the relink message, drop the links to the lost players, form the links the positions gain, 
+     * and send the relink potato back once every link is formed.
+     * @throws std::runtime_error if a position is left without neighbors, or the new links cannot be formed
+     */
+    void relink();
+    /**
+     * Log the address of a neighbor and the transport of the link to it, unless the neighbor is played by this process.
+     * @param k the index of the neighbor in the neighborInfos member variable
+     */
+    void logNeighbor(std::size_t k) const;
+    /**
+     * Wait for a non-blocking connection to a neighbor to complete, and switch it back to blocking mode.
+     * @param neighbor the socket of the connection
+     * @param info the neighbor entry of the neighbor, used in error messages
+     * @throws std::runtime_error if the connection fails
+     */
+    void completeConnection(Socket & neighbor, const NeighborEntry & info);
+    /**
+     * Connect to a neighbor player using the provided neighbor entry, whose numeric socket address is connected to without going through the resolver. 
      * This function will create a new Socket object representing the connection to the neighbor player and return it.
-     * @param info the PlayerInfo struct containing the neighbor's IP address and port number
+     * A TCP connection may still be in progress when this function returns.
+     * @param info the neighbor entry containing the neighbor's socket address and the transport of the link
      * @return a Socket object representing the connection to the neighbor player
      */
-    Socket connectToNeighbor(const PlayerInfo & info);
+    Socket connectToNeighbor(const NeighborEntry & info);
     /**
-     * Accept a connection from a neighbor player using the provided PlayerInfo, which contains the neighbor's IP address and port number. 
-     * This function will block until a connection is accepted, and then create a new Socket object representing the connection to the neighbor player 
-     * and store it in the leftPlayer or rightPlayer member variable depending on whether the neighbor is the left or right neighbor.
-     * @param neighborInfo the PlayerInfo struct containing the neighbor's IP address and port number
+     * Accept a connection from a neighbor player on the listening socket of the given transport. 
+     * This function will block until a connection is accepted, and then return a new Socket object representing the connection to the neighbor player.
+     * @param transport the transport of the link to the neighbor, TCP or AF_UNIX
+     * @return a Socket object representing the connection to the neighbor player
      */
-    Socket acceptNeighborConnection();
+    Socket acceptNeighborConnection(TransportKind transport);
     
     /**
      * Get the port number that the player is listening on. 
@@ -90,65 +199,108 @@ private:
      */
     void getPort();
     /**
-     * Send the player's own port number to the ringmaster. 
+     * Register with the ringmaster by sending the player's own port number and the identifier of its host, 
+     * from which the ringmaster tells which neighbors can share a local transport. 
      * This function should be called after the player has opened a listening socket and obtained its port number.
      */
     void sendInfoToRingmaster() const;
 
     /**
-     * Receive the player's own ID from the ringmaster.
-     */
-    void receiveMyId();
-    /**
-     * Receive the total number of players in the game from the ringmaster.
-     */
-    void receiveTotalNumberOfPlayers();
-    /**
-     * Receive the neighbor information string from the ringmaster.
-     * @return the received neighbor information string
+     * Receive the length of a string sent by the ringmaster.
+     * @return the length of the string
      */
     std::uint16_t receiveInfoLength();
     /**
-     * Receive the neighbor information string from the ringmaster, blocking until the entire string is received. 
+     * Receive a string from the ringmaster, blocking until the entire string is received. 
      * The length of the string is determined by the receiveInfoLength() function.
-     * @return the received neighbor information string
+     * @return the received string
      */
     std::string receiveInfoString();
     /**
-     * Parse a neighbor information string in the format "ID:IP:port" and extract the player's ID, IP address, and port number. 
-     * @param playerInfo the neighbor information string to parse
-     * @return a PlayerInfo struct containing the parsed ID, IP address, and port number
+     * Receive a string of the given length from the ringmaster, blocking until the entire string is received.
+     * @param length the length of the string, which has already been received
+     * @return the received string
      */
-    PlayerInfo parseString(const std::string & playerInfo);
+    std::string receiveInfoBytes(std::uint16_t length);
     /**
-     * Receive the neighbor information from the ringmaster, including the neighbor's IP address and port number.
-     * Pre-condition: The received information is in the format "IP:port\nIP:port", where the first line is the right neighbor's information and the second line is the left neighbor's information.
-     * @return a vector of PlayerInfo structs, where the first element is the right neighbor's information and the second element is the left neighbor's information
+     * Receive the binary setup message of every position the process plays from the ringmaster: the position's ID, the total number of players, 
+     * the seed of the game, and the neighbor table, with one entry per neighbor in the order of the topology of the game; 
+     * in a ring, the right neighbor comes first and the left neighbor second. The entries of neighbors that have not registered yet are pending. 
+     * The tables are stored one after the other, delimited by the neighborOffsets member variable.
+     * The hop decisions of a replayed game, if any, are stored in the decisions member variable.
+     * @return the neighbor tables of the positions
+     * @throws std::runtime_error if the setup message is malformed or has no neighbors
      */
-    std::vector<PlayerInfo> receiveInfoFromRingmaster();
+    std::vector<NeighborEntry> receiveInfoFromRingmaster();
 
     /**
-     * Receive a potato from either the ringmaster or a neighbor player. 
-     * This function will block until a potato is received, and then return the received Potato object.
-     * @return the received Potato object, or a Potato with -1 hops if an error occurs while waiting for or receiving the potato
+     * Receive a potato from either the ringmaster or a neighbor player into the potato member variable, whose buffer is reused from hop to hop. 
+     * This function will block until a potato is received. The potato is not decoded.
+     * With io_uring, the potatoes queued by the previous hop are sent as part of the same wait. The wait and the received bytes are counted.
+     * If the game survives lost players, the link of a neighbor lost in the middle of a potato is dropped and the wait goes on.
+     * @return the index of the link the potato was received from in the links member variable
      */
-    Potato receivePotato() const;
+    std::size_t receivePotato();
     /**
-     * Pass the given potato to either the ringmaster or a neighbor player, depending on the state of the potato. If the potato's hops are 0, it should be sent back to the ringmaster. 
+     * Pass the received potato to either the ringmaster or a neighbor player, depending on the state of the potato. If the potato's hops are 0, it should be sent back to the ringmaster. 
      * If the potato's hops are greater than 0, it should be sent to a randomly chosen neighbor player. 
-     * The player's own ID should be added to the potato's trace before passing it on.
-     * @param potato the Potato object to pass
-     * @return 0 if the potato was sent back to the ringmaster, 1 if the potato was sent to a neighbor player, -1 if an error occurs while passing the potato
+     * The player's own ID should be added to the potato's trace before passing it on, 
+     * or to the player's trace log if the potato has a distributed trace. The potato is patched in place and sent from the buffer it was received into.
+     * Hops to the positions this process plays are taken right away, until the potato leaves the process.
+     * If the game survives lost players, the potato is also sent to the ringmaster as a checkpoint every checkpointInterval hops, 
+     * and a potato that cannot be sent to a lost neighbor, or whose generation is past, is dropped.
+     * @param source the index of the link the potato was received from
+     * @return 0 if the potato was sent back to the ringmaster, 1 if the potato was sent to a neighbor player, -1 if an error occurs while passing the potato, 
+     * -2 if the potato is the shutdown signal, 2 if it starts a new game, 3 if it was dropped, relinked the player around a lost player, 
+     * or asked for a report of the counters
+     */
+    int passPotato(std::size_t source);
+    /**
+     * Choose the neighbor of a hop: the recorded decision if the game is a replay, otherwise a neighbor drawn from the seed of the game, 
+     * the player's ID and the hop, so that the game takes the same path for the same seed.
+     * @param playerId the ID of the position taking the hop
+     * @param potatoId the ID of the potato
+     * @param seq the sequence number of the hop
+     * @return a number whose remainder modulo the number of neighbors is the index of the chosen neighbor
+     * @throws std::runtime_error if the game is a replay and the hop has no recorded decision
      */
-    int passPotato(Potato & potato) const;
+    std::uint64_t chooseNeighbor(std::uint32_t playerId, std::uint32_t potatoId, std::uint32_t seq) const;
+    /**
+     * Check whether a neighbor is one of the positions this process plays, in which case the hop to it is handled in memory.
+     * @param k the index of the neighbor in the neighborInfos member variable
+     * @return true if the neighbor is played by this process
+     */
+    bool isLocal(std::size_t k) const;
+    /**
+     * Get the ID of the position a neighbor entry belongs to.
+     * @param k the index of the neighbor in the neighborInfos member variable
+     * @return the 1-based ID of the position whose neighbor it is
+     */
+    std::uint32_t ownerId(std::size_t k) const;
+    /**
+     * Send the received potato to the ringmaster or a neighbor, through the io_uring engine if the player uses one. 
+     * With io_uring, the potato is only queued and goes out together with the wait for the next potato. The sent bytes are counted.
+     * @param link the index of the link to the ringmaster or the neighbor in the links member variable
+     */
+    void sendPotato(std::size_t link);
+    /**
+     * Answer the report potato the ringmaster sends when it refreshes its metrics with a report of the counters of the process.
+     */
+    void sendReport();
     /**
      * Receive a final message from the ringmaster indicating that the game is over, and print the message to standard output.
      */
     void receiveGameOver();
     /**
      * Send a shutdown acknowledgement to the ringmaster to indicate that the player has received the shutdown signal and is ready to exit. 
+     * The acknowledgement carries the player's trace log so that the ringmaster can reconstruct distributed traces, and the counters of the process.
      * This function should be called after receiving the shutdown signal from the ringmaster and before closing any connections or exiting the program.
      */
-    void sendShutdownAcknowledgement() const;
+    void sendShutdownAcknowledgement();
+    /**
+     * Answer the new game potato the ringmaster sends between the rounds of a session: send the trace log of the game that ended, 
+     * and the counters, in the same format as a shutdown acknowledgement, and clear the trace log. The links to the neighbors stay open for the next game.
+     */
+    void startNewGame();
 };
 #endif
\ No newline at end of file
@@ -1,10 +1,27 @@
 #include <iostream>
 #include <cstdlib>
+#include <fstream>
 #include "player.hpp"
 
 int main (int argc, char * argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: player <ringmaster_address> <ringmaster_port>" << std::endl;
+    if (argc == 3 && std::string(argv[1]) == "--decode-log") {
+        std::ifstream in(argv[2], std::ios::binary);
+        if (!in) {
+            std::cerr << "Could not open log file " << argv[2] << std::endl;
+            return EXIT_FAILURE;
+        }
+        try {
+            decodeBinaryLog(in, std::cout);
+        } catch (const std::exception & e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    if (argc < 3) {
+        std::cerr << "Usage: player <ringmaster_address> <ringmaster_port> [--log-level off|error|info|debug] [--log-format text|binary] [--log-file <file>] [--socket-profile default|latency|throughput] [--io-uring]" 
+                  << " [--wait-mode block|spin|hybrid] [--spin-us <microseconds>] [--cpu <cpu>] [--positions <num_positions>]" << std::endl;
+        std::cerr << "       player --decode-log <file>" << std::endl;
         return EXIT_FAILURE;
     }
     std::string ringmasterAddress = argv[1];
@@ -13,26 +30,126 @@ int main (int argc, char * argv[]) {
         std::cerr << "Invalid ringmaster port number." << std::endl;
         return EXIT_FAILURE;
     }
+    LoggerOptions logOptions;
+    PlayerOptions playerOptions;
+    for (int i = 3; i < argc; ++i) {
+        std::string option = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (option == "--log-level" && i + 1 < argc) {
+            if (value == "off") {
+                logOptions.level = LogLevel::Off;
+            }
+            else if (value == "error") {
+                logOptions.level = LogLevel::Error;
+            }
+            else if (value == "info") {
+                logOptions.level = LogLevel::Info;
+            }
+            else if (value == "debug") {
+                logOptions.level = LogLevel::Debug;
+            }
+            else {
+                std::cerr << "Unknown log level: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            ++i;
+        }
+        else if (option == "--log-format" && i + 1 < argc) {
+            if (value == "text") {
+                logOptions.format = LogFormat::Text;
+            }
+            else if (value == "binary") {
+                logOptions.format = LogFormat::Binary;
+            }
+            else {
+                std::cerr << "Unknown log format: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            ++i;
+        }
+        else if (option == "--socket-profile" && i + 1 < argc) {
+            if (!Socket::parseProfile(value, playerOptions.socketProfile)) {
+                std::cerr << "Unknown socket profile: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            ++i;
+        }
+        else if (option == "--io-uring") {
+            playerOptions.ioUring = true;
+        }
+        else if (option == "--wait-mode" && i + 1 < argc) {
+            if (!parseWaitMode(value, playerOptions.waitMode)) {
+                std::cerr << "Unknown wait mode: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            ++i;
+        }
+        else if (option == "--spin-us" && i + 1 < argc) {
+            int spinUs = std::stoi(value);
+            if (spinUs < 0) {
+                std::cerr << "Invalid spin budget." << std::endl;
+                return EXIT_FAILURE;
+            }
+            playerOptions.spinBudgetNs = static_cast<std::uint64_t>(spinUs) * 1000;
+            ++i;
+        }
+        else if (option == "--cpu" && i + 1 < argc) {
+            playerOptions.cpu = std::stoi(value);
+            if (playerOptions.cpu < 0) {
+                std::cerr << "Invalid CPU number." << std::endl;
+                return EXIT_FAILURE;
+            }
+            ++i;
+        }
+        else if (option == "--positions" && i + 1 < argc) {
+            int positions = std::stoi(value);
+            if (positions <= 0) {
+                std::cerr << "Number of positions must be positive." << std::endl;
+                return EXIT_FAILURE;
+            }
+            playerOptions.positions = static_cast<std::uint32_t>(positions);
+            ++i;
+        }
+        else if (option == "--log-file" && i + 1 < argc) {
+            logOptions.file = value;
+            ++i;
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (playerOptions.ioUring && playerOptions.positions > 1) {
+        // The engine reads whole potato frames, but the ringmaster prefixes the potatoes of a process playing several positions
+        std::cerr << "io_uring cannot be combined with several positions." << std::endl;
+        return EXIT_FAILURE;
+    }
 
     try {
-        Player player(0); // Use port 0 to let the OS choose an available port
-        player.start(ringmasterAddress, static_cast<std::uint16_t>(ringmasterPort));
-        srand((unsigned int) time(NULL) + player.get_id());
-        while (true) {
-            int result = player.middleGame();
-            if (result == -1) {
-                std::cerr << "Error: Failed to receive a valid potato. Continuing to wait for potatoes.\n";
-                continue; // Continue waiting for valid potatoes
-            }
-            else if (result == -2) {
-                break; // Exit the game loop if a shutdown signal is received
+        Logger logger(logOptions);
+        try {
+            Player player(0, logger, playerOptions); // Use port 0 to let the OS choose an available port
+            player.start(ringmasterAddress, static_cast<std::uint16_t>(ringmasterPort));
+            while (true) {
+                int result = player.middleGame();
+                if (result == -1) {
+                    logger.log(LogEvent::InvalidPotato);
+                    continue; // Continue waiting for valid potatoes
+                }
+                else if (result == -2) {
+                    break; // Exit the game loop if a shutdown signal is received
+                }
             }
+            player.end();
+        } catch (const std::exception & e) {
+            std::cerr << "Error: " << e.what() << std::endl; // Fatal, so written whatever the log level
+            return EXIT_FAILURE;
         }
-        player.end();
     } catch (const std::exception & e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -1,9 +1,57 @@
 #include "potato.hpp"
+#include "wire.hpp"
+#include "clock.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
 #include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    // Layout of the fixed header that follows the length prefix
+    constexpr std::size_t OFFSET_VERSION = 0;
+    constexpr std::size_t OFFSET_FLAGS = 1;
+    constexpr std::size_t OFFSET_GENERATION = 2;
+    constexpr std::size_t OFFSET_ID = 4;
+    constexpr std::size_t OFFSET_HOPS = 8;
+    constexpr std::size_t OFFSET_SEQ = 12;
+    constexpr std::size_t OFFSET_TRACE_LENGTH = 16;
+    constexpr std::size_t OFFSET_LAST_STAMP = 20;
+    constexpr std::size_t OFFSET_LAST_ID = 28; // The last trace entry, so that a hop can be appended as a delta without decoding the trace
+    constexpr std::size_t HEADER_SIZE = 32;
+    constexpr unsigned char FLAG_DISTRIBUTED_TRACE = 0x01;
+    constexpr unsigned char FLAG_TIMESTAMPS = 0x02;
+    // Longest encoding of a trace entry: a delta and a latency, both as varints of at most 5 bytes
+    constexpr std::size_t MAX_ENTRY_SIZE = 10;
+
+    // Helper function
+    int elapsedSince(std::uint64_t & lastStamp) {
+        std::uint64_t now = monotonicNanos();
+        std::uint64_t latency = lastStamp != 0 && now > lastStamp ? now - lastStamp : 0;
+        lastStamp = now;
+        return latency > INT_MAX ? INT_MAX : static_cast<int>(latency);
+    }
+
+    // Helper function
+    std::size_t putVarintAt(char * out, std::uint32_t value) {
+        std::size_t n = 0;
+        while (value >= 0x80) {
+            out[n++] = static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out[n++] = static_cast<char>(value);
+        return n;
+    }
+
+    // Helper function
+    void putU32At(char * out, std::uint32_t value) {
+        std::uint32_t value_net = htonl(value);
+        std::memcpy(out, &value_net, sizeof(value_net));
+    }
+}
 
 Potato::Potato(int hops) : hops(hops) {
-    std::memset(trace, 0, sizeof(trace)); // Initialize trace array to 0
-    traceLength = 0;
 }
 
 int Potato::getHops() const {
@@ -16,16 +64,235 @@ void Potato::decrementHops() {
     }
 }
 
-void Potato::addTrace(int playerId) {
-    if (traceLength < 512) {
-        trace[traceLength++] = playerId;
+void Potato::addTrace(int playerId, int latency) {
+    seq++;
+    if (!distributedTrace) {
+        trace.push_back(playerId);
+        if (timestamps) {
+            hopLatencies.push_back(latency);
+        }
     }
 }
 
-const int * Potato::getTrace() const {
+const Trace & Potato::getTrace() const {
     return trace;
 }
 
-int Potato::getTraceLength() const {
-    return traceLength;
-}
\ No newline at end of file
+std::size_t Potato::getTraceLength() const {
+    return trace.size();
+}
+
+void Potato::setTimestamps(bool enabled) {
+    timestamps = enabled;
+}
+
+bool Potato::hasTimestamps() const {
+    return timestamps;
+}
+
+void Potato::startClock() {
+    lastStamp = monotonicNanos();
+}
+
+int Potato::stampHop() {
+    return elapsedSince(lastStamp);
+}
+
+const Trace & Potato::getHopLatencies() const {
+    return hopLatencies;
+}
+
+std::uint32_t Potato::getId() const {
+    return id;
+}
+
+void Potato::setId(std::uint32_t potatoId) {
+    id = potatoId;
+}
+
+std::uint32_t Potato::getSeq() const {
+    return seq;
+}
+
+std::uint16_t Potato::getGeneration() const {
+    return generation;
+}
+
+void Potato::setGeneration(std::uint16_t value) {
+    generation = value;
+}
+
+void Potato::setDistributedTrace(bool enabled) {
+    distributedTrace = enabled;
+}
+
+bool Potato::hasDistributedTrace() const {
+    return distributedTrace;
+}
+
+void Potato::encode(std::vector<char> & out) const {
+    std::size_t start = out.size();
+    out.resize(start + FRAME_PREFIX_SIZE + HEADER_SIZE);
+    std::size_t header = start + FRAME_PREFIX_SIZE;
+    std::memset(out.data() + header, 0, HEADER_SIZE);
+    out[header + OFFSET_VERSION] = static_cast<char>(WIRE_VERSION);
+    out[header + OFFSET_FLAGS] = static_cast<char>((distributedTrace ? FLAG_DISTRIBUTED_TRACE : 0) | (timestamps ? FLAG_TIMESTAMPS : 0));
+    putU16(out, header + OFFSET_GENERATION, generation);
+    putU32(out, header + OFFSET_ID, id);
+    putU32(out, header + OFFSET_HOPS, static_cast<std::uint32_t>(hops));
+    putU32(out, header + OFFSET_SEQ, seq);
+    putU32(out, header + OFFSET_TRACE_LENGTH, static_cast<std::uint32_t>(trace.size()));
+    putU64(out, header + OFFSET_LAST_STAMP, lastStamp);
+    putU32(out, header + OFFSET_LAST_ID, static_cast<std::uint32_t>(trace.empty() ? 0 : trace[trace.size() - 1]));
+
+    std::int32_t previous = 0;
+    std::size_t index = 0;
+    bool withLatencies = timestamps && hopLatencies.size() == trace.size();
+    trace.forEachChunk([this, &out, &previous, &index, withLatencies](const int * entries, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i, ++index) {
+            putVarint(out, zigzag(entries[i] - previous));
+            previous = entries[i];
+            if (timestamps) {
+                putVarint(out, static_cast<std::uint32_t>(withLatencies ? hopLatencies[index] : 0));
+            }
+        }
+    });
+
+    putU32(out, start, static_cast<std::uint32_t>(out.size() - start - FRAME_PREFIX_SIZE));
+}
+
+Potato Potato::decode(const char * data, std::size_t len) {
+    if (len < HEADER_SIZE) {
+        throw std::runtime_error("Truncated potato header");
+    }
+    unsigned char version = static_cast<unsigned char>(data[OFFSET_VERSION]);
+    if (version != WIRE_VERSION) {
+        throw std::runtime_error("Unsupported potato wire version " + std::to_string(version));
+    }
+
+    Potato potato(static_cast<std::int32_t>(getU32(data + OFFSET_HOPS)));
+    potato.id = getU32(data + OFFSET_ID);
+    potato.seq = getU32(data + OFFSET_SEQ);
+    potato.generation = getU16(data + OFFSET_GENERATION);
+    potato.distributedTrace = (data[OFFSET_FLAGS] & FLAG_DISTRIBUTED_TRACE) != 0;
+    potato.timestamps = (data[OFFSET_FLAGS] & FLAG_TIMESTAMPS) != 0;
+    potato.lastStamp = getU64(data + OFFSET_LAST_STAMP);
+    std::uint32_t length = getU32(data + OFFSET_TRACE_LENGTH);
+    if (length > len - HEADER_SIZE) { // Every trace entry takes at least one byte
+        throw std::runtime_error("Potato trace length out of range");
+    }
+
+    const char * pos = data + HEADER_SIZE;
+    const char * end = data + len;
+    std::int32_t previous = 0;
+    for (std::uint32_t i = 0; i < length; ++i) {
+        previous += unzigzag(getVarint(pos, end));
+        potato.trace.push_back(previous);
+        if (potato.timestamps) {
+            potato.hopLatencies.push_back(static_cast<int>(getVarint(pos, end)));
+        }
+    }
+    if (pos != end) {
+        throw std::runtime_error("Trailing bytes after potato trace");
+    }
+    return potato;
+}
+
+void PotatoFrame::clear() {
+    size_ = 0;
+}
+
+char * PotatoFrame::reserve(std::size_t len) {
+    if (buf_.size() < len) {
+        buf_.resize(std::max(len, 2 * buf_.size())); // Only growth writes to the buffer, so a warm buffer is never zeroed again
+    }
+    size_ = len;
+    return buf_.data();
+}
+
+void PotatoFrame::assign(const char * data, std::size_t len) {
+    std::memcpy(reserve(len), data, len);
+}
+
+void PotatoFrame::adopt(std::vector<char> && buf) {
+    buf_ = std::move(buf);
+    clear();
+}
+
+std::vector<char> PotatoFrame::take() {
+    buf_.resize(size_); // Shrinking never writes to the buffer
+    std::vector<char> out = std::move(buf_);
+    buf_ = std::vector<char>();
+    clear();
+    return out;
+}
+
+void PotatoFrame::validate() const {
+    if (size_ < Potato::FRAME_PREFIX_SIZE + HEADER_SIZE) {
+        throw std::runtime_error("Truncated potato header");
+    }
+    unsigned char version = static_cast<unsigned char>(header()[OFFSET_VERSION]);
+    if (version != Potato::WIRE_VERSION) {
+        throw std::runtime_error("Unsupported potato wire version " + std::to_string(version));
+    }
+    if (getU32(buf_.data()) != size_ - Potato::FRAME_PREFIX_SIZE) {
+        throw std::runtime_error("Potato frame length does not match its contents");
+    }
+}
+
+int PotatoFrame::getHops() const {
+    return static_cast<std::int32_t>(getU32(header() + OFFSET_HOPS));
+}
+
+void PotatoFrame::decrementHops() {
+    int hops = getHops();
+    if (hops > 0) {
+        putU32At(header() + OFFSET_HOPS, static_cast<std::uint32_t>(hops - 1));
+    }
+}
+
+std::uint32_t PotatoFrame::getId() const {
+    return getU32(header() + OFFSET_ID);
+}
+
+std::uint32_t PotatoFrame::getSeq() const {
+    return getU32(header() + OFFSET_SEQ);
+}
+
+std::uint16_t PotatoFrame::getGeneration() const {
+    return getU16(header() + OFFSET_GENERATION);
+}
+
+bool PotatoFrame::hasDistributedTrace() const {
+    return (header()[OFFSET_FLAGS] & FLAG_DISTRIBUTED_TRACE) != 0;
+}
+
+bool PotatoFrame::hasTimestamps() const {
+    return (header()[OFFSET_FLAGS] & FLAG_TIMESTAMPS) != 0;
+}
+
+int PotatoFrame::stampHop() {
+    std::uint64_t lastStamp = getU64(header() + OFFSET_LAST_STAMP);
+    int latency = elapsedSince(lastStamp);
+    putU32At(header() + OFFSET_LAST_STAMP, static_cast<std::uint32_t>(lastStamp >> 32));
+    putU32At(header() + OFFSET_LAST_STAMP + 4, static_cast<std::uint32_t>(lastStamp));
+    return latency;
+}
+
+void PotatoFrame::addTrace(int playerId, int latency) {
+    putU32At(header() + OFFSET_SEQ, getSeq() + 1);
+    if (hasDistributedTrace()) {
+        return;
+    }
+    std::int32_t previous = static_cast<std::int32_t>(getU32(header() + OFFSET_LAST_ID));
+    std::size_t start = size_;
+    char * out = reserve(start + MAX_ENTRY_SIZE) + start;
+    std::size_t n = putVarintAt(out, zigzag(playerId - previous));
+    if (hasTimestamps()) {
+        n += putVarintAt(out + n, static_cast<std::uint32_t>(latency));
+    }
+    size_ = start + n;
+    putU32At(header() + OFFSET_LAST_ID, static_cast<std::uint32_t>(playerId));
+    putU32At(header() + OFFSET_TRACE_LENGTH, getU32(header() + OFFSET_TRACE_LENGTH) + 1);
+    putU32At(buf_.data(), static_cast<std::uint32_t>(size_ - Potato::FRAME_PREFIX_SIZE));
+}
@@ -2,10 +2,19 @@
 #ifndef POTATO_HPP
 #define POTATO_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "trace.hpp"
+
 class Potato {
 public:
     Potato() = default;
     ~Potato() = default;
+    Potato(const Potato &) = default;
+    Potato & operator=(const Potato &) = default;
+    Potato(Potato &&) noexcept = default;
+    Potato & operator=(Potato &&) noexcept = default;
     Potato(int hops);
 
     /**
@@ -23,27 +32,245 @@ public:
     /**
      * Add the given player ID to the trace of the potato, which is a sequence of player IDs representing the path the potato has taken through the players. 
      * The player ID should be added to the end of the trace, and the trace length should be incremented by 1. 
-     * If the trace is already at its maximum length of 512, this function should not add the player ID and should not increment the trace length.
+     * The trace grows as needed, so there is no limit on its length.
+     * The sequence number is always incremented, even when the trace is distributed and the player ID is not stored in the potato.
      * @param playerId the ID of the player to add to the trace of the potato
+     * @param latency the latency of the hop as returned by stampHop(), stored next to the trace entry if the potato records timestamps
      */
-    void addTrace(int playerId);
+    void addTrace(int playerId, int latency = 0);
     /**
-     * Get a pointer to the trace array of the potato, which is an array of player IDs representing the path the potato has taken through the players. 
+     * Get the trace of the potato, which is a sequence of player IDs representing the path the potato has taken through the players. 
      * The trace should be in the order that the player IDs were added to the trace, with the first player ID at index 0 
-     * and the most recently added player ID at index traceLength - 1.
-     * @return a pointer to the trace array of the potato, or nullptr if the potato is invalid
+     * and the most recently added player ID at index getTraceLength() - 1.
+     * @return the trace of the potato
+     */
+    const Trace & getTrace() const;
+
+    /**
+     * Get the length of the trace of the potato, which is the number of player IDs currently stored in the trace. 
+     * The trace length should be equal to the number of times addTrace() has been called on the potato, unless the trace is distributed.
+     * @return the length of the trace of the potato
+     */
+    std::size_t getTraceLength() const;
+
+    /**
+     * Enable or disable timestamps for the potato. 
+     * A potato with timestamps records, next to every trace entry, the time in nanoseconds since the previous hop 
+     * (or since startClock() for the first hop), as measured with CLOCK_MONOTONIC. 
+     * Timestamps are only recorded in potatoes that carry their trace.
+     * @param enabled true to record timestamps, false otherwise
+     */
+    void setTimestamps(bool enabled);
+    /**
+     * Check whether the potato records timestamps.
+     * @return true if the potato records timestamps, false otherwise
+     */
+    bool hasTimestamps() const;
+    /**
+     * Stamp the current time as the time of the previous hop. This should be called when the potato is injected into the game, 
+     * so that the first hop's latency covers the delivery from the ringmaster.
      */
-    const int * getTrace() const;
+    void startClock();
+    /**
+     * Stamp the current time as the time of the hop being taken, and return the time elapsed since the previous hop.
+     * @return the latency of the hop in nanoseconds, saturated at INT_MAX, or 0 if the clock was never started
+     */
+    int stampHop();
+    /**
+     * Get the per-hop latencies recorded next to the trace of a potato with timestamps. Entry i is the time in nanoseconds 
+     * between hop i - 1 and hop i, saturated at INT_MAX.
+     * @return the per-hop latencies, which are empty unless the potato records timestamps
+     */
+    const Trace & getHopLatencies() const;
 
     /**
-     * Get the length of the trace of the potato, which is the number of player IDs currently stored in the trace array. 
-     * The trace length should be equal to the number of times addTrace() has been called on the potato, and should be less than or equal to 512.
-     * @return the length of the trace of the potato, or -1 if the potato
+     * Get the ID of the potato, which distinguishes the potatoes of a game that has several potatoes in flight.
+     * @return the ID of the potato
+     */
+    std::uint32_t getId() const;
+    /**
+     * Set the ID of the potato.
+     * @param potatoId the ID to give to the potato
      */
-    int getTraceLength() const;
+    void setId(std::uint32_t potatoId);
+
+    /**
+     * Get the sequence number of the potato, which is the number of hops recorded so far.
+     * The next player to record a hop does so under this sequence number.
+     * @return the sequence number of the potato
+     */
+    std::uint32_t getSeq() const;
+
+    /**
+     * Get the generation of the potato. A game that lost a player re-injects its potatoes with the next generation, 
+     * and the players drop the potatoes of earlier generations that are still in flight.
+     * @return the generation of the potato, 0 unless the game has lost a player
+     */
+    std::uint16_t getGeneration() const;
+    /**
+     * Set the generation of the potato.
+     * @param value the generation to give to the potato
+     */
+    void setGeneration(std::uint16_t value);
+
+    /**
+     * Enable or disable distributed tracing for the potato. 
+     * A potato with a distributed trace only carries its hops and sequence number; each player keeps its own log of
+     * (sequence number, player ID) pairs and the ringmaster reconstructs the trace from those logs at the end of the game.
+     * @param enabled true to keep the trace in the players' logs, false to carry it in the potato
+     */
+    void setDistributedTrace(bool enabled);
+    /**
+     * Check whether the potato's trace is kept in the players' logs rather than in the potato itself.
+     * @return true if the trace is distributed, false otherwise
+     */
+    bool hasDistributedTrace() const;
+
+    /**
+     * Encode the potato into its wire format and append it to the given buffer.
+     * The frame starts with a 4-byte length prefix in network byte order, followed by a fixed header
+     * (version, flags, generation, ID, hops, sequence number, trace length, last timestamp, last trace entry) and the used trace entries as zigzag varint deltas, 
+     * each followed by its hop latency as a varint if the potato records timestamps,
+     * so the encoded size grows with the trace length rather than with the trace capacity, and a hop only ever appends to the end of the frame.
+     * @param out the buffer to append the encoded frame to
+     */
+    void encode(std::vector<char> & out) const;
+    /**
+     * Decode a potato from the payload of a frame produced by encode(), i.e. the bytes following the length prefix.
+     * @param data the frame payload
+     * @param len the length of the frame payload
+     * @return the decoded Potato object
+     * @throws std::runtime_error if the payload is truncated, malformed, or has an unsupported version
+     */
+    static Potato decode(const char * data, std::size_t len);
+
+    /**
+     * The version of the wire format written by encode() and accepted by decode().
+     */
+    static constexpr unsigned char WIRE_VERSION = 6;
+    /**
+     * The size of the length prefix at the start of every encoded frame.
+     */
+    static constexpr std::size_t FRAME_PREFIX_SIZE = 4;
 private:
     int hops = 0;
-    int trace[512] = {};
-    int traceLength = 0;
+    Trace trace;
+    std::uint32_t id = 0;
+    std::uint32_t seq = 0;
+    std::uint16_t generation = 0;
+    bool distributedTrace = false;
+    bool timestamps = false;
+    std::uint64_t lastStamp = 0;
+    Trace hopLatencies;
+};
+
+/**
+ * An encoded potato frame, as produced by Potato::encode(), handled in place: the hop counter, sequence number and timestamp are patched 
+ * in the header and a hop's trace entry is appended to the end of the frame, so forwarding a potato never decodes or copies its trace. 
+ * The frame owns a buffer that is kept at its largest size across potatoes, so a player that reuses one frame for every hop 
+ * does not allocate or clear memory in the steady state.
+ */
+class PotatoFrame {
+public:
+    /**
+     * Forget the frame, keeping the buffer for the next one.
+     */
+    void clear();
+    /**
+     * Make the frame len bytes long, growing the buffer if needed, and get the buffer to fill. Existing contents up to len are kept.
+     * @param len the size of the frame in the buffer
+     * @return the start of the buffer
+     */
+    char * reserve(std::size_t len);
+    /**
+     * Copy a whole frame, length prefix included, into the buffer.
+     * @param data the frame
+     * @param len the length of the frame
+     */
+    void assign(const char * data, std::size_t len);
+    /**
+     * Use the given buffer for the next frames, e.g. a buffer recycled by an io_uring engine. The frame is cleared.
+     * @param buf the buffer to use
+     */
+    void adopt(std::vector<char> && buf);
+    /**
+     * Give up the buffer, trimmed to the frame, e.g. to hand it to an io_uring engine for sending. The frame is left without a buffer.
+     * @return the buffer holding the whole frame
+     */
+    std::vector<char> take();
+    /**
+     * Check that the buffer holds a complete header of a supported version and that the length prefix matches the frame.
+     * @throws std::runtime_error if the frame is truncated, malformed, or has an unsupported version
+     */
+    void validate() const;
+
+    /**
+     * Check whether the frame has a buffer, i.e. it has not given it up with take().
+     * @return true if the frame has a buffer
+     */
+    bool hasBuffer() const { return !buf_.empty(); }
+    /**
+     * Get the start of the frame, i.e. of its length prefix.
+     * @return the start of the frame
+     */
+    const char * data() const { return buf_.data(); }
+    /**
+     * Get the number of bytes of the frame, length prefix included.
+     * @return the number of bytes of the frame
+     */
+    std::size_t size() const { return size_; }
+
+    /**
+     * Get the number of hops remaining in the potato.
+     * @return the number of hops remaining in the potato
+     */
+    int getHops() const;
+    /**
+     * Decrement the number of hops remaining in the potato by 1, if the number of hops is greater than 0.
+     */
+    void decrementHops();
+    /**
+     * Get the ID of the potato.
+     * @return the ID of the potato
+     */
+    std::uint32_t getId() const;
+    /**
+     * Get the sequence number of the potato, which is the number of hops recorded so far.
+     * @return the sequence number of the potato
+     */
+    std::uint32_t getSeq() const;
+    /**
+     * Get the generation of the potato, as Potato::getGeneration() does.
+     * @return the generation of the potato
+     */
+    std::uint16_t getGeneration() const;
+    /**
+     * Check whether the potato's trace is kept in the players' logs rather than in the potato itself.
+     * @return true if the trace is distributed, false otherwise
+     */
+    bool hasDistributedTrace() const;
+    /**
+     * Check whether the potato records timestamps.
+     * @return true if the potato records timestamps, false otherwise
+     */
+    bool hasTimestamps() const;
+    /**
+     * Stamp the current time as the time of the hop being taken, and return the time elapsed since the previous hop, as Potato::stampHop() does.
+     * @return the latency of the hop in nanoseconds, saturated at INT_MAX, or 0 if the clock was never started
+     */
+    int stampHop();
+    /**
+     * Record a hop as Potato::addTrace() does: increment the sequence number and, unless the trace is distributed, 
+     * append the player ID (and the latency if the potato records timestamps) to the end of the frame.
+     * @param playerId the ID of the player to add to the trace of the potato
+     * @param latency the latency of the hop as returned by stampHop()
+     */
+    void addTrace(int playerId, int latency = 0);
+private:
+    std::vector<char> buf_;
+    std::size_t size_ = 0;
+
+    char * header() { return buf_.data() + Potato::FRAME_PREFIX_SIZE; }
+    const char * header() const { return buf_.data() + Potato::FRAME_PREFIX_SIZE; }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,483 @@
+#include "protocol.hpp"
+#include "wire.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    // Upper bound on a frame payload, to reject garbage length prefixes before allocating
+    constexpr std::uint32_t MAX_FRAME_SIZE = 256 * 1024 * 1024;
+    // Format of the shutdown acknowledgement; the counters came in with 2, so the acknowledgement of an older player is rejected rather than misread
+    constexpr std::uint16_t SHUTDOWN_ACK = 2;
+    // The counters of a player process, as 64-bit integers in the order of PlayerCounters
+    constexpr std::size_t COUNTERS_SIZE = 7 * sizeof(std::uint64_t);
+    // First byte of the body of a report frame, where a potato frame has its wire version
+    constexpr unsigned char REPORT_TAG = 0xff;
+    static_assert(Potato::WIRE_VERSION != REPORT_TAG, "The report tag must never be used as a wire version");
+
+    // Layout of a setup message: index, number of players, number of neighbors, number of hop decisions, seed and checkpoint interval, 
+    // then one entry per neighbor and one per hop decision
+    constexpr std::size_t SETUP_HEADER_SIZE = 5 * sizeof(std::uint32_t) + sizeof(std::uint64_t);
+    constexpr std::size_t ENTRY_INDEX = 0;
+    constexpr std::size_t ENTRY_TRANSPORT = 4;
+    constexpr std::size_t ENTRY_ADDRESS = 5; // The address as encoded by putAddress()
+    constexpr std::size_t ENTRY_NAME = ENTRY_ADDRESS + 19;
+    constexpr std::size_t SETUP_ENTRY_SIZE = ENTRY_NAME + LINK_NAME_SIZE;
+    // Number of neighbor entries received with a single read
+    constexpr std::size_t SETUP_BATCH = 32;
+    // A hop decision is a potato ID, a sequence number and a neighbor index
+    constexpr std::size_t DECISION_SIZE = 3 * sizeof(std::uint32_t);
+
+    // A neighbor notice is the index of the player it completes an entry of, then the entry
+    constexpr std::size_t NOTICE_SIZE = sizeof(std::uint32_t) + SETUP_ENTRY_SIZE;
+    // A relink message is the number of lost players and the number of added links, 
+    // then the index of every lost player and one neighbor notice per added link
+    constexpr std::size_t RELINK_HEADER_SIZE = 2 * sizeof(std::uint32_t);
+
+    // Layout of an encoded address: the family, 4 or 6, or 0 for a neighbor that has not registered yet, 
+    // the port, then an IPv4 address in the first 4 bytes or an IPv6 address
+    constexpr std::size_t ADDRESS_FAMILY = 0;
+    constexpr std::size_t ADDRESS_PORT = 1;
+    constexpr std::size_t ADDRESS_BYTES = 3;
+    constexpr std::size_t ADDRESS_SIZE = ADDRESS_BYTES + 16;
+
+    // Layout of a shard assignment: the shard index, the index of its first player, its number of players and the number of players of the game
+    constexpr std::size_t SHARD_ASSIGNMENT_SIZE = 4 * sizeof(std::uint32_t);
+
+    // Helper function
+    std::uint32_t checkFrameLength(std::uint32_t len) {
+        if (len > MAX_FRAME_SIZE) {
+            throw std::runtime_error("Frame too large");
+        }
+        return len;
+    }
+
+    // Helper function
+    std::uint32_t readFrameLength(const Socket & socket) {
+        std::uint32_t len_net;
+        socket.recvAll(reinterpret_cast<char *>(&len_net), sizeof(len_net));
+        return checkFrameLength(ntohl(len_net));
+    }
+
+    // Helper function
+    void putAddress(char * out, const sockaddr_storage & address) {
+        if (address.ss_family == AF_INET) {
+            const sockaddr_in * addr = reinterpret_cast<const sockaddr_in *>(&address);
+            out[ADDRESS_FAMILY] = 4;
+            std::memcpy(out + ADDRESS_PORT, &addr->sin_port, sizeof(addr->sin_port));
+            std::memcpy(out + ADDRESS_BYTES, &addr->sin_addr, sizeof(addr->sin_addr));
+        }
+        else if (address.ss_family == AF_INET6) {
+            const sockaddr_in6 * addr = reinterpret_cast<const sockaddr_in6 *>(&address);
+            out[ADDRESS_FAMILY] = 6;
+            std::memcpy(out + ADDRESS_PORT, &addr->sin6_port, sizeof(addr->sin6_port));
+            std::memcpy(out + ADDRESS_BYTES, &addr->sin6_addr, sizeof(addr->sin6_addr));
+        }
+        else if (address.ss_family != AF_UNSPEC) {
+            throw std::runtime_error("Address is neither IPv4 nor IPv6");
+        }
+    }
+
+    // Helper function
+    sockaddr_storage getAddress(const char * in) {
+        sockaddr_storage address = {};
+        if (in[ADDRESS_FAMILY] == 4) {
+            sockaddr_in * addr = reinterpret_cast<sockaddr_in *>(&address);
+            addr->sin_family = AF_INET;
+            std::memcpy(&addr->sin_port, in + ADDRESS_PORT, sizeof(addr->sin_port));
+            std::memcpy(&addr->sin_addr, in + ADDRESS_BYTES, sizeof(addr->sin_addr));
+        }
+        else if (in[ADDRESS_FAMILY] == 6) {
+            sockaddr_in6 * addr = reinterpret_cast<sockaddr_in6 *>(&address);
+            addr->sin6_family = AF_INET6;
+            std::memcpy(&addr->sin6_port, in + ADDRESS_PORT, sizeof(addr->sin6_port));
+            std::memcpy(&addr->sin6_addr, in + ADDRESS_BYTES, sizeof(addr->sin6_addr));
+        }
+        else if (in[ADDRESS_FAMILY] != 0) {
+            throw std::runtime_error("Invalid address family");
+        }
+        return address;
+    }
+
+    // Helper function
+    void putCounters(std::vector<char> & out, std::size_t offset, const PlayerCounters & counters) {
+        const std::uint64_t values[] = {counters.hops, counters.bytesSent, counters.bytesReceived, counters.wakeups, 
+                                        counters.waitNs, counters.latencyNs, counters.latencySamples};
+        for (std::uint64_t value : values) {
+            putU64(out, offset, value);
+            offset += sizeof(value);
+        }
+    }
+
+    // Helper function
+    PlayerCounters getCounters(const char * in) {
+        PlayerCounters counters;
+        std::uint64_t * values[] = {&counters.hops, &counters.bytesSent, &counters.bytesReceived, &counters.wakeups, 
+                                    &counters.waitNs, &counters.latencyNs, &counters.latencySamples};
+        for (std::uint64_t * value : values) {
+            *value = getU64(in);
+            in += sizeof(*value);
+        }
+        return counters;
+    }
+
+    // Helper function
+    void putEntry(std::vector<char> & out, std::size_t offset, const NeighborEntry & neighbor) {
+        putU32(out, offset + ENTRY_INDEX, neighbor.index);
+        out[offset + ENTRY_TRANSPORT] = static_cast<char>(neighbor.transport);
+        putAddress(&out[offset + ENTRY_ADDRESS], neighbor.address);
+        std::size_t nameLength = strnlen(neighbor.linkName, LINK_NAME_SIZE);
+        if (nameLength == LINK_NAME_SIZE) {
+            throw std::runtime_error("Link name too long");
+        }
+        std::memcpy(&out[offset + ENTRY_NAME], neighbor.linkName, nameLength);
+    }
+
+    // Helper function
+    void getEntry(const char * in, NeighborEntry & neighbor) {
+        neighbor.index = getU32(in + ENTRY_INDEX);
+        std::uint8_t transport = static_cast<std::uint8_t>(in[ENTRY_TRANSPORT]);
+        if (transport > static_cast<std::uint8_t>(TransportKind::SharedMemory)) {
+            throw std::runtime_error("Invalid transport in neighbor information");
+        }
+        neighbor.transport = static_cast<TransportKind>(transport);
+        neighbor.address = getAddress(in + ENTRY_ADDRESS);
+        std::memcpy(neighbor.linkName, in + ENTRY_NAME, LINK_NAME_SIZE);
+        if (neighbor.linkName[LINK_NAME_SIZE - 1] != '\0') {
+            throw std::runtime_error("Invalid link name in neighbor information");
+        }
+        if (!isPending(neighbor) && neighbor.transport != TransportKind::Tcp && neighbor.linkName[0] == '\0') {
+            throw std::runtime_error("Missing link name in neighbor information");
+        }
+    }
+}
+
+bool isPending(const NeighborEntry & neighbor) {
+    return neighbor.address.ss_family == AF_UNSPEC;
+}
+
+void writeSetup(const Socket & socket, const SetupHeader & header, const std::vector<NeighborEntry> & neighbors, const std::vector<HopDecision> & decisions) {
+    std::vector<char> out(SETUP_HEADER_SIZE + neighbors.size() * SETUP_ENTRY_SIZE + decisions.size() * DECISION_SIZE, '\0');
+    putU32(out, 0, header.index);
+    putU32(out, 4, header.numPlayers);
+    putU32(out, 8, static_cast<std::uint32_t>(neighbors.size()));
+    putU32(out, 12, static_cast<std::uint32_t>(decisions.size()));
+    putU64(out, 16, header.seed);
+    putU32(out, 24, header.checkpointInterval);
+    std::size_t offset = SETUP_HEADER_SIZE;
+    for (const NeighborEntry & neighbor : neighbors) {
+        putEntry(out, offset, neighbor);
+        offset += SETUP_ENTRY_SIZE;
+    }
+    for (const HopDecision & decision : decisions) {
+        putU32(out, offset, decision.potatoId);
+        putU32(out, offset + 4, decision.seq);
+        putU32(out, offset + 8, decision.neighbor);
+        offset += DECISION_SIZE;
+    }
+    socket.sendAll(out.data(), out.size());
+}
+
+SetupHeader readSetupHeader(const Socket & socket) {
+    char in[SETUP_HEADER_SIZE];
+    socket.recvAll(in, sizeof(in));
+    SetupHeader header;
+    header.index = getU32(in);
+    header.numPlayers = getU32(in + 4);
+    header.numNeighbors = getU32(in + 8);
+    header.numDecisions = getU32(in + 12);
+    header.seed = getU64(in + 16);
+    header.checkpointInterval = getU32(in + 24);
+    return header;
+}
+
+void readSetupNeighbors(const Socket & socket, NeighborEntry * neighbors, std::size_t count) {
+    char buf[SETUP_BATCH * SETUP_ENTRY_SIZE];
+    while (count > 0) {
+        std::size_t batch = std::min(count, SETUP_BATCH);
+        socket.recvAll(buf, batch * SETUP_ENTRY_SIZE);
+        for (const char * entry = buf; entry < buf + batch * SETUP_ENTRY_SIZE; entry += SETUP_ENTRY_SIZE, ++neighbors) {
+            getEntry(entry, *neighbors);
+        }
+        count -= batch;
+    }
+}
+
+std::vector<HopDecision> readSetupDecisions(const Socket & socket, std::size_t count) {
+    std::vector<HopDecision> decisions(count);
+    char buf[SETUP_BATCH * DECISION_SIZE];
+    for (std::size_t done = 0; done < count; ) {
+        std::size_t batch = std::min(count - done, SETUP_BATCH);
+        socket.recvAll(buf, batch * DECISION_SIZE);
+        for (std::size_t k = 0; k < batch; ++k, ++done) {
+            decisions[done].potatoId = getU32(buf + k * DECISION_SIZE);
+            decisions[done].seq = getU32(buf + k * DECISION_SIZE + 4);
+            decisions[done].neighbor = getU32(buf + k * DECISION_SIZE + 8);
+        }
+    }
+    return decisions;
+}
+
+void writeNeighborNotice(const Socket & socket, std::uint32_t index, const NeighborEntry & neighbor) {
+    std::vector<char> out(NOTICE_SIZE, '\0');
+    putU32(out, 0, index);
+    putEntry(out, sizeof(std::uint32_t), neighbor);
+    socket.sendAll(out.data(), out.size());
+}
+
+NeighborEntry readNeighborNotice(const Socket & socket, std::uint32_t & index) {
+    char in[NOTICE_SIZE];
+    socket.recvAll(in, sizeof(in));
+    index = getU32(in);
+    NeighborEntry neighbor;
+    getEntry(in + sizeof(std::uint32_t), neighbor);
+    if (isPending(neighbor)) {
+        throw std::runtime_error("The ringmaster sent a notice without the address of player " + std::to_string(neighbor.index + 1));
+    }
+    return neighbor;
+}
+
+void writeRelink(const Socket & socket, const Relink & relink) {
+    std::vector<char> out(RELINK_HEADER_SIZE + relink.lost.size() * sizeof(std::uint32_t) + relink.added.size() * NOTICE_SIZE, '\0');
+    putU32(out, 0, static_cast<std::uint32_t>(relink.lost.size()));
+    putU32(out, 4, static_cast<std::uint32_t>(relink.added.size()));
+    std::size_t offset = RELINK_HEADER_SIZE;
+    for (std::uint32_t index : relink.lost) {
+        putU32(out, offset, index);
+        offset += sizeof(std::uint32_t);
+    }
+    for (const AddedLink & link : relink.added) {
+        putU32(out, offset, link.index);
+        putEntry(out, offset + sizeof(std::uint32_t), link.neighbor);
+        offset += NOTICE_SIZE;
+    }
+    socket.sendAll(out.data(), out.size());
+}
+
+Relink readRelink(const Socket & socket) {
+    char in[RELINK_HEADER_SIZE];
+    socket.recvAll(in, sizeof(in));
+    Relink relink;
+    relink.lost.resize(getU32(in));
+    std::uint32_t numAdded = getU32(in + 4);
+    for (std::uint32_t & index : relink.lost) {
+        char index_net[sizeof(std::uint32_t)];
+        socket.recvAll(index_net, sizeof(index_net));
+        index = getU32(index_net);
+    }
+    for (std::uint32_t k = 0; k < numAdded; ++k) {
+        AddedLink link;
+        link.neighbor = readNeighborNotice(socket, link.index);
+        relink.added.push_back(link);
+    }
+    return relink;
+}
+
+void writeShardAssignment(const Socket & socket, const ShardAssignment & assignment) {
+    std::vector<char> out(SHARD_ASSIGNMENT_SIZE);
+    putU32(out, 0, assignment.shard);
+    putU32(out, 4, assignment.firstPlayer);
+    putU32(out, 8, assignment.numShardPlayers);
+    putU32(out, 12, assignment.numPlayers);
+    socket.sendAll(out.data(), out.size());
+}
+
+ShardAssignment readShardAssignment(const Socket & socket) {
+    char in[SHARD_ASSIGNMENT_SIZE];
+    socket.recvAll(in, sizeof(in));
+    ShardAssignment assignment;
+    assignment.shard = getU32(in);
+    assignment.firstPlayer = getU32(in + 4);
+    assignment.numShardPlayers = getU32(in + 8);
+    assignment.numPlayers = getU32(in + 12);
+    return assignment;
+}
+
+void writeShardRegistration(const Socket & socket, const std::vector<PlayerRegistration> & players) {
+    std::vector<char> out(sizeof(std::uint32_t));
+    putU32(out, 0, static_cast<std::uint32_t>(players.size()));
+    for (const PlayerRegistration & player : players) {
+        if (player.host.size() > 255) {
+            throw std::runtime_error("Host identifier too long");
+        }
+        std::size_t offset = out.size();
+        out.resize(offset + ADDRESS_SIZE + 1 + player.host.size());
+        putAddress(&out[offset], player.address);
+        out[offset + ADDRESS_SIZE] = static_cast<char>(player.host.size());
+        std::memcpy(&out[offset + ADDRESS_SIZE + 1], player.host.data(), player.host.size());
+    }
+    socket.sendAll(out.data(), out.size());
+}
+
+std::vector<PlayerRegistration> readShardRegistration(const Socket & socket) {
+    char count_buf[sizeof(std::uint32_t)];
+    socket.recvAll(count_buf, sizeof(count_buf));
+    std::vector<PlayerRegistration> players(getU32(count_buf));
+    char buf[ADDRESS_SIZE + 1];
+    for (PlayerRegistration & player : players) {
+        socket.recvAll(buf, sizeof(buf));
+        player.address = getAddress(buf);
+        player.host.resize(static_cast<unsigned char>(buf[ADDRESS_SIZE]));
+        socket.recvAll(&player.host[0], player.host.size());
+    }
+    return players;
+}
+
+void writeRoutedPotato(const Socket & socket, std::uint32_t target, const Potato & potato) {
+    thread_local std::vector<char> buf;
+    buf.clear();
+    appendU32(buf, target);
+    potato.encode(buf);
+    socket.sendAll(buf.data(), buf.size());
+}
+
+Potato readRoutedPotato(const Socket & socket, std::uint32_t & target) {
+    char target_buf[sizeof(target)];
+    socket.recvAll(target_buf, sizeof(target_buf));
+    target = getU32(target_buf);
+    return readPotato(socket);
+}
+
+std::string readFinalMessage(const Socket & socket) {
+    char len_buf[sizeof(std::uint16_t)];
+    socket.recvAll(len_buf, sizeof(len_buf));
+    std::string message(getU16(len_buf), '\0');
+    socket.recvAll(&message[0], message.size());
+    return message;
+}
+
+void writePotato(const Socket & socket, const Potato & potato) {
+    thread_local std::vector<char> buf;
+    buf.clear();
+    potato.encode(buf);
+    socket.sendAll(buf.data(), buf.size());
+}
+
+Potato readPotato(const Socket & socket) {
+    std::uint32_t len = readFrameLength(socket);
+    thread_local std::vector<char> buf;
+    buf.resize(len);
+    socket.recvAll(buf.data(), len);
+    return Potato::decode(buf.data(), len);
+}
+
+void writeReport(const Socket & socket, const PlayerCounters & counters) {
+    std::vector<char> buf(Potato::FRAME_PREFIX_SIZE + 1 + COUNTERS_SIZE);
+    putU32(buf, 0, static_cast<std::uint32_t>(buf.size() - Potato::FRAME_PREFIX_SIZE));
+    buf[Potato::FRAME_PREFIX_SIZE] = static_cast<char>(REPORT_TAG);
+    putCounters(buf, Potato::FRAME_PREFIX_SIZE + 1, counters);
+    socket.sendAll(buf.data(), buf.size());
+}
+
+bool readPlayerFrame(const Socket & socket, Potato & potato, PlayerCounters & counters) {
+    std::uint32_t len = readFrameLength(socket);
+    thread_local std::vector<char> buf;
+    buf.resize(len);
+    socket.recvAll(buf.data(), len);
+    if (len > 0 && static_cast<unsigned char>(buf[0]) == REPORT_TAG) {
+        if (len != 1 + COUNTERS_SIZE) {
+            throw std::runtime_error("Invalid report");
+        }
+        counters = getCounters(buf.data() + 1);
+        return false;
+    }
+    potato = Potato::decode(buf.data(), len);
+    return true;
+}
+
+void readFrame(Link & link, PotatoFrame & frame) {
+    frame.clear();
+    link.recvAll(frame.reserve(Potato::FRAME_PREFIX_SIZE), Potato::FRAME_PREFIX_SIZE);
+    std::size_t total = Potato::FRAME_PREFIX_SIZE + checkFrameLength(getU32(frame.data()));
+    char * buf = frame.reserve(total);
+    link.recvAll(buf + Potato::FRAME_PREFIX_SIZE, total - Potato::FRAME_PREFIX_SIZE);
+    frame.validate();
+}
+
+void writeFrame(Link & link, const PotatoFrame & frame) {
+    link.sendAll(frame.data(), frame.size());
+}
+
+void writeFrame(IoUring & io, int fd, PotatoFrame & frame) {
+    io.send(fd, frame.take());
+}
+
+void readFrame(IoUring & io, PotatoFrame & frame) {
+    std::vector<int> fds = io.fds();
+    while (true) {
+        bool open = false;
+        for (int fd : fds) {
+            std::size_t available = io.available(fd);
+            if (available >= Potato::FRAME_PREFIX_SIZE) {
+                std::size_t total = Potato::FRAME_PREFIX_SIZE + checkFrameLength(getU32(io.peek(fd)));
+                if (available >= total) {
+                    if (!frame.hasBuffer()) {
+                        frame.adopt(io.acquireBuffer()); // The previous buffer went out with the last send
+                    }
+                    frame.assign(io.peek(fd), total);
+                    io.consume(fd, total);
+                    frame.validate();
+                    return;
+                }
+            }
+            if (!io.closed(fd)) {
+                open = true;
+            }
+            else if (available > 0) {
+                throw std::runtime_error("Peer closed connection before all data was received");
+            }
+        }
+        if (!open) {
+            throw std::runtime_error("Every peer closed its connection");
+        }
+        io.wait();
+    }
+}
+
+void writeShutdownAck(const Socket & socket, const std::vector<TraceLogEntry> & traceLog, const PlayerCounters & counters) {
+    std::vector<char> buf(sizeof(SHUTDOWN_ACK) + COUNTERS_SIZE + sizeof(std::uint32_t));
+    std::uint16_t ack_net = htons(SHUTDOWN_ACK);
+    std::memcpy(buf.data(), &ack_net, sizeof(ack_net));
+    putCounters(buf, sizeof(ack_net), counters);
+    putVarint(buf, static_cast<std::uint32_t>(traceLog.size()));
+    for (const TraceLogEntry & entry : traceLog) {
+        putVarint(buf, entry.potatoId);
+        putVarint(buf, entry.seq);
+        putVarint(buf, static_cast<std::uint32_t>(entry.playerId));
+        putVarint(buf, static_cast<std::uint32_t>(entry.latency));
+        putVarint(buf, entry.generation);
+    }
+    std::size_t prefix = sizeof(ack_net) + COUNTERS_SIZE;
+    putU32(buf, prefix, static_cast<std::uint32_t>(buf.size() - prefix - sizeof(std::uint32_t)));
+    socket.sendAll(buf.data(), buf.size());
+}
+
+void readShutdownAck(const Socket & socket, std::vector<TraceLogEntry> & traceLog, PlayerCounters & counters) {
+    char head[sizeof(SHUTDOWN_ACK) + COUNTERS_SIZE];
+    socket.recvAll(head, sizeof(head));
+    if (getU16(head) != SHUTDOWN_ACK) {
+        throw std::runtime_error("Invalid or unsupported shutdown acknowledgement");
+    }
+    counters = getCounters(head + sizeof(SHUTDOWN_ACK));
+
+    std::uint32_t len = readFrameLength(socket);
+    std::vector<char> buf(len);
+    socket.recvAll(buf.data(), len);
+
+    const char * pos = buf.data();
+    const char * end = buf.data() + len;
+    std::uint32_t count = getVarint(pos, end);
+    for (std::uint32_t i = 0; i < count; ++i) {
+        std::uint32_t potatoId = getVarint(pos, end);
+        std::uint32_t seq = getVarint(pos, end);
+        int playerId = static_cast<int>(getVarint(pos, end));
+        int latency = static_cast<int>(getVarint(pos, end));
+        std::uint16_t generation = static_cast<std::uint16_t>(getVarint(pos, end));
+        traceLog.push_back({potatoId, seq, playerId, latency, generation});
+    }
+}
@@ -0,0 +1,316 @@
+#pragma once
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "IoUring.hpp"
+#include "Socket.hpp"
+#include "Transport.hpp"
+#include "metrics.hpp"
+#include "potato.hpp"
+
+/**
+ * Size of the link name field of a neighbor entry, including the terminating NUL.
+ */
+constexpr std::size_t LINK_NAME_SIZE = 32;
+
+/**
+ * One entry of the neighbor table of a setup message: who the neighbor is and how to reach it.
+ */
+struct NeighborEntry {
+    std::uint32_t index = 0; // 0-based index of the neighbor, one less than its player ID
+    TransportKind transport = TransportKind::Tcp; // Transport of the link to the neighbor
+    sockaddr_storage address = {}; // The neighbor's TCP listening address, AF_INET or AF_INET6, or AF_UNSPEC if the neighbor has not registered yet
+    char linkName[LINK_NAME_SIZE] = {}; // Shared memory segment or AF_UNIX socket of the link, for the local transports
+};
+
+/**
+ * Check whether a neighbor entry stands for a neighbor that had not registered when the setup message was sent. 
+ * Only the index of such an entry is set; the ringmaster completes it with a neighbor notice once the neighbor registers.
+ * @param neighbor the neighbor entry
+ * @return true if the entry has no address yet
+ */
+bool isPending(const NeighborEntry & neighbor);
+
+/**
+ * A neighbor choice recorded in an earlier game, which a player makes instead of drawing a random neighbor when the game is replayed.
+ */
+struct HopDecision {
+    std::uint32_t potatoId = 0;
+    std::uint32_t seq = 0; // Sequence number of the hop, the number of hops the potato had taken when the player received it
+    std::uint32_t neighbor = 0; // Index of the chosen neighbor in the player's neighbor table
+};
+
+/**
+ * The fixed header of a setup message.
+ */
+struct SetupHeader {
+    std::uint32_t index = 0; // 0-based index of the player
+    std::uint32_t numPlayers = 0; // Number of players of the game
+    std::uint32_t numNeighbors = 0; // Number of neighbor entries that follow the header; ignored by writeSetup()
+    std::uint32_t numDecisions = 0; // Number of hop decisions that follow the neighbor entries; ignored by writeSetup()
+    std::uint64_t seed = 0; // Seed the player draws its neighbor choices from
+    std::uint32_t checkpointInterval = 0; // Number of hops between the checkpoints the players send the ringmaster, or 0 if the game does not survive lost players
+};
+
+/**
+ * Send the setup message of a player with a single write: a fixed header with the player's index, the number of players, 
+ * the number of neighbors, the number of hop decisions, the seed of the game and its checkpoint interval, followed by one fixed-size entry per neighbor 
+ * carrying its index, the transport of the link, its listening address as a family, a port and a 16-byte IPv4 or IPv6 address, 
+ * and the name of the link, and by the hop decisions the player must make, if the game is a replay. 
+ * The entries of neighbors that have not registered yet are sent pending, with family 0.
+ * @param socket the Socket object connected to the player
+ * @param header the index of the player, the number of players, the seed of the game and its checkpoint interval
+ * @param neighbors the neighbor table of the player
+ * @param decisions the recorded hop decisions of the player, empty unless the game is a replay
+ * @throws std::runtime_error if an address is neither IPv4 nor IPv6, or a link name does not fit in its field
+ */
+void writeSetup(const Socket & socket, const SetupHeader & header, const std::vector<NeighborEntry> & neighbors, const std::vector<HopDecision> & decisions);
+
+/**
+ * Receive the header of a setup message sent by writeSetup().
+ * @param socket the Socket object connected to the ringmaster
+ * @return the header, whose counts tell how many neighbor entries and hop decisions to receive with readSetupNeighbors() and readSetupDecisions()
+ */
+SetupHeader readSetupHeader(const Socket & socket);
+
+/**
+ * Receive and decode the neighbor entries of a setup message. The entries are received in batches into a buffer on the stack 
+ * and decoded straight into the given table, so decoding allocates nothing.
+ * @param socket the Socket object connected to the ringmaster
+ * @param neighbors the table to decode the entries into
+ * @param count the number of entries, as returned by readSetupHeader()
+ * @throws std::runtime_error if the peer closes the connection or an entry is malformed
+ */
+void readSetupNeighbors(const Socket & socket, NeighborEntry * neighbors, std::size_t count);
+
+/**
+ * Receive the hop decisions of a setup message, which follow its neighbor entries.
+ * @param socket the Socket object connected to the ringmaster
+ * @param count the number of decisions, as returned by readSetupHeader()
+ * @return the decisions
+ * @throws std::runtime_error if the peer closes the connection
+ */
+std::vector<HopDecision> readSetupDecisions(const Socket & socket, std::size_t count);
+
+/**
+ * Send a neighbor notice, which completes the pending entry of a player's neighbor table once that neighbor has registered, 
+ * as the index of the player followed by the complete entry, encoded as in a setup message.
+ * @param socket the Socket object connected to the player
+ * @param index the 0-based index of the player whose entry is completed, which tells the positions of a process apart
+ * @param neighbor the complete entry of the neighbor
+ */
+void writeNeighborNotice(const Socket & socket, std::uint32_t index, const NeighborEntry & neighbor);
+
+/**
+ * Receive a neighbor notice sent by writeNeighborNotice().
+ * @param socket the Socket object connected to the ringmaster
+ * @param index receives the 0-based index of the player whose entry is completed
+ * @return the complete entry of the neighbor
+ * @throws std::runtime_error if the peer closes the connection or the entry is malformed or still pending
+ */
+NeighborEntry readNeighborNotice(const Socket & socket, std::uint32_t & index);
+
+/**
+ * A link the ringmaster adds when it splices the game around a lost player.
+ */
+struct AddedLink {
+    std::uint32_t index = 0; // 0-based index of the player that gains the neighbor
+    NeighborEntry neighbor; // The complete entry of the new neighbor
+};
+
+/**
+ * The changes to the neighbor tables of a process when the ringmaster splices the game around a lost player.
+ */
+struct Relink {
+    std::vector<std::uint32_t> lost; // 0-based indices of the lost players, whose entries every table drops
+    std::vector<AddedLink> added; // The links the positions of the process gain
+};
+
+/**
+ * Send a relink message, which follows the relink potato, with a single write: the number of lost players and of added links, 
+ * then the indices of the lost players, then the added links as neighbor notices.
+ * @param socket the Socket object connected to the process
+ * @param relink the changes to the neighbor tables of the positions of the process
+ */
+void writeRelink(const Socket & socket, const Relink & relink);
+
+/**
+ * Receive a relink message sent by writeRelink().
+ * @param socket the Socket object connected to the ringmaster
+ * @return the changes to the neighbor tables of the positions of the process
+ * @throws std::runtime_error if the peer closes the connection or an added entry is malformed or pending
+ */
+Relink readRelink(const Socket & socket);
+
+/**
+ * The part of the players of a game that a root ringmaster hands to one of its shard ringmasters.
+ */
+struct ShardAssignment {
+    std::uint32_t shard = 0; // 0-based index of the shard, in the order the shards connected to the root
+    std::uint32_t firstPlayer = 0; // 0-based index of the first player of the shard; its players have consecutive indices
+    std::uint32_t numShardPlayers = 0; // Number of players the shard registers
+    std::uint32_t numPlayers = 0; // Number of players of the game, across all shards
+};
+
+/**
+ * The registration of a player as a shard ringmaster forwards it to the root.
+ */
+struct PlayerRegistration {
+    sockaddr_storage address = {}; // The player's TCP listening address, AF_INET or AF_INET6
+    std::string host; // Identifier of the player's host, at most 255 bytes
+};
+
+/**
+ * Target of a routed potato that is meant for every player of a shard rather than a single one, such as the shutdown potato.
+ */
+constexpr std::uint32_t ROUTE_TO_ALL = 0xffffffff;
+
+/**
+ * Send a shard assignment from the root ringmaster to a shard ringmaster, as four 32-bit integers.
+ * @param socket the Socket object connected to the shard ringmaster
+ * @param assignment the players the shard is responsible for
+ */
+void writeShardAssignment(const Socket & socket, const ShardAssignment & assignment);
+
+/**
+ * Receive a shard assignment sent by writeShardAssignment().
+ * @param socket the Socket object connected to the root ringmaster
+ * @return the players the shard is responsible for
+ * @throws std::runtime_error if the peer closes the connection
+ */
+ShardAssignment readShardAssignment(const Socket & socket);
+
+/**
+ * Send the registrations of every player of a shard to the root ringmaster with a single write, in the order of their indices: 
+ * the number of players, then each player's listening address, encoded as in a setup message, and its length-prefixed host identifier.
+ * @param socket the Socket object connected to the root ringmaster
+ * @param players the registrations of the players of the shard
+ * @throws std::runtime_error if an address is neither IPv4 nor IPv6, or a host identifier is longer than 255 bytes
+ */
+void writeShardRegistration(const Socket & socket, const std::vector<PlayerRegistration> & players);
+
+/**
+ * Receive the registrations of the players of a shard sent by writeShardRegistration().
+ * @param socket the Socket object connected to the shard ringmaster
+ * @return the registrations of the players of the shard, in the order of their indices
+ * @throws std::runtime_error if the peer closes the connection or a registration is malformed
+ */
+std::vector<PlayerRegistration> readShardRegistration(const Socket & socket);
+
+/**
+ * Send a potato from the root ringmaster to a shard ringmaster, prefixed with the player of the shard it is meant for.
+ * @param socket the Socket object connected to the shard ringmaster
+ * @param target the 0-based index of the player within the shard, or ROUTE_TO_ALL
+ * @param potato the Potato object to send
+ */
+void writeRoutedPotato(const Socket & socket, std::uint32_t target, const Potato & potato);
+
+/**
+ * Receive a potato sent by writeRoutedPotato().
+ * @param socket the Socket object connected to the root ringmaster
+ * @param target receives the 0-based index of the player within the shard, or ROUTE_TO_ALL
+ * @return the decoded Potato object
+ * @throws std::runtime_error if the peer closes the connection or the frame is malformed
+ */
+Potato readRoutedPotato(const Socket & socket, std::uint32_t & target);
+
+/**
+ * Receive the length-prefixed final message a ringmaster sends after the shutdown potato.
+ * @param socket the Socket object connected to the ringmaster
+ * @return the final message
+ * @throws std::runtime_error if the peer closes the connection
+ */
+std::string readFinalMessage(const Socket & socket);
+
+/**
+ * Encode the given potato and send it over the given socket as a single length-prefixed frame.
+ * @param socket the Socket object to send the potato over
+ * @param potato the Potato object to send
+ */
+void writePotato(const Socket & socket, const Potato & potato);
+
+/**
+ * Receive a single length-prefixed potato frame from the given socket, blocking until the whole frame is received, and decode it.
+ * @param socket the Socket object to receive the potato from
+ * @return the decoded Potato object
+ * @throws std::runtime_error if the peer closes the connection or the frame is malformed
+ */
+Potato readPotato(const Socket & socket);
+
+/**
+ * Send a report of a player's counters to the ringmaster, as a length-prefixed frame that readPlayerFrame() tells from a potato 
+ * by its first byte, followed by the counters as 64-bit integers. The first byte of a report is 0xff, where a potato has its wire version, 
+ * so 0xff must never be used as a wire version.
+ * @param socket the Socket object connected to the ringmaster
+ * @param counters the counters of the player process
+ */
+void writeReport(const Socket & socket, const PlayerCounters & counters);
+
+/**
+ * Receive a single length-prefixed frame a player sends the ringmaster, which is either a potato or a report sent by writeReport().
+ * @param socket the Socket object connected to the player
+ * @param potato receives the decoded Potato object if the frame is a potato
+ * @param counters receives the counters of the player if the frame is a report
+ * @return true if the frame is a potato, false if it is a report
+ * @throws std::runtime_error if the peer closes the connection or the frame is malformed
+ */
+bool readPlayerFrame(const Socket & socket, Potato & potato, PlayerCounters & counters);
+
+/**
+ * Receive a single length-prefixed potato frame from the given link into a reusable frame buffer, without decoding it.
+ * @param link the link to receive the frame from
+ * @param frame the frame to receive into, whose buffer is reused
+ * @throws std::runtime_error if the peer closes the link or the frame is malformed
+ */
+void readFrame(Link & link, PotatoFrame & frame);
+
+/**
+ * Send a potato frame over the given link.
+ * @param link the link to send the frame over
+ * @param frame the frame to send
+ * @throws std::runtime_error if sending fails
+ */
+void writeFrame(Link & link, const PotatoFrame & frame);
+
+/**
+ * Queue a potato frame to be sent on a socket watched by an io_uring engine. The frame hands its buffer to the engine, 
+ * which recycles it once the send completes. The frame is sent with the engine's next wait.
+ * @param io the engine watching the socket
+ * @param fd the socket to send the frame over
+ * @param frame the frame to send, which is left without a buffer
+ */
+void writeFrame(IoUring & io, int fd, PotatoFrame & frame);
+
+/**
+ * Wait until a whole length-prefixed potato frame has been received on any socket watched by an io_uring engine, 
+ * and copy it into the given frame, taking a recycled buffer from the engine if the frame has none.
+ * The sockets are checked in the order they were given to the engine, so earlier sockets take priority.
+ * @param io the engine watching the sockets
+ * @param frame the frame to receive into
+ * @throws std::runtime_error if a peer closes the connection in the middle of a frame or the frame is malformed
+ */
+void readFrame(IoUring & io, PotatoFrame & frame);
+
+/**
+ * Send a shutdown acknowledgement to the ringmaster, followed by the player's counters as 64-bit integers 
+ * and the player's trace log as a length-prefixed frame of varints. The acknowledgement starts with the version of its format, 
+ * which readShutdownAck() checks.
+ * A player answers the new game potato between the rounds of a session the same way.
+ * @param socket the Socket object connected to the ringmaster
+ * @param traceLog the player's trace log, which is empty unless the player handled potatoes with a distributed trace
+ * @param counters the counters of the player process, or the summed counters of its players for a shard ringmaster
+ */
+void writeShutdownAck(const Socket & socket, const std::vector<TraceLogEntry> & traceLog, const PlayerCounters & counters);
+
+/**
+ * Receive a shutdown acknowledgement sent by writeShutdownAck() and append the player's trace log to the given vector.
+ * @param socket the Socket object connected to the player
+ * @param traceLog the vector to append the received trace log entries to
+ * @param counters receives the counters of the player
+ * @throws std::runtime_error if the peer closes the connection, or the acknowledgement is malformed or of an unsupported format
+ */
+void readShutdownAck(const Socket & socket, std::vector<TraceLogEntry> & traceLog, PlayerCounters & counters);
+#endif
@@ -0,0 +1,65 @@
+#include "replay.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+void writeRecording(const std::string & file, std::uint64_t seed, std::uint64_t topologySeed, int numPlayers, const std::vector<Potato> & potatoes) {
+    std::ofstream out(file);
+    if (!out) {
+        throw std::runtime_error("Could not open recording file " + file);
+    }
+    out << "seed " << seed << "\n";
+    out << "topology-seed " << topologySeed << "\n";
+    out << "players " << numPlayers << "\n";
+    for (const Potato & potato : potatoes) {
+        out << "potato " << potato.getId() << " ";
+        bool first = true;
+        potato.getTrace().forEachChunk([&out, &first](const int * entries, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                out << (first ? "" : ",") << entries[i];
+                first = false;
+            }
+        });
+        out << "\n";
+    }
+    if (!out) {
+        throw std::runtime_error("Could not write recording file " + file);
+    }
+}
+
+Recording readRecording(const std::string & file) {
+    std::ifstream in(file);
+    if (!in) {
+        throw std::runtime_error("Could not open recording file " + file);
+    }
+    Recording recording;
+    std::string seedKey, topologySeedKey, playersKey;
+    if (!(in >> seedKey >> recording.seed >> topologySeedKey >> recording.topologySeed >> playersKey >> recording.numPlayers) 
+        || seedKey != "seed" || topologySeedKey != "topology-seed" || playersKey != "players") {
+        throw std::runtime_error("Malformed header in recording file " + file);
+    }
+    std::string key;
+    std::uint32_t potatoId;
+    std::string trace;
+    while (in >> key >> potatoId >> trace) {
+        if (key != "potato" || potatoId != recording.paths.size() + 1) {
+            throw std::runtime_error("Malformed potato " + std::to_string(recording.paths.size() + 1) + " in recording file " + file);
+        }
+        std::vector<int> path;
+        std::istringstream entries(trace);
+        std::string entry;
+        while (std::getline(entries, entry, ',')) {
+            int playerId = std::stoi(entry);
+            if (playerId < 1 || playerId > recording.numPlayers) {
+                throw std::runtime_error("Invalid player " + entry + " in recording file " + file);
+            }
+            path.push_back(playerId);
+        }
+        recording.paths.push_back(std::move(path));
+    }
+    if (!in.eof()) {
+        throw std::runtime_error("Malformed potato " + std::to_string(recording.paths.size() + 1) + " in recording file " + file);
+    }
+    return recording;
+}
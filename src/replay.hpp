@@ -0,0 +1,40 @@
+#pragma once
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "potato.hpp"
+
+/**
+ * The hop paths of a finished game, as recorded by the ringmaster, together with the seeds needed to set the same game up again.
+ */
+struct Recording {
+    std::uint64_t seed = 0; // Seed of the neighbor choices
+    std::uint64_t topologySeed = 0; // Seed of the random regular topology
+    int numPlayers = 0;
+    // The player IDs each potato visited, in the order of the potato IDs; the first is the player the ringmaster sent the potato to
+    std::vector<std::vector<int>> paths;
+};
+
+/**
+ * Write the hop paths of the given potatoes to a text file: a line with the seed, a line with the topology seed, 
+ * a line with the number of players, then one line per potato with its ID and its comma-separated trace.
+ * @param file the path of the file to write
+ * @param seed the seed of the neighbor choices of the game
+ * @param topologySeed the seed of the topology of the game
+ * @param numPlayers the number of players of the game
+ * @param potatoes the potatoes of the game, carrying their traces, ordered by potato ID
+ * @throws std::runtime_error if the file cannot be written
+ */
+void writeRecording(const std::string & file, std::uint64_t seed, std::uint64_t topologySeed, int numPlayers, const std::vector<Potato> & potatoes);
+
+/**
+ * Read a recording written by writeRecording().
+ * @param file the path of the file to read
+ * @return the seeds, the number of players and the hop paths of the recorded game
+ * @throws std::runtime_error if the file cannot be read or is malformed
+ */
+Recording readRecording(const std::string & file);
+#endif
@@ -1,100 +1,322 @@
 #include "ringmaster.hpp"
+#include "game.hpp"
+#include "clock.hpp"
+#include "latency.hpp"
 
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unistd.h>
+
+namespace {
+    // Size of the fixed part of a registration: the listening port, the number of positions and the length of the host identifier
+    constexpr std::size_t REGISTRATION_HEADER_SIZE = 7;
+
+    // Helper function
+    PlayerCounters sumCounters(const std::vector<PlayerCounters> & reports) {
+        PlayerCounters total;
+        for (const PlayerCounters & counters : reports) {
+            total += counters;
+        }
+        return total;
+    }
+}
 
-Ringmaster::Ringmaster(int port, int numPlayers) : port_(port), numPlayers(numPlayers) {}
+Ringmaster::Ringmaster(int port, int numPlayers, const RingmasterOptions & options) 
+    : port_(port), numPlayers(numPlayers), options_(options) {
+    if (!options_.replayFile.empty()) {
+        replay = readRecording(options_.replayFile);
+        options_.seed = replay.seed;
+        options_.topology.seed = replay.topologySeed;
+    }
+}
 
-Potato Ringmaster::createPotato(int numHops) const {
-    return Potato(numHops);
+Potato Ringmaster::createPotato(int numHops, std::uint32_t potatoId) const {
+    Potato potato(numHops);
+    potato.setId(potatoId);
+    potato.setDistributedTrace(options_.distributedTrace);
+    potato.setTimestamps(options_.timestamps);
+    potato.setGeneration(generation);
+    return potato;
 }
 
 void Ringmaster::openListeningSocket() {
-    mySocket = Socket::createListeningSocket(port_);
+    mySocket = Socket::createListeningSocket(port_, options_.socketProfile);
 }
 
 // Helper function
 Ringmaster::PlayerConnection Ringmaster::acceptPlayer() {
     PlayerConnection pc;
+    pc.playerSocket = mySocket.accept(&pc.address, true, options_.socketProfile);
+    return pc;
+}
+
+void Ringmaster::initializePlayers() {
+    std::unordered_map<int, PlayerConnection> pending;
+    mySocket.setNonBlocking(true);
+    reactor.add(mySocket.get_fd(), EPOLLIN, [this, &pending](std::uint32_t) {
+        for (;;) {
+            PlayerConnection pc = acceptPlayer();
+            if (!pc.playerSocket.valid()) {
+                break; // No more pending connections
+            }
+            int fd = pc.playerSocket.get_fd();
+            pending.emplace(fd, std::move(pc));
+            reactor.add(fd, EPOLLIN, [this, &pending, fd](std::uint32_t) {
+                receiveRegistration(pending, fd);
+            });
+        }
+    });
+    while (playerInfos.size() < numPlayers) {
+        reactor.runOnce();
+    }
+    reactor.remove(mySocket.get_fd());
+
+    // Connections beyond the expected number of players are dropped
+    for (auto & entry : pending) {
+        reactor.remove(entry.first);
+    }
+}
 
-    struct sockaddr_storage player_addr;
-    socklen_t player_addr_len = sizeof(player_addr);
-    int player_fd = ::accept(mySocket.get_fd(), (struct sockaddr *) &player_addr, &player_addr_len);
-    if (player_fd < 0) {
-        throw std::runtime_error("accept failed");
+void Ringmaster::receiveRegistration(std::unordered_map<int, PlayerConnection> & pending, int fd) {
+    PlayerConnection & pc = pending.at(fd);
+    // The port, the number of positions and the length of the host identifier come first, and tell how much of the identifier to expect
+    std::size_t hostLength = static_cast<unsigned char>(pc.registration[REGISTRATION_HEADER_SIZE - 1]);
+    std::size_t expected = pc.received < REGISTRATION_HEADER_SIZE ? REGISTRATION_HEADER_SIZE : REGISTRATION_HEADER_SIZE + hostLength;
+    ssize_t bytes;
+    try {
+        bytes = pc.playerSocket.tryRecv(pc.registration + pc.received, expected - pc.received);
+    } catch (const std::exception &) {
+        bytes = 0; // Treat a failed connection like a closed one
+    }
+    if (bytes < 0) {
+        return; // Wait for the rest of the registration
+    }
+    if (bytes == 0) {
+        std::cerr << "A player disconnected from " << Socket::formatAddress(pc.address) << " before registering\n";
+        reactor.remove(fd);
+        pending.erase(fd);
+        return;
+    }
+    pc.received += static_cast<std::size_t>(bytes);
+    hostLength = static_cast<unsigned char>(pc.registration[REGISTRATION_HEADER_SIZE - 1]);
+    if (pc.received == REGISTRATION_HEADER_SIZE && hostLength != 0) {
+        receiveRegistration(pending, fd); // The host identifier may have arrived together with the port
+        return;
+    }
+    if (pc.received < REGISTRATION_HEADER_SIZE + hostLength || playerInfos.size() >= numPlayers) {
+        return;
     }
-    pc.playerSocket = Socket(player_fd);
 
-    char ip_str[INET6_ADDRSTRLEN];
-    struct sockaddr_in * addr_in = (struct sockaddr_in *) &player_addr;
-    inet_ntop(AF_INET, &addr_in->sin_addr, ip_str, sizeof(ip_str));
+    std::uint16_t player_port_net;
+    std::memcpy(&player_port_net, pc.registration, sizeof(player_port_net));
+    std::uint16_t player_port = ntohs(player_port_net);
+    std::uint32_t positions_net;
+    std::memcpy(&positions_net, pc.registration + sizeof(player_port_net), sizeof(positions_net));
+    std::uint32_t positions = ntohl(positions_net);
+    if (positions == 0 || positions > numPlayers - playerInfos.size()) {
+        std::cerr << "A player at " << Socket::formatAddress(pc.address) << " offered " << positions << " positions, but " 
+                  << numPlayers - playerInfos.size() << " are left\n";
+        reactor.remove(fd);
+        pending.erase(fd);
+        return;
+    }
+    std::string host(pc.registration + REGISTRATION_HEADER_SIZE, hostLength);
+    sockaddr_storage address = pc.address;
+    Socket::setAddressPort(address, player_port);
+    int i = static_cast<int>(playerInfos.size());
+    for (std::uint32_t position = 0; position < positions; ++position) {
+        playerInfos.push_back({i + static_cast<int>(position), address, player_port, host}); // The positions of a process share its address
+    }
 
-    pc.address = ip_str;
+    pc.playerSocket.setNonBlocking(false);
+    reactor.setHandler(fd, setupHandler(playerSockets.size()));
+    firstPlayers.push_back(static_cast<std::uint32_t>(i));
+    playerSockets.push_back(std::move(pc.playerSocket));
+    pending.erase(fd);
+    if (announceOnRegistration) {
+        announcePlayers(static_cast<std::size_t>(i), positions);
+    }
 
-    return pc;
+    // Convert to 1-based player IDs for printing
+    if (positions == 1) {
+        std::cout << "Player " << firstPlayer + i + 1 << " is ready to play\n";
+    }
+    else {
+        std::cout << "Players " << firstPlayer + i + 1 << " to " << firstPlayer + i + positions << " are ready to play\n";
+    }
 }
 
-void Ringmaster::initializePlayers() {
-    for (int i = 0; i < numPlayers; ++i) {
-        PlayerConnection pc = acceptPlayer();
+Reactor::Handler Ringmaster::setupHandler(std::size_t socket) {
+    return [this, socket](std::uint32_t) {
+        std::string player = options_.numShards > 0 ? "Shard " + std::to_string(socket + 1) : "Player " + std::to_string(firstPlayer + firstPlayers[socket] + 1);
+        char byte;
+        if (playerSockets[socket].recvSome(&byte, 1) == 0) {
+            throw std::runtime_error(player + " disconnected before the game started");
+        }
+        throw std::runtime_error(player + " sent data before the game started");
+    };
+}
 
-        uint16_t player_port_net;
-        char * buf = reinterpret_cast<char *>(&player_port_net);
-        pc.playerSocket.recvAll(buf, sizeof(player_port_net));
+void Ringmaster::initializeShards() {
+    std::uint32_t numShards = static_cast<std::uint32_t>(options_.numShards);
+    std::uint32_t next = 0;
+    for (std::uint32_t shard = 0; shard < numShards; ++shard) {
+        Socket socket = mySocket.accept(nullptr, false, options_.socketProfile);
+        if (!socket.valid()) {
+            throw std::runtime_error("accept failed");
+        }
+        ShardAssignment assignment;
+        assignment.shard = shard;
+        assignment.firstPlayer = next;
+        assignment.numShardPlayers = numPlayers / numShards + (shard < numPlayers % numShards ? 1 : 0);
+        assignment.numPlayers = numPlayers;
+        writeShardAssignment(socket, assignment);
+        firstPlayers.push_back(next);
+        next += assignment.numShardPlayers;
+        playerSockets.push_back(std::move(socket));
+        std::cout << "Shard " << shard + 1 << " is ready for players " << assignment.firstPlayer + 1 << " to " << next << "\n";
+    }
 
-        uint16_t player_port = ntohs(player_port_net);
-        playerInfos.push_back({i, pc.address, player_port});
+    // Each shard reports once all of its players have registered; the shards register their players concurrently
+    for (std::size_t shard = 0; shard < playerSockets.size(); ++shard) {
+        std::vector<PlayerRegistration> players = readShardRegistration(playerSockets[shard]);
+        std::uint32_t end = shard + 1 < firstPlayers.size() ? firstPlayers[shard + 1] : numPlayers;
+        if (players.size() != end - firstPlayers[shard]) {
+            throw std::runtime_error("Shard " + std::to_string(shard + 1) + " registered the wrong number of players");
+        }
+        for (const PlayerRegistration & player : players) {
+            int id = static_cast<int>(playerInfos.size());
+            playerInfos.push_back({id, player.address, Socket::addressPort(player.address), player.host});
+        }
+        reactor.add(playerSockets[shard].get_fd(), EPOLLIN, setupHandler(shard));
+    }
+}
+
+std::size_t Ringmaster::socketOf(std::size_t index) const {
+    return static_cast<std::size_t>(std::upper_bound(firstPlayers.begin(), firstPlayers.end(), index) - firstPlayers.begin()) - 1;
+}
 
-        playerSockets.push_back(std::move(pc.playerSocket));
+bool Ringmaster::routed(std::size_t socket) const {
+    std::uint32_t end = socket + 1 < firstPlayers.size() ? firstPlayers[socket + 1] : numPlayers;
+    return options_.numShards > 0 || end - firstPlayers[socket] > 1;
+}
 
-        std::cout << "Player " << i + 1 << " is ready to play\n"; // Convert to 1-based player ID for printing
+void Ringmaster::sendToPlayer(std::uint32_t index, const Potato & potato) const {
+    std::size_t socket = socketOf(index);
+    if (routed(socket)) {
+        writeRoutedPotato(playerSockets[socket], index - firstPlayers[socket], potato);
+    }
+    else {
+        writePotato(playerSockets[socket], potato);
     }
 }
 
+TransportKind Ringmaster::linkTransport(const PlayerInfo & from, const PlayerInfo & to) const {
+    return from.host == to.host ? options_.localTransport : TransportKind::Tcp;
+}
+
 // Helper function
-std::string Ringmaster::getNeighborInfo(const PlayerInfo & neighbor) const {
-    return std::to_string(neighbor.id) + ":" + neighbor.address + ":" + std::to_string(neighbor.port);
+NeighborEntry Ringmaster::getNeighborEntry(std::size_t player, std::size_t neighbor) const {
+    // The player with the higher ID starts the link, since it registered last and the other one is ready for it
+    const PlayerInfo & from = playerInfos[std::max(player, neighbor)];
+    const PlayerInfo & to = playerInfos[std::min(player, neighbor)];
+    NeighborEntry entry;
+    entry.index = static_cast<std::uint32_t>(playerInfos[neighbor].id);
+    entry.transport = linkTransport(from, to);
+    entry.address = playerInfos[neighbor].address;
+    std::string name;
+    if (entry.transport == TransportKind::SharedMemory) {
+        name = "/potato-" + std::to_string(::getpid()) + "-" + std::to_string(from.id) + "-" + std::to_string(to.id);
+    }
+    else if (entry.transport == TransportKind::Unix) {
+        name = "@potato-player-" + std::to_string(to.port); // The player that completes the link listens, and its TCP port is unique on the host
+    }
+    if (name.size() >= LINK_NAME_SIZE) {
+        throw std::runtime_error("Link name too long: " + name);
+    }
+    std::memcpy(entry.linkName, name.data(), name.size());
+    return entry;
 }
 
-void Ringmaster::sendPlayerOwnInfo(const PlayerInfo & playerInfo, const Socket & playerSocket) const {
-    std::uint16_t player_id_info = htons(static_cast<std::uint16_t>(playerInfo.id));
-    playerSocket.sendAll(reinterpret_cast<const char *>(&player_id_info), sizeof(player_id_info));
+void Ringmaster::sendSetupMessage(std::size_t index, const std::vector<NeighborEntry> & neighbors, const std::vector<HopDecision> & decisions) const {
+    const Socket & socket = playerSockets[socketOf(index)];
+    SetupHeader header;
+    header.index = static_cast<std::uint32_t>(playerInfos[index].id);
+    header.numPlayers = numPlayers;
+    header.seed = options_.seed;
+    header.checkpointInterval = static_cast<std::uint32_t>(options_.checkpointInterval);
+    writeSetup(socket, header, neighbors, decisions);
 }
 
-void Ringmaster::sendTotalNumberOfPlayers(const Socket & playerSocket) const {
-    std::uint16_t numPlayers_net = htons(static_cast<std::uint16_t>(numPlayers));
-    playerSocket.sendAll(reinterpret_cast<const char *>(&numPlayers_net), sizeof(numPlayers_net));
+std::vector<std::vector<HopDecision>> Ringmaster::replayDecisions() const {
+    std::vector<std::vector<HopDecision>> decisions(graph.size());
+    for (std::size_t p = 0; p < replay.paths.size(); ++p) {
+        const std::vector<int> & path = replay.paths[p];
+        for (std::size_t seq = 0; seq + 1 < path.size(); ++seq) {
+            const std::vector<int> & neighbors = graph[path[seq] - 1];
+            auto next = std::find(neighbors.begin(), neighbors.end(), path[seq + 1] - 1);
+            if (next == neighbors.end()) {
+                throw std::runtime_error("The recorded path of potato " + std::to_string(p + 1) + " passes from player " + std::to_string(path[seq]) + 
+                                         " to player " + std::to_string(path[seq + 1]) + ", which are not neighbors");
+            }
+            decisions[path[seq] - 1].push_back({static_cast<std::uint32_t>(p + 1), static_cast<std::uint32_t>(seq), 
+                                                static_cast<std::uint32_t>(next - neighbors.begin())});
+        }
+    }
+    return decisions;
 }
 
 void Ringmaster::sendInfoToPlayers() const {
-    if (numPlayers == 1) {
-        sendPlayerOwnInfo(playerInfos[0], playerSockets[0]);
-        sendTotalNumberOfPlayers(playerSockets[0]);
-        return;
+    std::vector<NeighborEntry> neighbors;
+    for (std::size_t i = 0; i < playerInfos.size(); ++i) {
+        neighbors.clear();
+        for (int j : graph[i]) {
+            neighbors.push_back(getNeighborEntry(i, static_cast<std::size_t>(j)));
+        }
+        sendSetupMessage(i, neighbors, hopDecisions[i]);
     }
-    for (size_t i = 0; i < playerSockets.size(); ++i) {
-        sendPlayerOwnInfo(playerInfos[i], playerSockets[i]);
-        sendTotalNumberOfPlayers(playerSockets[i]);
-
-        int rightIndex = (i + 1) % numPlayers;
-        std::string info = getNeighborInfo(playerInfos[rightIndex]);
+}
 
-        if (numPlayers > 2) {
-            int leftIndex = (i - 1 + numPlayers) % numPlayers;
-            info += "\n" + getNeighborInfo(playerInfos[leftIndex]);
+void Ringmaster::announcePlayers(std::size_t first, std::size_t count) const {
+    std::size_t end = first + count;
+    std::vector<NeighborEntry> neighbors;
+    for (std::size_t i = first; i < end; ++i) {
+        neighbors.clear();
+        for (int j : graph[i]) {
+            if (static_cast<std::size_t>(j) < end) {
+                neighbors.push_back(getNeighborEntry(i, static_cast<std::size_t>(j)));
+            }
+            else {
+                NeighborEntry pending; // Completed by a notice once the neighbor registers
+                pending.index = static_cast<std::uint32_t>(j);
+                neighbors.push_back(pending);
+            }
         }
+        sendSetupMessage(i, neighbors, hopDecisions[i]);
+    }
 
-        info += "\n"; // Add a newline at the end to indicate the end of the message
-
-        const Socket & playerSocket = playerSockets[i];
+    // The players that registered before wait for these ones to start the links between them
+    for (std::size_t i = first; i < end; ++i) {
+        for (int j : graph[i]) {
+            if (static_cast<std::size_t>(j) < first) {
+                writeNeighborNotice(playerSockets[socketOf(static_cast<std::size_t>(j))], static_cast<std::uint32_t>(j), getNeighborEntry(static_cast<std::size_t>(j), i));
+            }
+        }
+    }
+}
 
-        std::uint16_t info_len = htons(static_cast<std::uint16_t>(info.size()));
-        playerSocket.sendAll(reinterpret_cast<const char *>(&info_len), sizeof(info_len));
-        playerSocket.sendAll(info.c_str(), info.size());
+std::uint32_t Ringmaster::startingPlayer(std::uint32_t potatoId) const {
+    if (potatoId <= replay.paths.size()) {
+        return static_cast<std::uint32_t>(replay.paths[potatoId - 1].front() - 1);
     }
+    return static_cast<std::uint32_t>(hopRandom(options_.seed, 0, potatoId, 0) % numPlayers);
 }
 
 int Ringmaster::sendPotato(Potato & potato) const {
@@ -102,8 +324,11 @@ int Ringmaster::sendPotato(Potato & potato) const {
     if (playerSockets.empty()) {
         return -1;
     }
-    int randomIndex = rand() % numPlayers;
-    playerSockets[randomIndex].sendAll(reinterpret_cast<const char *>(&potato), sizeof(potato));
+    int randomIndex = static_cast<int>(livePlayer(startingPlayer(potato.getId())));
+    if (potato.hasTimestamps()) {
+        potato.startClock();
+    }
+    sendToPlayer(static_cast<std::uint32_t>(randomIndex), potato);
     return randomIndex;
 }
 
@@ -111,117 +336,665 @@ int Ringmaster::startGame(int numHops) {
     std::cout << "Potato Ringmaster\n";
     std::cout << "Players = " << numPlayers << std::endl;
     std::cout << "Hops = " << numHops << std::endl;
+    if (!options_.replayFile.empty()) {
+        // The recording must describe this very game, so that every potato has a path to follow and every hop a decision
+        if (replay.numPlayers != static_cast<int>(numPlayers) || replay.paths.size() != static_cast<std::size_t>(numHops > 0 ? options_.numPotatoes : 0)) {
+            throw std::runtime_error("The recording has " + std::to_string(replay.paths.size()) + " potatoes and " + std::to_string(replay.numPlayers) + " players");
+        }
+        for (const std::vector<int> & path : replay.paths) {
+            if (path.size() != static_cast<std::size_t>(numHops)) {
+                throw std::runtime_error("The recording has potatoes of " + std::to_string(path.size()) + " hops");
+            }
+        }
+    }
+    times.registrationStart = monotonicNanos();
+    // The topology only depends on the number of players, so it is known before any player registers
+    graph = numPlayers > 1 ? buildTopology(options_.topology, numPlayers) : std::vector<std::vector<int>>(numPlayers);
+    hopDecisions = replayDecisions();
     openListeningSocket();
-    initializePlayers();
-    sendInfoToPlayers();
+    if (options_.numShards > 0) {
+        std::cout << "Shards = " << options_.numShards << std::endl;
+        initializeShards();
+        sendInfoToPlayers();
+    }
+    else {
+        announceOnRegistration = true;
+        initializePlayers();
+    }
+    reports.assign(playerSockets.size(), PlayerCounters());
+    awaitingReport.assign(playerSockets.size(), false);
+    times.registrationEnd = monotonicNanos();
+    times.gameStart = times.registrationEnd;
 
     if (numHops <= 0) {
         std::cout << "No hops specified. Ending game.\n";
         return 0;
     }
-    Potato potato = createPotato(numHops);
-    int startingPlayer = sendPotato(potato);
-    std::cout << "Ready to start the game, sending potato to player " << startingPlayer + 1 << "\n"; // Convert to 1-based player ID for printing
+    if (!options_.replayFile.empty()) {
+        std::cout << "Replaying " << options_.replayFile << "\n";
+    }
+    injectPotatoes(numHops);
     return 1;
 }
 
-Potato Ringmaster::waitForPotato() const {
-    std::vector<struct pollfd> pfds(numPlayers);
-    for (int i = 0; i < numPlayers; ++i) {
-        int player_fd = playerSockets[i].get_fd();
-        pfds[i] = {player_fd, POLLIN, 0};
+void Ringmaster::injectPotatoes(int numHops) {
+    potatoHops = numHops;
+    if (options_.numPotatoes == 1) {
+        Potato potato = createPotato(numHops, 1);
+        int startingPlayer = sendPotato(potato);
+        std::cout << "Ready to start the game, sending potato to player " << startingPlayer + 1 << "\n"; // Convert to 1-based player ID for printing
+        return;
+    }
+    for (int id = 1; id <= options_.numPotatoes; ++id) {
+        Potato potato = createPotato(numHops, id);
+        int startingPlayer = sendPotato(potato);
+        std::cout << "Ready to start the game, sending potato " << id << " to player " << startingPlayer + 1 << "\n";
+    }
+}
+
+void Ringmaster::nextRound(const std::vector<Potato> & potatoes, int numHops) {
+    for (const Potato & potato : potatoes) {
+        if (potato.getHops() < 0) {
+            throw std::runtime_error("Failed to receive the final potato of round " + std::to_string(round) + " from the players");
+        }
     }
-    int status = ::poll(pfds.data(), numPlayers, -1);
-    if (status > 0) {
-        for (int i = 0; i < numPlayers; ++i) {
-            if (pfds[i].revents & POLLIN) {
-                Potato finalPotato;
-                playerSockets[i].recvAll(reinterpret_cast<char *>(&finalPotato), sizeof(finalPotato));
-                return finalPotato;
+    times.shutdownStart = monotonicNanos();
+    collectTraceLogs();
+    times.shutdownEnd = monotonicNanos();
+    writeMetrics(potatoes.size());
+    std::vector<Potato> reported = printRound(potatoes);
+    if (!options_.statsFile.empty()) {
+        writeStats(reported);
+    }
+
+    traceLog.clear();
+    checkpoints.clear();
+    ++round;
+    times.registrationStart = times.registrationEnd = times.shutdownEnd; // The players register once for the whole session
+    times.gameStart = times.registrationEnd;
+    injectPotatoes(numHops);
+}
+
+std::vector<Potato> Ringmaster::waitForPotatoes() {
+    std::vector<Potato> potatoes;
+    std::vector<std::size_t> lostSockets;
+    auto watch = [this, &potatoes, &lostSockets]() {
+        for (std::size_t i = 0; i < playerSockets.size(); ++i) {
+            if (!playerSockets[i].valid()) {
+                continue; // A lost process
             }
+            reactor.setHandler(playerSockets[i].get_fd(), [this, i, &potatoes, &lostSockets](std::uint32_t) {
+                if (!receiveFrame(i, potatoes)) {
+                    reactor.remove(playerSockets[i].get_fd());
+                    lostSockets.push_back(i);
+                }
+            });
+        }
+    };
+    watch();
+    // The shards relay nothing but potatoes, so the counters of a sharded game only arrive with the acknowledgements
+    bool reporting = !options_.metricsFile.empty() && options_.numShards == 0;
+    std::uint64_t intervalNs = static_cast<std::uint64_t>(options_.metricsIntervalMs) * 1000000;
+    std::uint64_t nextReport = monotonicNanos() + intervalNs;
+    // The reports asked for are read before returning, so that the answers to the signals that follow are the only thing left to read
+    while (potatoes.size() < static_cast<std::size_t>(options_.numPotatoes) || awaitingReports > 0) {
+        int timeoutMs = -1;
+        if (reporting) {
+            std::uint64_t now = monotonicNanos();
+            if (now >= nextReport) {
+                if (potatoes.size() < static_cast<std::size_t>(options_.numPotatoes)) {
+                    requestReports();
+                }
+                nextReport = now + intervalNs;
+            }
+            timeoutMs = static_cast<int>((nextReport - now + 999999) / 1000000);
+        }
+        reactor.runOnce(timeoutMs);
+        if (!lostSockets.empty()) {
+            // Healed outside the handlers, since healing waits on the reactor itself; every process lost in the same batch is healed at once
+            heal(lostSockets, potatoes);
+            lostSockets.clear();
+            watch();
         }
     }
-    return Potato(-1); // Return a potato with -1 hops to indicate an error
+    times.gameEnd = monotonicNanos();
+    std::sort(potatoes.begin(), potatoes.end(), [](const Potato & a, const Potato & b) {
+        return a.getId() < b.getId();
+    });
+    return potatoes;
 }
 
-void Ringmaster::printTrace(const Potato & potato) const {
-    const int * trace = potato.getTrace();
-    int traceLength = potato.getTraceLength();
-    std::string finalTrace;
-    for (int i = 0; i < traceLength; ++i) {
-        finalTrace += std::to_string(trace[i]);
-        if (i < traceLength - 1) {
-            finalTrace += ",";
+bool Ringmaster::receiveFrame(std::size_t socket, std::vector<Potato> & potatoes) {
+    Potato potato(0);
+    try {
+        if (!readPlayerFrame(playerSockets[socket], potato, reports[socket])) {
+            reportReceived(socket, potatoes.size());
+            return true;
+        }
+    } catch (const std::exception &) {
+        if (options_.checkpointInterval == 0) {
+            throw;
         }
+        return false; // The kernel closes the connection of a process that dies, so the failed read is the sign of a lost player
+    }
+    if (options_.checkpointInterval == 0) {
+        potatoes.push_back(std::move(potato));
+        return true;
+    }
+    if (potato.getGeneration() != generation) {
+        return true; // A copy sent before the potato was re-injected
     }
-    std::string finalMessage = "Trace of potato:\n" + finalTrace;
-    std::cout << finalMessage << std::endl;
+    if (potato.getHops() <= 0) {
+        potatoes.push_back(std::move(potato));
+        return true;
+    }
+    auto checkpoint = checkpoints.find(potato.getId());
+    if (checkpoint == checkpoints.end()) {
+        checkpoints.emplace(potato.getId(), std::move(potato));
+    }
+    else if (checkpoint->second.getSeq() < potato.getSeq()) {
+        checkpoint->second = std::move(potato);
+    }
+    return true;
 }
 
-void Ringmaster::sendShutdownSignal() const {
-    Potato shutdownPotato(-2);
-    for (int i = 0; i < numPlayers; ++i) {
-        playerSockets[i].sendAll(reinterpret_cast<const char *>(&shutdownPotato), sizeof(shutdownPotato));
+void Ringmaster::requestReports() {
+    if (awaitingReports > 0) {
+        return; // A process that is slow to answer is not asked again, so its reports do not pile up
+    }
+    sendSignal(REPORT_HOPS);
+    for (std::size_t i = 0; i < playerSockets.size(); ++i) {
+        if (playerSockets[i].valid()) {
+            awaitingReport[i] = true;
+            ++awaitingReports;
+        }
     }
 }
 
-void Ringmaster::sendFinalMessage(const std::string & finalMessage) const {
-    std::uint16_t message_len_net = htons(static_cast<std::uint16_t>(finalMessage.size()));
-    for (int i = 0; i < numPlayers; ++i) {
-        playerSockets[i].sendAll(reinterpret_cast<const char *>(&message_len_net), sizeof(message_len_net));
-        playerSockets[i].sendAll(finalMessage.c_str(), finalMessage.size());
+void Ringmaster::reportReceived(std::size_t socket, std::size_t returned) {
+    if (!awaitingReport[socket]) {
+        return;
     }
-} 
+    awaitingReport[socket] = false;
+    if (--awaitingReports == 0) {
+        writeMetrics(returned);
+    }
+}
 
-void Ringmaster::waitForPlayersToAcknowledgeShutdown() const {
-    std::vector<struct pollfd> pfds(numPlayers);
-    for (int i = 0; i < numPlayers; ++i) {
-        pfds[i] = {playerSockets[i].get_fd(), POLLIN, 0};
+void Ringmaster::writeMetrics(std::size_t returned) const {
+    if (options_.metricsFile.empty()) {
+        return;
+    }
+    GameGauges gauges;
+    gauges.round = round;
+    gauges.players = numPlayers - static_cast<std::uint32_t>(std::count(lost.begin(), lost.end(), true));
+    gauges.potatoes = options_.numPotatoes;
+    gauges.potatoesReturned = returned;
+    gauges.generation = generation;
+
+    std::string temporary = options_.metricsFile + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Could not open the metrics file " + temporary);
+        }
+        writePrometheus(out, sumCounters(reports), gauges); // A lost process keeps the counters it last reported
+        if (!out.flush()) {
+            throw std::runtime_error("Could not write the metrics file " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), options_.metricsFile.c_str()) != 0) {
+        throw std::runtime_error("Could not rename the metrics file to " + options_.metricsFile + ": " + std::strerror(errno));
+    }
+}
+
+std::uint32_t Ringmaster::livePlayer(std::uint32_t index) const {
+    while (!lost.empty() && lost[index]) {
+        index = (index + 1) % numPlayers;
     }
+    return index;
+}
 
-    int closedPlayers = 0;
-    while (closedPlayers < numPlayers) {
-        int returnedPlayers = ::poll(pfds.data(), numPlayers, -1);
-        if (returnedPlayers < 0) {
-            if (errno == EINTR) {
+std::vector<AddedLink> Ringmaster::spliceTopology(const std::vector<std::uint32_t> & lostPlayers) {
+    // Group the lost players into sets of linked players, one per gap, and collect the live neighbors of each gap: 
+    // those are the ones that lose links
+    std::vector<int> gapOf(numPlayers, -1);
+    std::vector<std::vector<int>> boundaries;
+    for (std::uint32_t p : lostPlayers) {
+        if (gapOf[p] >= 0) {
+            continue;
+        }
+        int gap = static_cast<int>(boundaries.size());
+        boundaries.emplace_back();
+        std::vector<int> pending = {static_cast<int>(p)};
+        gapOf[p] = gap;
+        while (!pending.empty()) {
+            int q = pending.back();
+            pending.pop_back();
+            for (int j : graph[q]) {
+                if (!lost[j]) {
+                    boundaries[gap].push_back(j);
+                }
+                else if (gapOf[j] < 0) {
+                    gapOf[j] = gap;
+                    pending.push_back(j);
+                }
+            }
+        }
+    }
+    for (std::uint32_t p : lostPlayers) {
+        graph[p].clear();
+    }
+    for (std::vector<int> & boundary : boundaries) {
+        std::sort(boundary.begin(), boundary.end());
+        boundary.erase(std::unique(boundary.begin(), boundary.end()), boundary.end());
+        for (int b : boundary) {
+            graph[b].erase(std::remove_if(graph[b].begin(), graph[b].end(), [this](int j) { return lost[j]; }), graph[b].end());
+        }
+    }
+
+    // Each gap is closed on its own; in a ring, this links the player before a run of lost players to the one after it
+    std::vector<AddedLink> added;
+    for (const std::vector<int> & boundary : boundaries) {
+        for (std::size_t k = 0; boundary.size() > 1 && k < boundary.size(); ++k) {
+            std::size_t a = static_cast<std::size_t>(boundary[k]);
+            std::size_t b = static_cast<std::size_t>(boundary[(k + 1) % boundary.size()]);
+            if (std::find(graph[a].begin(), graph[a].end(), static_cast<int>(b)) != graph[a].end()) {
                 continue;
             }
-            std::cerr << "Error: poll failed while waiting for players to close connections." << std::endl;
-            break;
+            graph[a].push_back(static_cast<int>(b));
+            graph[b].push_back(static_cast<int>(a));
+            added.push_back({static_cast<std::uint32_t>(a), getNeighborEntry(a, b)});
+            added.push_back({static_cast<std::uint32_t>(b), getNeighborEntry(b, a)});
         }
+    }
 
-        for (int i = 0; i < numPlayers; ++i) {
-            if (pfds[i].revents & POLLIN) {
-                char buf[1024];
-                ssize_t bytesRead = playerSockets[i].recvSome(buf, sizeof(buf));
-                if (bytesRead <= 0) {
-                    closedPlayers++;
-                    pfds[i].fd = -1; // Mark this player's socket as closed
-                }
+    if (std::count(lost.begin(), lost.end(), false) < 2) {
+        throw std::runtime_error("Too few players are left to go on with the game");
+    }
+    for (std::size_t i = 0; i < graph.size(); ++i) {
+        if (!lost[i] && graph[i].empty()) {
+            throw std::runtime_error("Player " + std::to_string(i + 1) + " has no neighbors left");
+        }
+    }
+    return added;
+}
+
+void Ringmaster::heal(const std::vector<std::size_t> & lostSockets, const std::vector<Potato> & returned) {
+    if (lost.empty()) {
+        lost.assign(numPlayers, false);
+    }
+    std::vector<std::uint32_t> lostPlayers;
+    for (std::size_t socket : lostSockets) {
+        std::uint32_t end = socket + 1 < firstPlayers.size() ? firstPlayers[socket + 1] : numPlayers;
+        for (std::uint32_t p = firstPlayers[socket]; p < end; ++p) {
+            lost[p] = true;
+            lostPlayers.push_back(p);
+            std::cout << "Lost player " << p + 1 << "\n";
+        }
+        playerSockets[socket] = Socket(); // Its file descriptor was removed from the reactor when the loss was found
+        reportReceived(socket, returned.size()); // The report asked for will never arrive
+    }
+    std::vector<AddedLink> added = spliceTopology(lostPlayers);
+    if (generation == UINT16_MAX) {
+        throw std::runtime_error("Too many players were lost");
+    }
+    ++generation;
+
+    // Every process learns the new generation, so the copies of the potatoes still in flight are dropped wherever they go next
+    std::vector<std::size_t> lateLost; // Processes lost while the others relink
+    sendSignal(RELINK_HOPS, &lateLost);
+    for (std::size_t i : lateLost) {
+        reactor.remove(playerSockets[i].get_fd());
+    }
+    std::size_t relinking = 0;
+    for (std::size_t i = 0; i < playerSockets.size(); ++i) {
+        if (!playerSockets[i].valid() || std::find(lateLost.begin(), lateLost.end(), i) != lateLost.end()) {
+            continue;
+        }
+        Relink relink;
+        relink.lost = lostPlayers;
+        for (const AddedLink & link : added) {
+            if (socketOf(link.index) == i) {
+                relink.added.push_back(link);
             }
         }
+        try {
+            writeRelink(playerSockets[i], relink);
+        } catch (const std::exception &) {
+            reactor.remove(playerSockets[i].get_fd());
+            lateLost.push_back(i);
+            continue;
+        }
+        ++relinking;
+        // The frames sent before the relink potato arrived are stale, and the relink potato comes back once the process has formed its links
+        reactor.setHandler(playerSockets[i].get_fd(), [this, i, &relinking, &returned, &lateLost](std::uint32_t) {
+            Potato frame(0);
+            bool report;
+            try {
+                report = !readPlayerFrame(playerSockets[i], frame, reports[i]);
+            } catch (const std::exception &) {
+                reactor.remove(playerSockets[i].get_fd());
+                lateLost.push_back(i);
+                --relinking;
+                return;
+            }
+            if (report) {
+                reportReceived(i, returned.size()); // Asked for before the loss was found
+            }
+            else if (frame.getHops() == RELINK_HOPS) {
+                reactor.setHandler(playerSockets[i].get_fd(), nullptr);
+                --relinking;
+            }
+        });
     }
+    while (relinking > 0) {
+        reactor.runOnce();
+    }
+    std::cout << "Relinked " << added.size() / 2 << " links around the lost players\n";
+    if (!lateLost.empty()) {
+        heal(lateLost, returned); // The next generation re-injects the potatoes for both losses
+        return;
+    }
+
+    for (std::uint32_t id = 1; id <= static_cast<std::uint32_t>(options_.numPotatoes); ++id) {
+        if (std::any_of(returned.begin(), returned.end(), [id](const Potato & potato) { return potato.getId() == id; })) {
+            continue;
+        }
+        auto checkpoint = checkpoints.find(id);
+        if (checkpoint == checkpoints.end()) {
+            Potato potato = createPotato(potatoHops, id);
+            int player = sendPotato(potato);
+            std::cout << "Re-injecting potato " << id << " from the start to player " << player + 1 << "\n";
+            continue;
+        }
+        Potato potato = checkpoint->second;
+        potato.setGeneration(generation);
+        std::uint32_t player = livePlayer(static_cast<std::uint32_t>(hopRandom(options_.seed, 0, id, potato.getSeq()) % numPlayers));
+        if (potato.hasTimestamps()) {
+            potato.startClock();
+        }
+        sendToPlayer(player, potato);
+        std::cout << "Re-injecting potato " << id << " after " << potato.getSeq() << " hops to player " << player + 1 << "\n";
+    }
+}
+
+void Ringmaster::printTrace(const Potato & potato) const {
+    writeTrace(std::cout, potato, options_.numPotatoes > 1);
+}
+
+void Ringmaster::printLatencyReport(const std::vector<Potato> & potatoes) const {
+    if (options_.latencyReport) {
+        writeLatencyReport(std::cout, potatoes);
+    }
+}
+
+std::vector<Potato> Ringmaster::printRound(const std::vector<Potato> & potatoes) {
+    bool printing = options_.traceFile.empty();
+    if (options_.rounds > 1 && printing) {
+        std::cout << "Round " << round << "\n";
+    }
+    if (!options_.distributedTrace) {
+        if (printing) {
+            for (const Potato & potato : potatoes) {
+                printTrace(potato);
+            }
+        }
+        writeTraceFile(potatoes);
+        printLatencyReport(potatoes);
+        return potatoes;
+    }
+    sortTraceLog(traceLog);
+    std::vector<Potato> merged; // The potatoes carrying the traces reconstructed from the players' logs
+    for (const Potato & potato : potatoes) {
+        merged.push_back(mergeTraceLog(traceLog, potato, generation > 0)); // The logs of lost players are gone
+        if (printing) {
+            printTrace(merged.back());
+        }
+    }
+    writeTraceFile(merged);
+    printLatencyReport(merged);
+    return merged;
 }
 
-void Ringmaster::tidyUp(const std::string & finalMessage) const {
-    sendShutdownSignal();
+void Ringmaster::writeTraceFile(const std::vector<Potato> & potatoes) const {
+    if (options_.traceFile.empty()) {
+        return;
+    }
+    std::ofstream out(options_.traceFile, std::ios::binary | (round > 1 ? std::ios::app : std::ios::trunc)); // Every round of a session is appended
+    if (!out) {
+        throw std::runtime_error("Could not open trace file " + options_.traceFile);
+    }
+    if (round == 1) {
+        writeBinaryTraceHeader(out, options_.numPotatoes > 1, options_.rounds > 1);
+    }
+    for (const Potato & potato : potatoes) {
+        writeBinaryTrace(out, potato, round);
+    }
+    if (!out.flush()) {
+        throw std::runtime_error("Could not write trace file " + options_.traceFile);
+    }
+}
+
+void Ringmaster::sendSignal(int hops, std::vector<std::size_t> * failed) const {
+    Potato signal(hops);
+    signal.setGeneration(generation);
+    for (std::size_t i = 0; i < playerSockets.size(); ++i) {
+        if (!playerSockets[i].valid()) {
+            continue; // A lost process
+        }
+        try {
+            if (routed(i)) {
+                writeRoutedPotato(playerSockets[i], ROUTE_TO_ALL, signal);
+            }
+            else {
+                writePotato(playerSockets[i], signal);
+            }
+        } catch (const std::exception &) {
+            if (failed == nullptr) {
+                throw;
+            }
+            failed->push_back(i);
+        }
+    }
+}
+
+void Ringmaster::skipCheckpoints(const Socket & socket, int hops) const {
+    if (options_.checkpointInterval == 0) {
+        return;
+    }
+    Potato frame = readPotato(socket);
+    while (frame.getHops() != hops) {
+        frame = readPotato(socket); // A checkpoint of a potato that was received back in the meantime
+    }
+}
+
+void Ringmaster::collectTraceLogs() {
+    sendSignal(NEW_GAME_HOPS);
+    for (std::size_t i = 0; i < playerSockets.size(); ++i) {
+        const Socket & socket = playerSockets[i];
+        if (!socket.valid()) {
+            continue;
+        }
+        skipCheckpoints(socket, NEW_GAME_HOPS);
+        readShutdownAck(socket, traceLog, reports[i]); // Every potato is back, so the acknowledgement is the only thing left to read
+        socket.acknowledgeNow(); // The player sends nothing else before returning a potato of the next round, which Nagle's algorithm would hold back
+    }
+}
+
+void Ringmaster::relaySetupMessages(const Socket & root) const {
+    std::vector<NeighborEntry> neighbors;
+    for (std::size_t i = 0; i < numPlayers; ++i) {
+        SetupHeader header = readSetupHeader(root);
+        neighbors.resize(header.numNeighbors);
+        readSetupNeighbors(root, neighbors.data(), neighbors.size());
+        writeSetup(playerSockets[socketOf(i)], header, neighbors, readSetupDecisions(root, header.numDecisions));
+    }
+}
+
+void Ringmaster::relayPotatoes(const Socket & root) {
+    bool shutdown = false;
+    reactor.add(root.get_fd(), EPOLLIN, [this, &root, &shutdown](std::uint32_t) {
+        std::uint32_t target;
+        Potato potato = readRoutedPotato(root, target);
+        if (target == ROUTE_TO_ALL && potato.getHops() == NEW_GAME_HOPS) {
+            collectTraceLogs();
+            writeShutdownAck(root, traceLog, sumCounters(reports)); // The trace logs and counters of every player of the shard, as a single acknowledgement
+            traceLog.clear();
+            return;
+        }
+        if (target == ROUTE_TO_ALL) {
+            shutdown = true; // Otherwise only the shutdown potato goes to every player, and tidyUp() sends it to them
+            return;
+        }
+        if (target >= numPlayers) {
+            throw std::runtime_error("The root ringmaster sent a potato to player " + std::to_string(target) + " of a shard of " + std::to_string(numPlayers));
+        }
+        sendToPlayer(target, potato);
+    });
+    for (std::size_t i = 0; i < playerSockets.size(); ++i) {
+        reactor.setHandler(playerSockets[i].get_fd(), [this, &root, i](std::uint32_t) {
+            writePotato(root, readPotato(playerSockets[i]));
+        });
+    }
+    while (!shutdown) {
+        reactor.runOnce();
+    }
+    reactor.remove(root.get_fd());
+}
+
+void Ringmaster::runShard(const std::string & rootAddress, std::uint16_t rootPort) {
+    Socket root = Socket::connectToServer(rootAddress, rootPort, true, options_.socketProfile);
+    ShardAssignment assignment = readShardAssignment(root);
+    numPlayers = assignment.numShardPlayers;
+    firstPlayer = assignment.firstPlayer;
+    std::cout << "Potato Ringmaster shard " << assignment.shard + 1 << "\n";
+    std::cout << "Players = " << firstPlayer + 1 << " to " << firstPlayer + numPlayers << " of " << assignment.numPlayers << std::endl;
+    openListeningSocket();
+    initializePlayers();
+    reports.assign(playerSockets.size(), PlayerCounters());
+    awaitingReport.assign(playerSockets.size(), false);
+
+    std::vector<PlayerRegistration> players;
+    for (const PlayerInfo & info : playerInfos) {
+        players.push_back({info.address, info.host});
+    }
+    writeShardRegistration(root, players);
+    relaySetupMessages(root);
+    relayPotatoes(root);
+
+    tidyUp(readFinalMessage(root));
+    writeShutdownAck(root, traceLog, sumCounters(reports)); // The trace logs and counters of every player of the shard
+}
+
+void Ringmaster::sendFinalMessage(const std::string & finalMessage) const {
+    std::uint16_t message_len_net = htons(static_cast<std::uint16_t>(finalMessage.size()));
+    struct iovec iov[2];
+    iov[0].iov_base = &message_len_net;
+    iov[0].iov_len = sizeof(message_len_net);
+    iov[1].iov_base = const_cast<char *>(finalMessage.data());
+    iov[1].iov_len = finalMessage.size();
+    for (const Socket & socket : playerSockets) {
+        if (socket.valid()) {
+            socket.sendAllv(iov, 2);
+        }
+    }
+} 
+
+void Ringmaster::waitForPlayersToAcknowledgeShutdown() {
+    for (std::size_t i = 0; i < playerSockets.size(); ++i) {
+        if (!playerSockets[i].valid()) {
+            continue;
+        }
+        reactor.setHandler(playerSockets[i].get_fd(), [this, i, acknowledged = false](std::uint32_t) mutable {
+            if (!acknowledged) {
+                skipCheckpoints(playerSockets[i], SHUTDOWN_HOPS);
+                readShutdownAck(playerSockets[i], traceLog, reports[i]);
+                acknowledged = true;
+                return;
+            }
+            char buf[1024];
+            std::size_t bytesRead = playerSockets[i].recvSome(buf, sizeof(buf));
+            if (bytesRead == 0) {
+                reactor.remove(playerSockets[i].get_fd()); // The player has closed its connection
+            }
+        });
+    }
+
+    while (reactor.size() > 0) {
+        reactor.runOnce();
+    }
+}
+
+void Ringmaster::tidyUp(const std::string & finalMessage) {
+    times.shutdownStart = monotonicNanos();
+    sendSignal(SHUTDOWN_HOPS);
     sendFinalMessage(finalMessage);
     waitForPlayersToAcknowledgeShutdown();
+    times.shutdownEnd = monotonicNanos();
 }
 
-void Ringmaster::endGame(const Potato & potato, int gameInfo) const {
+void Ringmaster::writeStats(const std::vector<Potato> & potatoes) const {
+    std::uint64_t totalHops = 0;
+    for (const Potato & potato : potatoes) {
+        totalHops += potato.getSeq();
+    }
+    std::uint64_t gameNs = times.gameEnd > times.gameStart ? times.gameEnd - times.gameStart : 0;
+    std::vector<std::uint64_t> latencies = collectHopLatencies(potatoes);
+    std::sort(latencies.begin(), latencies.end());
+
+    std::ofstream out(options_.statsFile, round > 1 ? std::ios::app : std::ios::trunc); // One line per round of a session
+    if (!out) {
+        throw std::runtime_error("Could not open stats file " + options_.statsFile);
+    }
+    out << "{\"round\": " << round
+        << ", \"players\": " << numPlayers
+        << ", \"potatoes\": " << potatoes.size()
+        << ", \"hops\": " << totalHops
+        << ", \"socket_profile\": \"" << Socket::profileName(options_.socketProfile) << "\""
+        << ", \"local_transport\": \"" << transportName(options_.localTransport) << "\""
+        << ", \"topology\": \"" << topologyName(options_.topology.kind) << "\""
+        << ", \"seed\": " << options_.seed
+        << ", \"registration_ns\": " << times.registrationEnd - times.registrationStart
+        << ", \"game_ns\": " << gameNs
+        << ", \"shutdown_ns\": " << times.shutdownEnd - times.shutdownStart
+        << ", \"hops_per_sec\": " << (gameNs > 0 ? totalHops * 1e9 / gameNs : 0.0)
+        << ", \"hop_latency_samples\": " << latencies.size()
+        << ", \"hop_latency_p50_ns\": " << percentile(latencies, 0.50)
+        << ", \"hop_latency_p99_ns\": " << percentile(latencies, 0.99)
+        << ", \"hop_latency_p999_ns\": " << percentile(latencies, 0.999)
+        << "}\n";
+}
+
+void Ringmaster::endGame(const std::vector<Potato> & potatoes, int gameInfo) {
     std::string finalMessage = "Game over. Shutting down...";
+    std::vector<Potato> reported; // The potatoes as printed, carrying the traces reconstructed from the players' logs if the trace is distributed
     if (gameInfo == 0) {
         tidyUp(finalMessage);
     }
     else {
-        int finalHops = potato.getHops();
-        if (finalHops < 0) {
-            std::cerr << "Error: Failed to receive the final potato from the players." << std::endl;
-            return;
+        for (const Potato & potato : potatoes) {
+            if (potato.getHops() < 0) {
+                std::cerr << "Error: Failed to receive the final potato from the players." << std::endl;
+                return;
+            }
         }
 
-        printTrace(potato);
-        tidyUp(finalMessage);
+        if (options_.distributedTrace) {
+            tidyUp(finalMessage); // The traces are reconstructed from the logs the players send with their acknowledgements
+            reported = printRound(potatoes);
+        }
+        else {
+            reported = printRound(potatoes);
+            tidyUp(finalMessage);
+        }
     }
-}
\ No newline at end of file
+
+    if (!options_.recordFile.empty() && gameInfo != 0) {
+        writeRecording(options_.recordFile, options_.seed, options_.topology.seed, static_cast<int>(numPlayers), reported);
+    }
+    if (!options_.statsFile.empty()) {
+        writeStats(reported);
+    }
+    writeMetrics(potatoes.size());
+}
@@ -5,12 +5,62 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <unordered_map>
 #include "potato.hpp"
+#include "protocol.hpp"
+#include "Reactor.hpp"
+#include "replay.hpp"
 #include "Socket.hpp"
+#include "Transport.hpp"
+#include "metrics.hpp"
+#include "topology.hpp"
+
+/**
+ * Options that change how the ringmaster runs a game.
+ */
+struct RingmasterOptions {
+    // Keep the trace in the players' logs instead of the potato, so every hop message has a constant size
+    bool distributedTrace = false;
+    // Number of potatoes injected at the start of the game and forwarded concurrently by the players
+    int numPotatoes = 1;
+    // Record a timestamp next to every trace entry, so that per-hop latencies can be reported
+    bool timestamps = false;
+    // Print the per-link latency matrix and a latency histogram after the traces; implies timestamps
+    bool latencyReport = false;
+    // Socket options of the connections to the players
+    SocketProfile socketProfile = SocketProfile::Default;
+    // Transport of the links between neighbors that report the same host; neighbors on different hosts always use TCP
+    TransportKind localTransport = TransportKind::SharedMemory;
+    // Graph the players are arranged in
+    TopologyOptions topology;
+    // If not empty, write the timings of the game as a JSON object to this file at the end of the game
+    std::string statsFile;
+    // Seed of the players' neighbor choices and of the first player of every potato; a game with the same seed and topology takes the same path
+    std::uint64_t seed = 0;
+    // If not empty, write the hop path of every potato to this file at the end of the game, to be replayed with replayFile
+    std::string recordFile;
+    // If not empty, make the potatoes take the hop paths recorded in this file, with its seeds, instead of drawing random neighbors
+    std::string replayFile;
+    // If positive, run as the root of this many shard ringmasters, which register the players and relay their potatoes, instead of accepting the players
+    int numShards = 0;
+    // Number of games played back to back by the same players, which stay connected to each other between rounds; 
+    // with the same seed every round takes the same paths
+    int rounds = 1;
+    // If positive, the players send the ringmaster a checkpoint of every potato each this many hops, and the game goes on without the players it loses: 
+    // their neighbors are linked to each other and the potatoes are re-injected from their checkpoints
+    int checkpointInterval = 0;
+    // If not empty, export the counters of the players and the state of the game to this file in the Prometheus text format, 
+    // for a node exporter's textfile collector or any scraper that reads files
+    std::string metricsFile;
+    // Time between the reports the players are asked for while a round is played, in milliseconds; the file is also written at the end of every round
+    int metricsIntervalMs = 1000;
+    // If not empty, write the traces to this file as varints, to be decoded with --decode-trace, instead of printing them
+    std::string traceFile;
+};
 
 class Ringmaster {
 public:
-    Ringmaster(int port, int numPlayers);
+    Ringmaster(int port, int numPlayers, const RingmasterOptions & options = RingmasterOptions());
 
     /**
      * Start the ringmaster by accepting connections from the specified number of players, sending the necessary information to each player, 
@@ -20,30 +70,85 @@ public:
      */
     int startGame(int numHops);
     /**
-     * Wait for a potato to be received from any player, and then return the received potato.
-     * This function will block until a potato is received, and then return the received Potato object.
-     * @return the received Potato object, or a Potato with -1 hops if an error occurs while waiting for or receiving the potato
+     * Wait for every potato of the game to be received back from the players, and then return the received potatoes.
+     * This function will block until all potatoes are received, and then return them ordered by potato ID.
+     * If the game survives lost players, it keeps the checkpoints the players send, and goes on without the players it loses.
+     * @return the received Potato objects
+     */
+    std::vector<Potato> waitForPotatoes();
+    /**
+     * End a round of a session and start the next one with the same players: send every player the new game potato, 
+     * collect the trace logs they answer with, print the traces of the round and write its stats, then inject the potatoes of the next round.
+     * @param potatoes the potatoes received at the end of the round
+     * @param numHops the number of hops of the potatoes of the next round
+     * @throws std::runtime_error if a potato of the round was not received back
      */
-    Potato waitForPotato() const;
+    void nextRound(const std::vector<Potato> & potatoes, int numHops);
     /**
-     * Print the trace of the given potato, which is a sequence of player IDs representing the path the potato has taken through the players.
+     * Print the trace of each of the given potatoes, which is a sequence of player IDs representing the path the potato has taken through the players.
+     * If the potatoes have a distributed trace, the players are shut down first so that the traces can be reconstructed from their logs.
      */
-    void endGame(const Potato & potato, int gameInfo) const;
+    void endGame(const std::vector<Potato> & potatoes, int gameInfo);
+    /**
+     * Run as a shard ringmaster: connect to the root ringmaster, register the players of the shard it assigns, 
+     * and forward their registrations to the root. The setup messages the root computes for the players are then relayed to them, 
+     * potatoes the root injects are handed to their target player, and potatoes the players send back are forwarded to the root. 
+     * When the root sends the shutdown potato, the players of the shard are shut down, and their acknowledgements and trace logs 
+     * are forwarded to the root as a single acknowledgement.
+     * @param rootAddress the hostname or address of the root ringmaster
+     * @param rootPort the port the root ringmaster listens on
+     */
+    void runShard(const std::string & rootAddress, std::uint16_t rootPort);
 private:
-    std::vector<Socket> playerSockets;
+    std::vector<Socket> playerSockets; // The connections to the player processes, or to the shard ringmasters for a root
     std::uint16_t port_;
     Socket mySocket;
-    std::uint16_t numPlayers;
+    std::uint32_t numPlayers; // Number of players of the game, or of the shard for a shard ringmaster
+    // The index of the first of the consecutive players each connection of playerSockets covers: a process playing one or more positions, or a shard for a root
+    std::vector<std::uint32_t> firstPlayers;
+    std::uint32_t firstPlayer = 0; // For a shard ringmaster, the index of the first player of the shard in the game
+    int round = 1; // The round of the session being played, counted from 1
+    Recording replay; // The game being replayed, which has no paths unless options_.replayFile is set
+    std::vector<std::vector<int>> graph; // The neighbor table of every player in the topology of the game; empty for a shard ringmaster
+    std::vector<std::vector<HopDecision>> hopDecisions; // The hop decisions of every player, empty unless the game is a replay
+    bool announceOnRegistration = false; // Whether every process is sent its setup as soon as it registers, rather than once all have
+    RingmasterOptions options_;
+    std::vector<TraceLogEntry> traceLog;
+    Reactor reactor;
+    int potatoHops = 0; // Hops of the potatoes of the round being played
+    std::uint16_t generation = 0; // Generation of the potatoes in play, which grows every time the game goes on without a lost player
+    std::vector<bool> lost; // Whether each player has been lost; empty until one is
+    std::unordered_map<std::uint32_t, Potato> checkpoints; // The latest checkpoint of every potato of the round, keyed by potato ID
+    std::vector<PlayerCounters> reports; // The latest counters reported over every connection, in the order of playerSockets
+    std::vector<bool> awaitingReport; // Whether a report was asked for over each connection and has not arrived yet
+    std::size_t awaitingReports = 0; // Number of connections with a report that has not arrived yet
+
+    // CLOCK_MONOTONIC stamps of the phases of the game, in nanoseconds
+    struct GameTimes {
+        std::uint64_t registrationStart = 0;
+        // All players have registered and been sent their neighbor information. The players may still be linking to their neighbors, 
+        // which the ringmaster is not told about, so linking is counted in the game time of the first round
+        std::uint64_t registrationEnd = 0;
+        std::uint64_t gameStart = 0;
+        std::uint64_t gameEnd = 0; // The last potato is back
+        std::uint64_t shutdownStart = 0;
+        std::uint64_t shutdownEnd = 0;
+    };
+    GameTimes times;
 
     struct PlayerConnection {
         Socket playerSocket;
-        std::string address;
+        sockaddr_storage address = {}; // The address the player connected from
+        // The registration as it arrives: the player's listening port, the number of positions it plays, the length of its host identifier, and the identifier
+        char registration[7 + 255] = {};
+        std::size_t received = 0;
     };
 
     struct PlayerInfo {
         int id;
-        std::string address;
+        sockaddr_storage address; // The player's listening address: the address it connected from, with its listening port
         std::uint16_t port;
+        std::string host; // Identifier of the player's host, equal for players that can share a local transport
     };
     std::vector<PlayerInfo> playerInfos;
 
@@ -54,52 +159,129 @@ private:
     void openListeningSocket();
     
     /**
-     * Accept a connection from a player, returning a PlayerConnection struct containing the accepted Socket and the player's IP address. 
-     * This function will block until a connection is accepted.
-     * @return a PlayerConnection struct containing the accepted Socket and the player's IP address
+     * Accept a connection from a player, returning a PlayerConnection struct containing the accepted non-blocking Socket and the player's address. 
+     * This function does not block; if no connection is pending, the returned Socket is invalid.
+     * @return a PlayerConnection struct containing the accepted Socket and the player's address
      */
     PlayerConnection acceptPlayer();
     /**
      * Initialize the player connections by accepting connections from the specified number of players and storing their information in the playerInfos vector. 
+     * Registration is a non-blocking state machine driven by the reactor: any number of players can be accepted and handshaking at once, 
+     * so a slow or stuck client does not hold up the others. Each registered player socket stays registered with the reactor, 
+     * with the handler of setupHandler() until the game starts, and the reactor then drives potato collection and shutdown acknowledgement.
      * This function should be called after opening the listening socket and before sending any information to the players.
      */
     void initializePlayers();
     /**
-     * Construct a neighbor information string in the format "ID:IP:port" for the given PlayerInfo struct, which contains the player's ID, IP address, and port number. 
-     * This function is used to create the neighbor information string that will be sent to each player.
-     * @param neighbor the PlayerInfo struct containing the player's ID, IP address, and port number
-     * @return a string in the format "ID:IP:port" representing the player's neighbor information
+     * Receive as much of a pending player's registration as is available: its listening port, the number of positions it plays, and the identifier of its host. 
+     * Once the whole registration has arrived, the player is assigned the next player IDs, one per position, and its socket is switched back to blocking mode; 
+     * it is then announced with announcePlayers() if announceOnRegistration is set.
+     * A player that disconnects before completing the handshake, or plays more positions than are left, is dropped.
+     * @param pending the connections that have not completed the handshake yet, keyed by file descriptor
+     * @param fd the file descriptor of the pending connection that is ready
+     */
+    void receiveRegistration(std::unordered_map<int, PlayerConnection> & pending, int fd);
+    /**
+     * Make the handler of a registered connection until the game starts. Nothing is expected on the connection before the first potato, 
+     * so the handler aborts the setup if the peer disconnects or sends anything, rather than leaving a readable socket the reactor would keep waking up for.
+     * @param socket the index of the connection in the playerSockets and firstPlayers vectors
+     * @return the handler to register for the connection
+     */
+    Reactor::Handler setupHandler(std::size_t socket);
+    /**
+     * Accept the configured number of shard ringmasters, assign each of them a contiguous range of players in the order they connect, 
+     * and gather the registrations of their players into the playerInfos vector, with IDs that number the players across all shards.
+     * This function replaces initializePlayers() for a root ringmaster. The shard sockets are then registered with the reactor, with the handler of setupHandler().
+     */
+    void initializeShards();
+    /**
+     * Find the connection a player is reached through: the process playing it, or its shard for a root.
+     * @param index the 0-based index of the player in the game, or in the shard for a shard ringmaster
+     * @return the index of the connection in the playerSockets and firstPlayers vectors
+     */
+    std::size_t socketOf(std::size_t index) const;
+    /**
+     * Check whether the potatoes sent over a connection must name the player they are meant for, 
+     * because the connection leads to a shard or to a process playing several positions.
+     * @param socket the index of the connection in the playerSockets and firstPlayers vectors
+     * @return true if the potatoes are sent with writeRoutedPotato(), false if they are sent with writePotato()
+     */
+    bool routed(std::size_t socket) const;
+    /**
+     * Send a potato to a player over the connection it is reached through, naming the player if the connection is routed.
+     * @param index the 0-based index of the player in the game, or in the shard for a shard ringmaster
+     * @param potato the Potato object to send
+     */
+    void sendToPlayer(std::uint32_t index, const Potato & potato) const;
+    /**
+     * Pick the transport of the link between two neighbors: the local transport if both players report the same host, TCP otherwise.
+     * @param from the player that starts the link
+     * @param to the player that completes the link
+     * @return the transport of the link
+     */
+    TransportKind linkTransport(const PlayerInfo & from, const PlayerInfo & to) const;
+    /**
+     * Construct the entry of the neighbor table of a player for the given neighbor, which carries the neighbor's index and listening address, 
+     * and the transport and name of the link between the player and that neighbor. The player with the higher ID starts the link. 
+     * The name identifies the link for the local transports: the shared memory segment, or the AF_UNIX listening socket of the player that completes the link.
+     * @param player the index of the player in the playerInfos vector
+     * @param neighbor the index of the neighbor in the playerInfos vector
+     * @return the neighbor entry
+     * @throws std::runtime_error if the name of the link does not fit in the entry
      */
-    std::string getNeighborInfo(const PlayerInfo & neighbor) const;
+    NeighborEntry getNeighborEntry(std::size_t player, std::size_t neighbor) const;
     /**
-     * Send the player's own information, including their ID, to the player using the provided Socket. 
-     * This function should be called for each player after accepting their connection and before sending any other information to the players.
-     * @param playerInfo the PlayerInfo struct containing the player's ID, IP address, and port number
-     * @param playerSocket the Socket object representing the connection to the player
+     * Send the binary setup message of a player, which consists of the player's ID, the total number of players, the seed of the game, 
+     * the player's neighbor table and its recorded hop decisions, with a single write. A root sends it to the shard of the player, which relays it.
+     * @param index the index of the player in the playerInfos and playerSockets vectors
+     * @param neighbors the neighbor table of the player, which is empty if there is only one player
+     * @param decisions the hop decisions of the player, empty unless the game is a replay
      */
-    void sendPlayerOwnInfo(const PlayerInfo & playerInfo, const Socket & playerSocket) const;
+    void sendSetupMessage(std::size_t index, const std::vector<NeighborEntry> & neighbors, const std::vector<HopDecision> & decisions) const;
     /**
-     * Send the total number of players in the game to the player using the provided Socket. 
-     * This function should be called for each player after sending their own information and before sending any neighbor information to the players.
-     * @param playerSocket the Socket object representing the connection to the player
+     * Turn the recorded paths of the game being replayed into the hop decisions of every player.
+     * @return the hop decisions of every player, indexed by the 0-based index of the player
+     * @throws std::runtime_error if a recorded path passes between two players that are not neighbors in the topology
      */
-    void sendTotalNumberOfPlayers(const Socket & playerSocket) const;
+    std::vector<std::vector<HopDecision>> replayDecisions() const;
     /**
      * Send the necessary information to each player, including their own ID, the total number of players, 
-     * and the neighbor information for their right and left neighbors. 
-     * This function should be called after accepting all player connections and before starting the game.
+     * and one neighbor entry for each of their neighbors in the topology of the game. 
+     * A root ringmaster calls this function once every shard has registered its players; a ringmaster that registers the players itself 
+     * announces them with announcePlayers() instead.
      */
     void sendInfoToPlayers() const;
+    /**
+     * Announce the positions of a process that has just registered: send the process their setup messages, in which the neighbors 
+     * that have not registered yet are pending, and send the processes that registered before a neighbor notice for every link 
+     * to a new position. The links to the players that registered before can then form while the rest of the players register.
+     * @param first the index of the first position of the process in the playerInfos vector
+     * @param count the number of positions of the process
+     */
+    void announcePlayers(std::size_t first, std::size_t count) const;
 
     /**
      * Create a new Potato object with the specified number of hops and return it. 
      * This function is used to create the initial potato that will be sent to a random player at the start of the game.
      * @param numHops the number of hops to set in the created Potato object
+     * @param potatoId the ID to give to the created Potato object
      * @return a new Potato object with the specified number of hops
      */
-    Potato createPotato(int numHops) const;
+    Potato createPotato(int numHops, std::uint32_t potatoId) const;
+    /**
+     * Pick the player a potato is sent to first: the first player of its recorded path if the game is a replay, 
+     * otherwise a player drawn from the seed of the game.
+     * @param potatoId the ID of the potato
+     * @return the 0-based index of the player
+     */
+    std::uint32_t startingPlayer(std::uint32_t potatoId) const;
     /**
-     * Send the given potato to a randomly chosen player. 
+     * Create the potatoes of a round and send each of them to its starting player.
+     * @param numHops the number of hops to set in the potatoes
+     */
+    void injectPotatoes(int numHops);
+    /**
+     * Send the given potato to the player picked by startingPlayer(). 
      * The potato's hops should be decremented before sending it. 
      * This function is used to send the initial potato to a random player at the start of the game, 
      * and can also be used to send a potato back to a player if it is received with 0 hops.
@@ -108,18 +290,117 @@ private:
      */
     int sendPotato(Potato & potato) const;
 
+    /**
+     * Get the first player that has not been lost, starting from the given one and wrapping around.
+     * @param index the 0-based index of the player to start from
+     * @return the 0-based index of a player that is still in the game
+     */
+    std::uint32_t livePlayer(std::uint32_t index) const;
+    /**
+     * Receive a frame from a player process while a round is played: a returned potato is added to the given potatoes, and a report 
+     * replaces the counters of the process. When the game survives lost players, a checkpoint replaces the earlier checkpoint of its potato, 
+     * and a copy of a potato that was re-injected since is ignored.
+     * @param socket the index of the connection in the playerSockets vector
+     * @param potatoes the potatoes received back so far
+     * @return false if the connection failed and the game survives lost players, which means the process was lost
+     * @throws std::runtime_error if the connection failed and the game does not survive lost players
+     */
+    bool receiveFrame(std::size_t socket, std::vector<Potato> & potatoes);
+    /**
+     * Ask every player process for a report of its counters by sending the report potato, unless the reports asked for last have not all arrived.
+     */
+    void requestReports();
+    /**
+     * Record that the report asked for over a connection has arrived or will never arrive, and write the metrics once the last one has.
+     * @param socket the index of the connection in the playerSockets vector
+     * @param returned the number of potatoes of the round received back so far
+     */
+    void reportReceived(std::size_t socket, std::size_t returned);
+    /**
+     * Write the summed counters of the player processes and the state of the game to the metrics file, if any. 
+     * The file is written under a temporary name and renamed, so that a reader never sees it half written.
+     * @param returned the number of potatoes of the round received back so far
+     * @throws std::runtime_error if the file cannot be written
+     */
+    void writeMetrics(std::size_t returned) const;
+    /**
+     * Remove the given players from the topology of the game and, for each group of linked lost players, link the live neighbors 
+     * of that group to each other in a cycle, so that the parts of the graph the lost players held together stay connected 
+     * without linking players on opposite sides of the graph.
+     * @param lostPlayers the 0-based indices of the lost players
+     * @return the links added, one entry for each end
+     * @throws std::runtime_error if fewer than two players are left, or a player is left without neighbors
+     */
+    std::vector<AddedLink> spliceTopology(const std::vector<std::uint32_t> & lostPlayers);
+    /**
+     * Go on with the game without the given player processes: splice the topology around their positions, 
+     * send every other process the relink potato of the next generation and the changes to its neighbor tables, wait until each has formed its new links, 
+     * and re-inject every potato that has not been received back from its latest checkpoint, or from the start if it has none.
+     * A process lost in the meantime is healed right after, in the generation that follows.
+     * @param lostSockets the indices of the connections of the lost processes, which are no longer watched by the reactor
+     * @param returned the potatoes received back so far, which are not re-injected
+     * @throws std::runtime_error if the game cannot go on with the players that are left
+     */
+    void heal(const std::vector<std::size_t> & lostSockets, const std::vector<Potato> & returned);
+
     /**
      * Print the trace of the given potato, which is a sequence of player IDs representing the path the potato has taken through the players. 
      * The trace should be printed in a comma-separated format, with a header line indicating that it is the trace of the potato.
+     * When the game has several potatoes, the header line also carries the potato ID.
      * @param potato the Potato object whose trace is to be printed
      */
     void printTrace(const Potato & potato) const;
+    /**
+     * Append the traces of a round to the binary trace file, which is created with its header in the first round of a session.
+     * @param potatoes the potatoes carrying the traces of the round
+     * @throws std::runtime_error if the file cannot be written
+     */
+    void writeTraceFile(const std::vector<Potato> & potatoes) const;
+    /**
+     * If the latency report is enabled, print the per-link latency matrix and the hop latency histogram of the given potatoes.
+     * @param potatoes the potatoes carrying the traces and hop latencies of the game
+     */
+    void printLatencyReport(const std::vector<Potato> & potatoes) const;
+    /**
+     * Print the traces and the latency report of a round, headed by the number of the round if the session has several. 
+     * If the trace is distributed, the traces are first reconstructed from the trace logs the players sent; 
+     * the hops logged by players that were lost are printed as player 0. With a trace file, the traces are written to it instead.
+     * @param potatoes the potatoes received at the end of the round
+     * @return the potatoes as printed, carrying the reconstructed traces if the trace is distributed
+     */
+    std::vector<Potato> printRound(const std::vector<Potato> & potatoes);
 
     /**
-     * Send a shutdown signal to all players to indicate that the game is over and they should exit. 
-     * This function should be called after the game is over and before waiting for the players to acknowledge the shutdown signal.
+     * Send a signal potato to all players: SHUTDOWN_HOPS to indicate that the game is over and they should exit, 
+     * or NEW_GAME_HOPS to indicate that a round is over and another one follows.
+     * @param hops the hops of the signal potato
+     * @param failed if not null, receives the indices of the connections the signal could not be written to, instead of throwing
+     */
+    void sendSignal(int hops, std::vector<std::size_t> * failed = nullptr) const;
+    /**
+     * If the game survives lost players, skip the checkpoints a player process sent before it received a signal potato, 
+     * up to the copy of the signal potato it sends back to mark their end.
+     * @param socket the Socket object connected to the process
+     * @param hops the hops of the signal potato
      */
-    void sendShutdownSignal() const;
+    void skipCheckpoints(const Socket & socket, int hops) const;
+    /**
+     * Send the new game potato to all players and append the trace logs they answer with to the traceLog member variable. 
+     * This function should be called once every potato of the round is back, so that the answers are the only thing left to read.
+     */
+    void collectTraceLogs();
+    /**
+     * For a shard ringmaster, relay the setup message of every player of the shard from the root ringmaster, in the order of the players.
+     * @param root the Socket object connected to the root ringmaster
+     */
+    void relaySetupMessages(const Socket & root) const;
+    /**
+     * For a shard ringmaster, hand the potatoes the root ringmaster injects to their target players, and forward the potatoes 
+     * the players send back to the root, until the root sends the shutdown potato. The new game potato is handed to every player, 
+     * and their trace logs are forwarded to the root as a single answer.
+     * @param root the Socket object connected to the root ringmaster
+     */
+    void relayPotatoes(const Socket & root);
     /**
      * Send a final message to all players before shutting down the game. 
      * This function should be called after sending the shutdown signal and before waiting for acknowledgements from players.
@@ -128,13 +409,21 @@ private:
     void sendFinalMessage(const std::string & finalMessage) const;
     /**
      * Wait for acknowledgements from all players to confirm that they have received the shutdown signal and are ready to exit. 
+     * The trace log sent along with each acknowledgement is appended to the traceLog member variable.
      * This function should be called after sending the shutdown signal and before tidying up any resources or exiting the program.
      */
-    void waitForPlayersToAcknowledgeShutdown() const;
+    void waitForPlayersToAcknowledgeShutdown();
     /**
      * Perform any necessary cleanup after the game is over, such as closing any open connections or releasing any resources. 
      * This function should be called after waiting for the players to acknowledge the shutdown signal and before exiting the program.
      */
-    void tidyUp(const std::string & finalMessage) const;
+    void tidyUp(const std::string & finalMessage);
+    /**
+     * Write the timings of the round, the hop rate, and the per-hop latency percentiles as a single-line JSON object to the stats file, 
+     * which gets one line per round of a session. The shutdown time of a round that is followed by another is the time taken to collect the trace logs.
+     * This function should be called after tidying up or collecting the trace logs, once every phase of the round has been timed.
+     * @param potatoes the potatoes received at the end of the game
+     */
+    void writeStats(const std::vector<Potato> & potatoes) const;
 };
 #endif
\ No newline at end of file
@@ -1,16 +1,143 @@
 #include <iostream>
 #include <cstdlib>
+#include <fstream>
+#include "game.hpp"
 #include "ringmaster.hpp"
 
 int main(int argc, char * argv[]) {
-    if (argc != 4) {
-        std::cerr << "Usage: ringmaster <port> <num_players> <num_hops>" << std::endl;
+    if (argc == 3 && std::string(argv[1]) == "--decode-trace") {
+        std::ifstream in(argv[2], std::ios::binary);
+        if (!in) {
+            std::cerr << "Could not open trace file " << argv[2] << std::endl;
+            return EXIT_FAILURE;
+        }
+        try {
+            decodeBinaryTrace(in, std::cout);
+        } catch (const std::exception & e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    // A shard ringmaster takes the address of the root in place of the size of the game, which the root decides
+    bool shard = argc > 1 && std::string(argv[1]) == "--shard";
+    if (argc < (shard ? 5 : 4)) {
+        std::cerr << "Usage: ringmaster <port> <num_players> <num_hops> [--distributed-trace] [--potatoes <num_potatoes>] [--timestamps] [--latency-report] [--socket-profile default|latency|throughput] [--local-transport tcp|unix|shm] [--topology ring|torus|hypercube|random] [--degree <degree>] [--topology-seed <seed>] [--seed <seed>] [--record <file>] [--replay <file>] [--shards <num_shards>] [--rounds <num_rounds>] [--checkpoint <num_hops>] [--stats <file>] [--metrics <file>] [--metrics-interval <ms>] [--trace-file <file>]\n"
+                  << "       ringmaster --shard <root_address> <root_port> <port> [--socket-profile default|latency|throughput]\n"
+                  << "       ringmaster --decode-trace <file>" << std::endl;
         return EXIT_FAILURE;
     }
     srand((unsigned int) time(NULL));
-    int port = std::stoi(argv[1]);
-    int numPlayers = std::stoi(argv[2]);
-    int numHops = std::stoi(argv[3]);
+    int port = std::stoi(argv[shard ? 4 : 1]);
+    int numPlayers = shard ? 0 : std::stoi(argv[2]);
+    int numHops = shard ? 0 : std::stoi(argv[3]);
+    RingmasterOptions options;
+    options.seed = static_cast<std::uint64_t>(rand());
+    bool topologySeedSet = false;
+    for (int i = shard ? 5 : 4; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--distributed-trace") {
+            options.distributedTrace = true;
+        }
+        else if (option == "--timestamps") {
+            options.timestamps = true;
+        }
+        else if (option == "--latency-report") {
+            options.timestamps = true;
+            options.latencyReport = true;
+        }
+        else if (option == "--socket-profile" && i + 1 < argc) {
+            if (!Socket::parseProfile(argv[++i], options.socketProfile)) {
+                std::cerr << "Unknown socket profile: " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--local-transport" && i + 1 < argc) {
+            if (!parseTransport(argv[++i], options.localTransport)) {
+                std::cerr << "Unknown transport: " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--topology" && i + 1 < argc) {
+            if (!parseTopology(argv[++i], options.topology.kind)) {
+                std::cerr << "Unknown topology: " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--degree" && i + 1 < argc) {
+            options.topology.degree = std::stoi(argv[++i]);
+        }
+        else if (option == "--topology-seed" && i + 1 < argc) {
+            options.topology.seed = std::stoull(argv[++i]);
+            topologySeedSet = true;
+        }
+        else if (option == "--seed" && i + 1 < argc) {
+            options.seed = std::stoull(argv[++i]);
+        }
+        else if (option == "--record" && i + 1 < argc) {
+            options.recordFile = argv[++i];
+        }
+        else if (option == "--replay" && i + 1 < argc) {
+            options.replayFile = argv[++i];
+        }
+        else if (option == "--shards" && i + 1 < argc) {
+            options.numShards = std::stoi(argv[++i]);
+        }
+        else if (option == "--rounds" && i + 1 < argc) {
+            options.rounds = std::stoi(argv[++i]);
+            if (options.rounds <= 0) {
+                std::cerr << "Number of rounds must be positive." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--checkpoint" && i + 1 < argc) {
+            options.checkpointInterval = std::stoi(argv[++i]);
+            if (options.checkpointInterval <= 0) {
+                std::cerr << "Checkpoint interval must be positive." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--stats" && i + 1 < argc) {
+            options.statsFile = argv[++i];
+        }
+        else if (option == "--trace-file" && i + 1 < argc) {
+            options.traceFile = argv[++i];
+        }
+        else if (option == "--metrics" && i + 1 < argc) {
+            options.metricsFile = argv[++i];
+        }
+        else if (option == "--metrics-interval" && i + 1 < argc) {
+            options.metricsIntervalMs = std::stoi(argv[++i]);
+            if (options.metricsIntervalMs <= 0) {
+                std::cerr << "Metrics interval must be positive." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--potatoes" && i + 1 < argc) {
+            options.numPotatoes = std::stoi(argv[++i]);
+            if (options.numPotatoes <= 0) {
+                std::cerr << "Number of potatoes must be positive." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (!topologySeedSet) {
+        options.topology.seed = options.seed; // A single seed reproduces the whole game
+    }
+    if (shard) {
+        try {
+            Ringmaster ringmaster(port, 0, options);
+            ringmaster.runShard(argv[2], static_cast<std::uint16_t>(std::stoi(argv[3])));
+        } catch (const std::exception & e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
     if (numPlayers <= 1) {
         std::cerr << "Number of players must be greater than 1." << std::endl;
         return EXIT_FAILURE;
@@ -19,21 +146,33 @@ int main(int argc, char * argv[]) {
         std::cerr << "Number of hops must be non-negative." << std::endl;
         return EXIT_FAILURE;
     }
-    else if (numHops > 512) {
-        std::cerr << "Number of hops must be less than or equal to 512." << std::endl;
+    if (options.numShards < 0 || options.numShards > numPlayers) {
+        std::cerr << "Number of shards must be between 0 and the number of players." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (options.checkpointInterval > 0 && (options.numShards > 0 || !options.replayFile.empty())) {
+        // The shards do not relay checkpoints, and the recorded decisions name neighbors by their place in tables that relinking changes
+        std::cerr << "Checkpoints cannot be combined with shards or a replay." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string problem = checkTopology(options.topology, numPlayers);
+    if (!problem.empty()) {
+        std::cerr << problem << std::endl;
         return EXIT_FAILURE;
     }
 
     try {
-        Ringmaster ringmaster(port, numPlayers);
+        Ringmaster ringmaster(port, numPlayers, options);
         int gameInfo = ringmaster.startGame(numHops);
         if (gameInfo == 0) {
-            Potato potato(0);
-            ringmaster.endGame(potato, gameInfo);
+            ringmaster.endGame(std::vector<Potato>(), gameInfo);
         }
         else {
-            Potato potato = ringmaster.waitForPotato();
-            ringmaster.endGame(potato, gameInfo);
+            for (int round = 1; round < options.rounds; ++round) {
+                ringmaster.nextRound(ringmaster.waitForPotatoes(), numHops); // The players stay connected to each other between rounds
+            }
+            std::vector<Potato> potatoes = ringmaster.waitForPotatoes();
+            ringmaster.endGame(potatoes, gameInfo);
         }
     } catch (const std::exception & e) {
         std::cerr << "Error: " << e.what() << std::endl;
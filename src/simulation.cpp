@@ -0,0 +1,168 @@
+#include "simulation.hpp"
+#include "game.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+
+namespace {
+    // Number of empty polls of its queues after which an idle worker starts yielding its CPU
+    constexpr int SPIN_BEFORE_YIELD = 64;
+}
+
+Simulation::Simulation(int numPlayers, int numHops, const SimulationOptions & options)
+    : numPlayers(numPlayers), numHops(numHops), options_(options), neighbors(buildTopology(options.topology, numPlayers)), stop(false) {
+    numWorkers = options_.numThreads > 0 ? options_.numThreads : static_cast<int>(std::thread::hardware_concurrency());
+    if (numWorkers <= 0) {
+        numWorkers = 1;
+    }
+    if (numWorkers > numPlayers) {
+        numWorkers = numPlayers;
+    }
+    playersPerWorker = (numPlayers + numWorkers - 1) / numWorkers;
+    numWorkers = (numPlayers + playersPerWorker - 1) / playersPerWorker;
+
+    workers.resize(numWorkers);
+    for (int i = 0; i < numWorkers; ++i) {
+        workers[i].firstPlayer = i * playersPerWorker;
+        workers[i].lastPlayer = std::min(numPlayers, (i + 1) * playersPerWorker);
+    }
+
+    // No queue ever holds more than every potato of the game at once
+    links.resize((numWorkers + 1) * (numWorkers + 1));
+    for (int from = 0; from <= numWorkers; ++from) {
+        for (int to = 0; to <= numWorkers; ++to) {
+            if (from != to) {
+                links[from * (numWorkers + 1) + to].reset(new SpscQueue<Message>(options_.numPotatoes));
+            }
+        }
+    }
+}
+
+SpscQueue<Simulation::Message> & Simulation::link(int from, int to) {
+    return *links[from * (numWorkers + 1) + to];
+}
+
+void Simulation::push(SpscQueue<Message> & queue, Message && message) {
+    while (!queue.push(std::move(message))) {
+        std::this_thread::yield();
+    }
+}
+
+int Simulation::ownerOf(int player) const {
+    return player / playersPerWorker;
+}
+
+void Simulation::handle(int index, Message && message) {
+    const std::vector<int> & targetNeighbors = neighbors[message.target];
+    std::vector<TraceLogEntry> unused; // Simulated potatoes always carry their trace
+
+    std::uint32_t potatoId = message.potato.getId();
+    std::uint32_t seq = message.potato.getSeq();
+    int next = takeHop(message.potato, message.target + 1, targetNeighbors.size(), [this, &message, potatoId, seq] {
+        return hopRandom(options_.seed, static_cast<std::uint32_t>(message.target + 1), potatoId, seq);
+    }, unused);
+    if (next == PASS_TO_RINGMASTER) {
+        push(link(index, numWorkers), std::move(message));
+        return;
+    }
+
+    message.target = targetNeighbors[next];
+    int owner = ownerOf(message.target);
+    if (owner == index) {
+        workers[index].local.push_back(std::move(message));
+    } else {
+        push(link(index, owner), std::move(message));
+    }
+}
+
+void Simulation::runWorker(int index) {
+    Worker & worker = workers[index];
+    Message message;
+    int idle = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        bool worked = false;
+        for (int from = 0; from <= numWorkers; ++from) {
+            if (from != index) {
+                while (link(from, index).pop(message)) {
+                    handle(index, std::move(message));
+                    worked = true;
+                }
+            }
+        }
+        // Only handle the local potatoes already queued, so that the other queues get polled in between
+        for (std::size_t pending = worker.local.size(); pending > 0; --pending) {
+            message = std::move(worker.local.front());
+            worker.local.pop_front();
+            handle(index, std::move(message));
+            worked = true;
+        }
+
+        if (worked) {
+            idle = 0;
+        } else if (++idle > SPIN_BEFORE_YIELD) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+int Simulation::run() {
+    std::cout << "Potato Simulation\n";
+    std::cout << "Players = " << numPlayers << std::endl;
+    std::cout << "Hops = " << numHops << std::endl;
+    std::cout << "Threads = " << numWorkers << std::endl;
+    if (numHops <= 0) {
+        std::cout << "No hops specified. Ending game.\n";
+        return 0;
+    }
+
+    for (int i = 0; i < numWorkers; ++i) {
+        workers[i].thread = std::thread(&Simulation::runWorker, this, i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int id = 1; id <= options_.numPotatoes; ++id) {
+        Message message;
+        message.target = static_cast<int>(hopRandom(options_.seed, 0, id, 0) % numPlayers); // Same first player as the ringmaster would pick
+        message.potato = Potato(numHops);
+        message.potato.setId(id);
+        message.potato.decrementHops();
+        push(link(numWorkers, ownerOf(message.target)), std::move(message));
+    }
+
+    std::vector<Potato> potatoes;
+    Message message;
+    while (potatoes.size() < static_cast<std::size_t>(options_.numPotatoes)) {
+        bool received = false;
+        for (int from = 0; from < numWorkers; ++from) {
+            while (link(from, numWorkers).pop(message)) {
+                potatoes.push_back(std::move(message.potato));
+                received = true;
+            }
+        }
+        if (!received) {
+            std::this_thread::yield();
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    stop.store(true, std::memory_order_relaxed);
+    for (Worker & worker : workers) {
+        worker.thread.join();
+    }
+
+    std::sort(potatoes.begin(), potatoes.end(), [](const Potato & a, const Potato & b) {
+        return a.getId() < b.getId();
+    });
+    if (options_.printTraces) {
+        for (const Potato & potato : potatoes) {
+            writeTrace(std::cout, potato, options_.numPotatoes > 1);
+        }
+    }
+
+    double totalHops = static_cast<double>(numHops) * options_.numPotatoes;
+    std::cout << "Simulated " << static_cast<std::uint64_t>(totalHops) << " hops in " << elapsed << " s ("
+              << totalHops / elapsed << " hops/sec, " << elapsed * 1e9 / totalHops << " ns/hop)" << std::endl;
+    return 1;
+}
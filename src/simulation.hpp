@@ -0,0 +1,92 @@
+#pragma once
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "potato.hpp"
+#include "SpscQueue.hpp"
+#include "topology.hpp"
+
+/**
+ * Options that change how the simulation runs a game.
+ */
+struct SimulationOptions {
+    // Number of potatoes injected at the start of the game
+    int numPotatoes = 1;
+    // Number of worker threads the players are spread over, or 0 to use one per hardware thread
+    int numThreads = 0;
+    // Print the trace of every potato at the end of the game
+    bool printTraces = true;
+    // Graph the players are arranged in
+    TopologyOptions topology;
+    // Seed of the neighbor choices and of the first player of every potato, drawn as in the networked game
+    std::uint64_t seed = 0;
+};
+
+/**
+ * Runs a whole game inside one process: the ringmaster is the calling thread and the players are cooperative tasks 
+ * spread over a pool of worker threads, each owning a contiguous block of players. 
+ * Potatoes move between workers, and between the workers and the ringmaster, over lock-free single-producer single-consumer queues, 
+ * so the game logic can be measured without any kernel involvement.
+ */
+class Simulation {
+public:
+    Simulation(int numPlayers, int numHops, const SimulationOptions & options = SimulationOptions());
+
+    /**
+     * Run the game: inject the potatoes, let the workers pass them around until every potato is back at the ringmaster, 
+     * and then print the traces and the hop rate to standard output.
+     * @return 1 if the game was played, 0 if no hops were specified and there was no game to play
+     */
+    int run();
+private:
+    struct Message {
+        int target = 0; // Index of the player to deliver the potato to
+        Potato potato;
+    };
+
+    struct Worker {
+        int firstPlayer;
+        int lastPlayer; // One past the last player owned by the worker
+        std::deque<Message> local; // Potatoes passed between players owned by the same worker
+        std::thread thread;
+    };
+
+    int numPlayers;
+    int numHops;
+    SimulationOptions options_;
+    int numWorkers;
+    int playersPerWorker;
+    std::vector<Worker> workers;
+    std::vector<std::vector<int>> neighbors; // The neighbor table of every player, as the ringmaster would send it
+    // links[from * (numWorkers + 1) + to]; node numWorkers is the ringmaster, and a worker has no link to itself
+    std::vector<std::unique_ptr<SpscQueue<Message>>> links;
+    std::atomic<bool> stop;
+
+    /**
+     * Get the queue carrying potatoes from one node to another, where node numWorkers is the ringmaster.
+     */
+    SpscQueue<Message> & link(int from, int to);
+    /**
+     * Push a message onto a queue, yielding while the queue is full.
+     */
+    static void push(SpscQueue<Message> & queue, Message && message);
+    /**
+     * Get the index of the worker that owns the given player.
+     */
+    int ownerOf(int player) const;
+    /**
+     * The main loop of a worker thread, which handles every potato delivered to one of its players until the game is over.
+     */
+    void runWorker(int index);
+    /**
+     * Handle a potato on behalf of one of the worker's players and pass it on.
+     */
+    void handle(int index, Message && message);
+};
+#endif
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include "simulation.hpp"
+
+int main(int argc, char * argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: simulation <num_players> <num_hops> [--potatoes <num_potatoes>] [--threads <num_threads>] [--topology ring|torus|hypercube|random] [--degree <degree>] [--topology-seed <seed>] [--seed <seed>] [--quiet]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    srand((unsigned int) time(NULL));
+    int numPlayers = std::stoi(argv[1]);
+    int numHops = std::stoi(argv[2]);
+    SimulationOptions options;
+    options.seed = static_cast<std::uint64_t>(rand());
+    bool topologySeedSet = false;
+    for (int i = 3; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--potatoes" && i + 1 < argc) {
+            options.numPotatoes = std::stoi(argv[++i]);
+        }
+        else if (option == "--threads" && i + 1 < argc) {
+            options.numThreads = std::stoi(argv[++i]);
+        }
+        else if (option == "--topology" && i + 1 < argc) {
+            if (!parseTopology(argv[++i], options.topology.kind)) {
+                std::cerr << "Unknown topology: " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--degree" && i + 1 < argc) {
+            options.topology.degree = std::stoi(argv[++i]);
+        }
+        else if (option == "--topology-seed" && i + 1 < argc) {
+            options.topology.seed = std::stoull(argv[++i]);
+            topologySeedSet = true;
+        }
+        else if (option == "--seed" && i + 1 < argc) {
+            options.seed = std::stoull(argv[++i]);
+        }
+        else if (option == "--quiet") {
+            options.printTraces = false;
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (!topologySeedSet) {
+        options.topology.seed = options.seed; // A single seed reproduces the whole game
+    }
+    if (numPlayers <= 1) {
+        std::cerr << "Number of players must be greater than 1." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (numHops < 0) {
+        std::cerr << "Number of hops must be non-negative." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string problem = checkTopology(options.topology, numPlayers);
+    if (!problem.empty()) {
+        std::cerr << problem << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (options.numPotatoes <= 0 || options.numThreads < 0) {
+        std::cerr << "Number of potatoes must be positive and number of threads non-negative." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        Simulation simulation(numPlayers, numHops, options);
+        simulation.run();
+    } catch (const std::exception & e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
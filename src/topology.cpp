@@ -0,0 +1,180 @@
+#include "topology.hpp"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace {
+    // Number of random regular graphs drawn before giving up on finding a connected one
+    constexpr int MAX_GRAPH_ATTEMPTS = 1000;
+    // Number of random partners tried for a stub before the graph being drawn is abandoned
+    constexpr int MAX_PAIRING_TRIES = 100;
+
+    // Helper function
+    void addNeighbor(std::vector<int> & neighbors, int self, int neighbor) {
+        if (neighbor != self && std::find(neighbors.begin(), neighbors.end(), neighbor) == neighbors.end()) {
+            neighbors.push_back(neighbor);
+        }
+    }
+
+    // Helper function
+    int torusRows(int numPlayers) {
+        int rows = 1;
+        for (int d = 1; d * d <= numPlayers; ++d) {
+            if (numPlayers % d == 0) {
+                rows = d;
+            }
+        }
+        return rows;
+    }
+
+    // Helper function
+    bool isConnected(const std::vector<std::vector<int>> & graph) {
+        std::vector<bool> seen(graph.size(), false);
+        std::vector<int> stack = {0};
+        seen[0] = true;
+        std::size_t reached = 1;
+        while (!stack.empty()) {
+            int player = stack.back();
+            stack.pop_back();
+            for (int neighbor : graph[player]) {
+                if (!seen[neighbor]) {
+                    seen[neighbor] = true;
+                    ++reached;
+                    stack.push_back(neighbor);
+                }
+            }
+        }
+        return reached == graph.size();
+    }
+
+    // Helper function: pair up the stubs of the players one at a time, only ever with a partner that keeps the graph simple
+    bool drawRegularGraph(int numPlayers, int degree, std::mt19937_64 & rng, std::vector<std::vector<int>> & graph) {
+        graph.assign(numPlayers, std::vector<int>());
+        std::vector<int> stubs;
+        stubs.reserve(static_cast<std::size_t>(numPlayers) * degree);
+        for (int player = 0; player < numPlayers; ++player) {
+            stubs.insert(stubs.end(), degree, player);
+        }
+        while (!stubs.empty()) {
+            int a = stubs.back();
+            stubs.pop_back();
+            bool paired = false;
+            for (int tries = 0; tries < MAX_PAIRING_TRIES && !stubs.empty() && !paired; ++tries) {
+                std::size_t k = static_cast<std::size_t>(rng() % stubs.size());
+                int b = stubs[k];
+                if (b == a || std::find(graph[a].begin(), graph[a].end(), b) != graph[a].end()) {
+                    continue;
+                }
+                std::swap(stubs[k], stubs.back());
+                stubs.pop_back();
+                graph[a].push_back(b);
+                graph[b].push_back(a);
+                paired = true;
+            }
+            if (!paired) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+bool parseTopology(const std::string & name, TopologyKind & kind) {
+    if (name == "ring") {
+        kind = TopologyKind::Ring;
+    }
+    else if (name == "torus") {
+        kind = TopologyKind::Torus;
+    }
+    else if (name == "hypercube") {
+        kind = TopologyKind::Hypercube;
+    }
+    else if (name == "random") {
+        kind = TopologyKind::RandomRegular;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+const char * topologyName(TopologyKind kind) {
+    switch (kind) {
+        case TopologyKind::Torus:
+            return "torus";
+        case TopologyKind::Hypercube:
+            return "hypercube";
+        case TopologyKind::RandomRegular:
+            return "random";
+        default:
+            return "ring";
+    }
+}
+
+std::string checkTopology(const TopologyOptions & options, int numPlayers) {
+    if (numPlayers <= 1) {
+        return "Number of players must be greater than 1.";
+    }
+    if (options.kind == TopologyKind::Torus && torusRows(numPlayers) < 2) {
+        return "A torus needs a number of players that is the product of two numbers of at least 2.";
+    }
+    if (options.kind == TopologyKind::Hypercube && (numPlayers & (numPlayers - 1)) != 0) {
+        return "A hypercube needs a power of two players.";
+    }
+    if (options.kind == TopologyKind::RandomRegular) {
+        if (options.degree < 3 || options.degree >= numPlayers) {
+            return "The degree of a random regular graph must be at least 3 and less than the number of players.";
+        }
+        if ((static_cast<long long>(numPlayers) * options.degree) % 2 != 0) {
+            return "A random regular graph needs an even number of players or an even degree.";
+        }
+    }
+    return "";
+}
+
+std::vector<std::vector<int>> buildTopology(const TopologyOptions & options, int numPlayers) {
+    std::string problem = checkTopology(options, numPlayers);
+    if (!problem.empty()) {
+        throw std::runtime_error(problem);
+    }
+    std::vector<std::vector<int>> graph(numPlayers);
+    switch (options.kind) {
+        case TopologyKind::Ring:
+            for (int i = 0; i < numPlayers; ++i) {
+                addNeighbor(graph[i], i, (i + 1) % numPlayers);
+                addNeighbor(graph[i], i, (i - 1 + numPlayers) % numPlayers);
+            }
+            break;
+        case TopologyKind::Torus: {
+            int rows = torusRows(numPlayers);
+            int columns = numPlayers / rows;
+            for (int i = 0; i < numPlayers; ++i) {
+                int row = i / columns;
+                int column = i % columns;
+                addNeighbor(graph[i], i, row * columns + (column + 1) % columns);
+                addNeighbor(graph[i], i, row * columns + (column - 1 + columns) % columns);
+                addNeighbor(graph[i], i, ((row + 1) % rows) * columns + column);
+                addNeighbor(graph[i], i, ((row - 1 + rows) % rows) * columns + column);
+            }
+            break;
+        }
+        case TopologyKind::Hypercube:
+            for (int i = 0; i < numPlayers; ++i) {
+                for (int bit = 1; bit < numPlayers; bit <<= 1) {
+                    graph[i].push_back(i ^ bit);
+                }
+            }
+            break;
+        case TopologyKind::RandomRegular: {
+            std::mt19937_64 rng(options.seed);
+            for (int attempt = 0; attempt < MAX_GRAPH_ATTEMPTS; ++attempt) {
+                if (drawRegularGraph(numPlayers, options.degree, rng, graph) && isConnected(graph)) {
+                    return graph;
+                }
+            }
+            throw std::runtime_error("Could not draw a connected random regular graph");
+        }
+    }
+    return graph;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * The graphs the players can be arranged in.
+ */
+enum class TopologyKind : std::uint8_t {
+    Ring,          // Every player has a right and a left neighbor
+    Torus,         // A rows x columns grid whose edges wrap around, with rows the largest divisor of the number of players not above its square root; needs rows of at least 2
+    Hypercube,     // Players whose indices differ in exactly one bit are neighbors; needs a power of two players
+    RandomRegular, // A connected random graph in which every player has the same number of neighbors
+};
+
+/**
+ * Options that pick the graph the players are arranged in.
+ */
+struct TopologyOptions {
+    TopologyKind kind = TopologyKind::Ring;
+    // Number of neighbors of every player in a random regular graph
+    int degree = 3;
+    // Seed of the random regular graph; the same seed and number of players always give the same graph
+    std::uint64_t seed = 0;
+};
+
+/**
+ * Look up a topology by its name: "ring", "torus", "hypercube" or "random".
+ * @param name the name of the topology
+ * @param kind receives the topology if the name is known
+ * @return true if the name is known, false otherwise
+ */
+bool parseTopology(const std::string & name, TopologyKind & kind);
+/**
+ * Get the name of a topology, as accepted by parseTopology().
+ * @param kind the topology
+ * @return the name of the topology
+ */
+const char * topologyName(TopologyKind kind);
+
+/**
+ * Check whether a topology can arrange the given number of players.
+ * @param options the topology and its parameters
+ * @param numPlayers the number of players, which must be greater than 1
+ * @return an empty string if the players can be arranged, otherwise the reason they cannot
+ */
+std::string checkTopology(const TopologyOptions & options, int numPlayers);
+
+/**
+ * Compute the neighbor table of every player. The graph is undirected and connected, and has no self-loops or duplicate edges.
+ * In a ring, the right neighbor comes first and the left neighbor second, so that two players have a single neighbor each.
+ * @param options the topology and its parameters
+ * @param numPlayers the number of players, which must be greater than 1
+ * @return the 0-based indices of the neighbors of every player, indexed by the 0-based index of the player
+ * @throws std::runtime_error if checkTopology() rejects the topology, or if no connected random regular graph is found
+ */
+std::vector<std::vector<int>> buildTopology(const TopologyOptions & options, int numPlayers);
+#endif
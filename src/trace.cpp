@@ -0,0 +1,59 @@
+#include "trace.hpp"
+
+#include <algorithm>
+
+namespace {
+    // Helper function
+    std::size_t floorLog2(std::size_t value) {
+        return static_cast<std::size_t>(63 - __builtin_clzll(static_cast<unsigned long long>(value)));
+    }
+}
+
+Trace::Trace(const Trace & other) : size_(other.size_) {
+    other.forEachChunk([this](const int * entries, std::size_t count) {
+        std::size_t capacity = chunkCapacity(chunks.size());
+        chunks.emplace_back(new int[capacity]);
+        std::copy(entries, entries + count, chunks.back().get());
+    });
+}
+
+Trace & Trace::operator=(const Trace & other) {
+    if (this != &other) {
+        Trace copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+std::size_t Trace::chunkCapacity(std::size_t chunk) {
+    return FIRST_CHUNK_CAPACITY << chunk;
+}
+
+void Trace::push_back(int playerId) {
+    std::size_t position = size_ + FIRST_CHUNK_CAPACITY;
+    std::size_t chunk = floorLog2(position) - floorLog2(FIRST_CHUNK_CAPACITY);
+    if (chunk == chunks.size()) {
+        chunks.emplace_back(new int[chunkCapacity(chunk)]);
+    }
+    chunks[chunk][position - chunkCapacity(chunk)] = playerId;
+    size_++;
+}
+
+int Trace::operator[](std::size_t index) const {
+    std::size_t position = index + FIRST_CHUNK_CAPACITY;
+    std::size_t chunk = floorLog2(position) - floorLog2(FIRST_CHUNK_CAPACITY);
+    return chunks[chunk][position - chunkCapacity(chunk)];
+}
+
+std::size_t Trace::size() const {
+    return size_;
+}
+
+bool Trace::empty() const {
+    return size_ == 0;
+}
+
+void Trace::clear() {
+    chunks.clear();
+    size_ = 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * A growable sequence of player IDs, stored in chunks whose capacity doubles with every chunk.
+ * Growing never moves the entries that are already stored, so appending is amortized O(1) without any realloc-copy,
+ * and a short trace only occupies its first, small chunk.
+ */
+class Trace {
+public:
+    Trace() = default;
+    ~Trace() = default;
+    Trace(const Trace & other);
+    Trace & operator=(const Trace & other);
+    Trace(Trace && other) noexcept = default;
+    Trace & operator=(Trace && other) noexcept = default;
+
+    /**
+     * Append the given player ID to the end of the trace, allocating a new chunk if the last one is full.
+     * @param playerId the player ID to append
+     */
+    void push_back(int playerId);
+
+    /**
+     * Get the player ID at the given position of the trace.
+     * @param index the position of the player ID, which must be less than size()
+     * @return the player ID at the given position
+     */
+    int operator[](std::size_t index) const;
+
+    /**
+     * Get the number of player IDs stored in the trace.
+     * @return the number of player IDs stored in the trace
+     */
+    std::size_t size() const;
+    /**
+     * Check if the trace is empty.
+     * @return true if the trace has no entries, false otherwise
+     */
+    bool empty() const;
+
+    /**
+     * Remove all entries from the trace and release its chunks.
+     */
+    void clear();
+
+    /**
+     * Call the given function once for every chunk of the trace, in order, with a pointer to the chunk's entries 
+     * and the number of entries used in that chunk. This is the fastest way to walk the whole trace.
+     * @param visit a callable taking (const int * entries, std::size_t count)
+     */
+    template <typename Visitor>
+    void forEachChunk(Visitor visit) const {
+        std::size_t remaining = size_;
+        for (std::size_t k = 0; k < chunks.size() && remaining > 0; ++k) {
+            std::size_t count = remaining < chunkCapacity(k) ? remaining : chunkCapacity(k);
+            visit(chunks[k].get(), count);
+            remaining -= count;
+        }
+    }
+private:
+    // Capacity of the first chunk; chunk k holds FIRST_CHUNK_CAPACITY << k entries
+    static constexpr std::size_t FIRST_CHUNK_CAPACITY = 32;
+
+    std::vector<std::unique_ptr<int[]>> chunks;
+    std::size_t size_ = 0;
+
+    static std::size_t chunkCapacity(std::size_t chunk);
+};
+
+/**
+ * A single entry of a player's trace log, recorded for every hop of a potato with a distributed trace.
+ */
+struct TraceLogEntry {
+    std::uint32_t potatoId;
+    std::uint32_t seq;
+    int playerId;
+    int latency; // Nanoseconds since the previous hop if the potato records timestamps, otherwise 0
+    std::uint16_t generation; // Generation of the potato; a hop taken again after the potato was re-injected has a later one
+};
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef WIRE_HPP
+#define WIRE_HPP
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Helpers shared by the encoders and decoders of the messages exchanged between the ringmaster and the players
+
+inline void putU16(std::vector<char> & out, std::size_t offset, std::uint16_t value) {
+    std::uint16_t value_net = htons(value);
+    std::memcpy(out.data() + offset, &value_net, sizeof(value_net));
+}
+
+inline std::uint16_t getU16(const char * data) {
+    std::uint16_t value_net;
+    std::memcpy(&value_net, data, sizeof(value_net));
+    return ntohs(value_net);
+}
+
+inline void putU32(std::vector<char> & out, std::size_t offset, std::uint32_t value) {
+    std::uint32_t value_net = htonl(value);
+    std::memcpy(out.data() + offset, &value_net, sizeof(value_net));
+}
+
+inline void appendU32(std::vector<char> & out, std::uint32_t value) {
+    out.resize(out.size() + sizeof(value));
+    putU32(out, out.size() - sizeof(value), value);
+}
+
+inline std::uint32_t getU32(const char * data) {
+    std::uint32_t value_net;
+    std::memcpy(&value_net, data, sizeof(value_net));
+    return ntohl(value_net);
+}
+
+inline void putU64(std::vector<char> & out, std::size_t offset, std::uint64_t value) {
+    putU32(out, offset, static_cast<std::uint32_t>(value >> 32));
+    putU32(out, offset + 4, static_cast<std::uint32_t>(value));
+}
+
+inline std::uint64_t getU64(const char * data) {
+    return (static_cast<std::uint64_t>(getU32(data)) << 32) | getU32(data + 4);
+}
+
+inline void putVarint(std::vector<char> & out, std::uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Longest encoding of a 32-bit varint
+constexpr std::size_t MAX_VARINT_SIZE = 5;
+
+inline char * putVarint(char * out, std::uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<char>(value);
+    return out;
+}
+
+inline std::uint32_t getVarint(const char * & pos, const char * end) {
+    std::uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (pos == end) {
+            throw std::runtime_error("Truncated varint");
+        }
+        std::uint8_t byte = static_cast<std::uint8_t>(*pos++);
+        value |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Malformed varint");
+}
+
+// Zigzag encoding keeps small negative deltas (e.g. passing to the left neighbor) in a single byte
+inline std::uint32_t zigzag(std::int32_t value) {
+    return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+inline std::int32_t unzigzag(std::uint32_t value) {
+    return static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1);
+}
+#endif